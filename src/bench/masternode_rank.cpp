@@ -0,0 +1,95 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "masternodeman.h"
+#include "random.h"
+
+/* Number of synthetic masternodes in the list */
+static const int MN_COUNT = 5000;
+/* Number of rank queries per iteration (e.g. payment votes for a block) */
+static const int RANK_QUERIES = 100;
+
+static std::vector<CMasternode> GetSyntheticMasternodes(FastRandomContext& rand)
+{
+    std::vector<CMasternode> vMasternodes(MN_COUNT);
+    for (CMasternode& mn : vMasternodes) {
+        mn.vin = CTxIn(COutPoint(rand.rand256(), 0));
+        mn.sigTime = 0;
+        mn.unitTest = true;
+    }
+    return vMasternodes;
+}
+
+// Rank of a masternode, calculating the scores of the full list at each query
+static void MasternodeRankUncached(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    const std::vector<CMasternode>& vMasternodes = GetSyntheticMasternodes(rand);
+    const uint256 hash = rand.rand256();
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < RANK_QUERIES; i++) {
+            const CTxIn& vin = vMasternodes[rand.randrange(MN_COUNT)].vin;
+            std::vector<std::pair<int64_t, CTxIn>> vecMasternodeScores;
+            for (const CMasternode& mn : vMasternodes) {
+                vecMasternodeScores.emplace_back(mn.CalculateScore(hash).GetCompact(false), mn.vin);
+            }
+            std::sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(),
+                    [](const std::pair<int64_t, CTxIn>& a, const std::pair<int64_t, CTxIn>& b) { return a.first < b.first; });
+            for (const auto& s : vecMasternodeScores) {
+                if (s.second.prevout == vin.prevout) break;
+            }
+        }
+    }
+}
+
+// Rank of a masternode, with the scores table cached per block hash
+static void MasternodeRankCached(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    FastRandomContext rand(true);
+    std::vector<CMasternode> vMasternodes = GetSyntheticMasternodes(rand);
+
+    CMasternodeMan man;
+    for (CMasternode& mn : vMasternodes) {
+        man.Add(mn);
+    }
+
+    // fake chain tip, to look up the block hash of the scores
+    uint256 blockHash = rand.rand256();
+    CBlockIndex index;
+    index.nHeight = 1000;
+    index.phashBlock = &blockHash;
+    man.SetBestHeight(index.nHeight);
+    man.CacheBlockHash(&index);
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < RANK_QUERIES; i++) {
+            const CTxIn& vin = vMasternodes[rand.randrange(MN_COUNT)].vin;
+            man.GetMasternodeRank(vin, index.nHeight + 1, 0, false);
+        }
+    }
+}
+
+// Building of the scores table, for a new block hash at every iteration
+static void MasternodeScoresBuild(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    std::vector<MasternodeRef> vMasternodes;
+    for (const CMasternode& mn : GetSyntheticMasternodes(rand)) {
+        vMasternodes.emplace_back(std::make_shared<CMasternode>(mn));
+    }
+
+    while (state.KeepRunning()) {
+        CMasternodeScores scores;
+        scores.Build(rand.rand256(), vMasternodes, 0);
+    }
+}
+
+BENCHMARK(MasternodeRankUncached);
+BENCHMARK(MasternodeRankCached);
+BENCHMARK(MasternodeScoresBuild);
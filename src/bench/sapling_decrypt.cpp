@@ -0,0 +1,83 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "sapling/address.hpp"
+#include "sapling/note.hpp"
+#include "sapling/sapling_transaction.h"
+
+/* Number of shielded outputs (e.g. the ones of a block being scanned) */
+static const int OUTPUT_COUNT = 100;
+/* Number of incoming viewing keys of the wallet */
+static const int IVK_COUNT = 8;
+
+static OutputDescription GetOutputTo(const libzcash::SaplingPaymentAddress& addr)
+{
+    libzcash::SaplingNote note(addr, 1000);
+    libzcash::SaplingNotePlaintext pt(note, {});
+    auto res = pt.encrypt(addr.pk_d);
+    assert(res);
+
+    OutputDescription output;
+    output.cmu = *note.cmu();
+    output.ephemeralKey = res->second.get_epk();
+    output.encCiphertext = res->first;
+    return output;
+}
+
+// One output in ten is sent to the last key of the wallet, the others to foreign addresses
+static void GetSyntheticOutputs(std::vector<OutputDescription>& vOutputs, std::vector<libzcash::SaplingIncomingViewingKey>& vIvk)
+{
+    for (int i = 0; i < IVK_COUNT; i++) {
+        vIvk.emplace_back(libzcash::SaplingSpendingKey::random().full_viewing_key().in_viewing_key());
+    }
+    const libzcash::SaplingPaymentAddress addr = *vIvk.back().address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+    for (int i = 0; i < OUTPUT_COUNT; i++) {
+        vOutputs.emplace_back(GetOutputTo(i % 10 == 0 ? addr : libzcash::SaplingSpendingKey::random().default_address()));
+    }
+}
+
+// Trial decryption trying each (output, ivk) pair in sequence
+static void SaplingTrialDecryptSerial(benchmark::State& state)
+{
+    std::vector<OutputDescription> vOutputs;
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvk;
+    GetSyntheticOutputs(vOutputs, vIvk);
+
+    while (state.KeepRunning()) {
+        int nFound = 0;
+        for (const OutputDescription& output : vOutputs) {
+            for (const auto& ivk : vIvk) {
+                if (libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cmu)) {
+                    nFound++;
+                    break;
+                }
+            }
+        }
+        assert(nFound == OUTPUT_COUNT / 10);
+    }
+}
+
+// Trial decryption with the pairs split across the cores
+static void SaplingTrialDecryptBatch(benchmark::State& state)
+{
+    std::vector<OutputDescription> vOutputs;
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvk;
+    GetSyntheticOutputs(vOutputs, vIvk);
+    std::vector<const OutputDescription*> vOutputPtrs;
+    for (const OutputDescription& output : vOutputs) {
+        vOutputPtrs.emplace_back(&output);
+    }
+
+    while (state.KeepRunning()) {
+        int nFound = 0;
+        for (const auto& result : libzcash::TrialDecryptSaplingOutputs(vOutputPtrs, vIvk)) {
+            if (result) nFound++;
+        }
+        assert(nFound == OUTPUT_COUNT / 10);
+    }
+}
+
+BENCHMARK(SaplingTrialDecryptSerial);
+BENCHMARK(SaplingTrialDecryptBatch);
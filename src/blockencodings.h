@@ -0,0 +1,211 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef AllForOneBusiness_BLOCKENCODINGS_H
+#define AllForOneBusiness_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+
+#include <memory>
+
+class CTxMemPool;
+
+/** Upper bound on the number of transactions of a (compact) block: each transaction takes
+ *  at least 60 bytes, so a block can't hold more than MAX_BLOCK_SIZE_CURRENT / 60 of them */
+static const unsigned int MAX_COMPACT_BLOCK_TXS = 2000000 / 60;
+
+/** Transactions of a block requested with a getblocktxn message
+ *  (indexes differentially encoded on the wire) */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(blockhash);
+        uint64_t indexes_size = (uint64_t)indexes.size();
+        READWRITE(COMPACTSIZE(indexes_size));
+        if (ser_action.ForRead()) {
+            if (indexes_size > MAX_COMPACT_BLOCK_TXS)
+                throw std::ios_base::failure("getblocktxn indexes overflowed the block size");
+            indexes.resize(indexes_size);
+            for (size_t i = 0; i < indexes.size(); i++) {
+                uint64_t index = 0;
+                READWRITE(COMPACTSIZE(index));
+                if (index > std::numeric_limits<uint16_t>::max())
+                    throw std::ios_base::failure("index overflowed 16 bits");
+                indexes[i] = index;
+            }
+
+            uint16_t offset = 0;
+            for (size_t i = 0; i < indexes.size(); i++) {
+                if (uint64_t(indexes[i]) + uint64_t(offset) > std::numeric_limits<uint16_t>::max())
+                    throw std::ios_base::failure("indexes overflowed 16 bits");
+                indexes[i] = indexes[i] + offset;
+                offset = indexes[i] + 1;
+            }
+        } else {
+            for (size_t i = 0; i < indexes.size(); i++) {
+                uint64_t index = indexes[i] - (i == 0 ? 0 : (indexes[i - 1] + 1));
+                READWRITE(COMPACTSIZE(index));
+            }
+        }
+    }
+};
+
+/** Transactions of a block sent with a blocktxn message, in reply to a getblocktxn */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransactionRef> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(blockhash);
+        uint64_t txn_size = (uint64_t)txn.size();
+        READWRITE(COMPACTSIZE(txn_size));
+        if (ser_action.ForRead()) {
+            if (txn_size > MAX_COMPACT_BLOCK_TXS)
+                throw std::ios_base::failure("blocktxn transactions overflowed the block size");
+            txn.resize(txn_size);
+        }
+        for (size_t i = 0; i < txn.size(); i++)
+            READWRITE(txn[i]);
+    }
+};
+
+/** A transaction sent in full within a compact block
+ *  (index differentially encoded on the wire) */
+struct PrefilledTransaction {
+    uint16_t index;
+    CTransactionRef tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        uint64_t idx = index;
+        READWRITE(COMPACTSIZE(idx));
+        if (idx > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("index overflowed 16-bits");
+        index = idx;
+        READWRITE(tx);
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, // Invalid object, peer is sending bogus crap
+    READ_STATUS_FAILED,  // Failed to process object (e.g. short id collision), request the full block
+};
+
+/** A block relayed as its header, the short ids of its transactions and the
+ *  transactions the receiver can't have in its mempool (BIP152, adapted to PoS):
+ *  the coinbase and, for PoS blocks, the coinstake are always prefilled, and the
+ *  block signature is sent along with the header.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+    friend class PartiallyDownloadedBlock;
+
+    static const int SHORTTXIDS_LENGTH = 6;
+
+protected:
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+
+public:
+    CBlockHeader header;
+    // PoS block signature (empty for PoW blocks)
+    std::vector<unsigned char> vchBlockSig;
+
+    // Dummy for deserialization
+    CBlockHeaderAndShortTxIDs() {}
+
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(header);
+        READWRITE(nonce);
+
+        uint64_t shorttxids_size = (uint64_t)shorttxids.size();
+        READWRITE(COMPACTSIZE(shorttxids_size));
+        if (ser_action.ForRead()) {
+            if (shorttxids_size > MAX_COMPACT_BLOCK_TXS)
+                throw std::ios_base::failure("short ids overflowed the block size");
+            shorttxids.resize(shorttxids_size);
+            for (size_t i = 0; i < shorttxids.size(); i++) {
+                uint32_t lsb = 0; uint16_t msb = 0;
+                READWRITE(lsb);
+                READWRITE(msb);
+                shorttxids[i] = (uint64_t(msb) << 32) | uint64_t(lsb);
+            }
+        } else {
+            for (size_t i = 0; i < shorttxids.size(); i++) {
+                uint32_t lsb = shorttxids[i] & 0xffffffff;
+                uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+                READWRITE(lsb);
+                READWRITE(msb);
+            }
+        }
+
+        READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
+
+        if (ser_action.ForRead())
+            FillShortTxIDSelector();
+    }
+};
+
+/** A block being reconstructed from a compact block, the mempool and
+ *  (if any is missing) the transactions requested to the peer
+ */
+class PartiallyDownloadedBlock
+{
+protected:
+    std::vector<CTransactionRef> txn_available;
+    size_t prefilled_count = 0, mempool_count = 0;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    size_t GetTxCount() const { return txn_available.size(); }
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing) const;
+};
+
+#endif // AllForOneBusiness_BLOCKENCODINGS_H
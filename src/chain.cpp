@@ -64,7 +64,7 @@ const CBlockIndex* CChain::FindFork(const CBlockIndex* pindex) const
     return pindex;
 }
 
-CBlockIndex::CBlockIndex(const CBlock& block):
+CBlockIndex::CBlockIndex(const CBlockHeader& block):
         nVersion{block.nVersion},
         hashMerkleRoot{block.hashMerkleRoot},
         hashFinalSaplingRoot(block.hashFinalSaplingRoot),
@@ -74,8 +74,7 @@ CBlockIndex::CBlockIndex(const CBlock& block):
 {
     if(block.nVersion > 3 && block.nVersion < 7)
         nAccumulatorCheckpoint = block.nAccumulatorCheckpoint;
-    if (block.IsProofOfStake())
-        SetProofOfStake();
+    // the proof-of-stake flag is set once the full block is received (ReceivedBlockTransactions)
 }
 
 std::string CBlockIndex::ToString() const
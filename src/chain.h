@@ -240,7 +240,7 @@ public:
     uint32_t nSequenceId{0};
 
     CBlockIndex() {}
-    CBlockIndex(const CBlock& block);
+    CBlockIndex(const CBlockHeader& block);
 
     std::string ToString() const;
 
@@ -16,6 +16,7 @@
 bool CCoinsView::GetCoin(const COutPoint& outpoint, Coin& coin) const { return false; }
 bool CCoinsView::HaveCoin(const COutPoint& outpoint) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return UINT256_ZERO; }
+std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins,
@@ -33,6 +34,7 @@ CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
 bool CCoinsViewBacked::GetCoin(const COutPoint& outpoint, Coin& coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint& outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
+std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
@@ -64,8 +66,10 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint& outpoint) const
 {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.accessed = true;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
@@ -75,6 +79,7 @@ CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint& outpoint) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    ret->second.accessed = true;
     cachedCoinsUsage += memusage::DynamicUsage(ret->second.coin);
     return ret;
 }
@@ -108,16 +113,17 @@ void CCoinsViewCache::AddCoin(const COutPoint& outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    it->second.accessed = true;
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
-void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight)
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool potential_overwrite)
 {
     bool fCoinbase = tx.IsCoinBase();
     bool fCoinstake = tx.IsCoinStake();
     const uint256& txid = tx.GetHash();
     for (size_t i = 0; i < tx.vout.size(); ++i) {
-        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase, fCoinstake), false);
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase, fCoinstake), potential_overwrite);
     }
 }
 
@@ -247,6 +253,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins,
                     entry.coin = std::move(it->second.coin);
                     cachedCoinsUsage += memusage::DynamicUsage(entry.coin);
                     entry.flags = CCoinsCacheEntry::DIRTY;
+                    entry.accessed = true;
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -274,6 +281,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins,
                     itUs->second.coin = std::move(it->second.coin);
                     cachedCoinsUsage += memusage::DynamicUsage(itUs->second.coin);
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.accessed = true;
                     // NOTE: It is possible the child has a FRESH flag here in
                     // the event the entry we found in the parent is pruned. But
                     // we must not copy that FRESH flag to the parent as that
@@ -309,6 +317,55 @@ bool CCoinsViewCache::Flush()
     return fOk;
 }
 
+void CCoinsViewCache::TakeChanges(CCoinsCacheChanges& changes)
+{
+    // The usage is recalculated on the coins left in the cache
+    cachedCoinsUsage = 0;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = changes.mapCoins[it->first];
+            entry.flags = CCoinsCacheEntry::DIRTY;
+            if (it->second.coin.IsSpent()) {
+                // The base view knows it's spent from now on
+                cacheCoins.erase(it++);
+                continue;
+            }
+            entry.coin = it->second.coin;
+            // Same as the base view (not FRESH anymore)
+            it->second.flags = 0;
+        }
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        ++it;
+    }
+
+    // Sapling
+    for (CAnchorsSaplingMap::iterator it = cacheSaplingAnchors.begin(); it != cacheSaplingAnchors.end(); it++)
+        changes.mapSaplingAnchors[it->first] = std::move(it->second);
+    for (CNullifiersMap::iterator it = cacheSaplingNullifiers.begin(); it != cacheSaplingNullifiers.end(); it++)
+        changes.mapSaplingNullifiers[it->first] = it->second;
+    cacheSaplingAnchors.clear();
+    cacheSaplingNullifiers.clear();
+    changes.hashSaplingAnchor = hashSaplingAnchor;
+
+    changes.hashBlock = hashBlock;
+}
+
+size_t CCoinsViewCache::EvictCold()
+{
+    size_t nEvicted = 0;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.flags == 0 && !it->second.accessed) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            cacheCoins.erase(it++);
+            nEvicted++;
+        } else {
+            it->second.accessed = false;
+            ++it;
+        }
+    }
+    return nEvicted;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& outpoint)
 {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
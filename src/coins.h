@@ -19,6 +19,7 @@
 #include <stdint.h>
 
 #include <unordered_map>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -133,14 +134,15 @@ public:
 struct CCoinsCacheEntry {
     Coin coin; // The actual cached data.
     unsigned char flags;
+    bool accessed; // Used since the last eviction pass (see CCoinsViewCache::EvictCold).
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), accessed(false) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), accessed(false) {}
 };
 
 // Sapling
@@ -175,6 +177,17 @@ typedef std::unordered_map<uint256, CNullifiersCacheEntry, SaltedIdHasher> CNull
 
 typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
+/** The modifications of a CCoinsViewCache, taken out of it to be written to its base view
+ *  (see CCoinsViewCache::TakeChanges) */
+struct CCoinsCacheChanges
+{
+    CCoinsMap mapCoins;
+    uint256 hashBlock;
+    uint256 hashSaplingAnchor;
+    CAnchorsSaplingMap mapSaplingAnchors;
+    CNullifiersMap mapSaplingNullifiers;
+};
+
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
 {
@@ -210,6 +223,12 @@ public:
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
+    //! Retrieve the range of blocks that may have been only partially written.
+    //! If the database is in a consistent state, the result is the empty vector.
+    //! Otherwise, a two-element vector is returned consisting of the new and
+    //! the old block hash, in that order.
+    virtual std::vector<uint256> GetHeadBlocks() const;
+
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap& mapCoins,
@@ -250,6 +269,7 @@ public:
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
     bool HaveCoin(const COutPoint& outpoint) const override;
     uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView& viewIn);
     CCoinsViewCursor* Cursor() const override;
     size_t EstimateSize() const override;
@@ -358,6 +378,20 @@ public:
      */
     bool Flush();
 
+    /**
+     * Move the modifications applied to this cache to changes, for the caller to write them
+     * to the base view. Unlike Flush, the cache stays warm: the modified coins are kept as
+     * clean entries, only the spent ones (and the Sapling entries) are removed.
+     * The base view must serve the returned changes from then on.
+     */
+    void TakeChanges(CCoinsCacheChanges& changes);
+
+    /**
+     * Remove the clean entries not used since the previous call, and mark the remaining
+     * ones as not used. Returns the number of removed entries.
+     */
+    size_t EvictCold();
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is not modified.
      */
@@ -439,7 +473,8 @@ private:
 
 //! Utility function to add all of a transaction's outputs to a cache.
 // PIVX: It assumes that overwrites are never possible due to BIP34 always in effect
-void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight);
+// (potential_overwrite is only set when replaying blocks on a partially written view)
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool potential_overwrite = false);
 
 //! Utility function to find any unspent output with a given txid.
 const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
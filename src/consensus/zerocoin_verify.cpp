@@ -141,6 +141,11 @@ bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::Coi
         return false;
     }
 
+    return CheckZerocoinSpendSerialNotInChain(spend);
+}
+
+bool CheckZerocoinSpendSerialNotInChain(const libzerocoin::CoinSpend* spend)
+{
     //Reject serial's that are already in the blockchain
     int nHeightTx = 0;
     if (IsSerialInBlockchain(spend->getCoinSerialNumber(), nHeightTx))
@@ -150,6 +155,11 @@ bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::Coi
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    return ContextualCheckZerocoinSpendNoSerialCheck(*ptx, spend.get(), nHeight, hashBlock);
+}
+
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, const uint256& hashBlock)
 {
     const Consensus::Params& consensus = Params().GetConsensus();
@@ -9,6 +9,8 @@
 #include "script/interpreter.h"
 #include "zafochain.h"
 
+#include <memory>
+
 /** Context-independent validity checks */
 bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, bool fFakeSerialAttack = false);
 // Fake Serial attack Range
@@ -19,5 +21,40 @@ int CurrentPublicCoinSpendVersion();
 bool CheckPublicCoinSpendVersion(int version);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, const uint256& hashBlock);
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, const uint256& hashBlock);
+// Reject serials already spent in the blockchain (requires cs_main)
+bool CheckZerocoinSpendSerialNotInChain(const libzerocoin::CoinSpend* spend);
+
+/**
+ * Verification of the signature, spend type and serial range of a zerocoin spend
+ * (ContextualCheckZerocoinSpendNoSerialCheck), which doesn't need cs_main. Can be deferred
+ * to the check queue, to verify the spends of a block in parallel.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    const CTransaction* ptx;
+    // the parsed spend (a PublicCoinSpend for public spends)
+    std::shared_ptr<const libzerocoin::CoinSpend> spend;
+    int nHeight;
+    uint256 hashBlock;
+
+public:
+    CZerocoinSpendCheck() : ptx(nullptr), nHeight(0) {}
+    CZerocoinSpendCheck(const CTransaction& txIn, std::shared_ptr<const libzerocoin::CoinSpend> spendIn, int nHeightIn, const uint256& hashBlockIn) :
+        ptx(&txIn),
+        spend(std::move(spendIn)),
+        nHeight(nHeightIn),
+        hashBlock(hashBlockIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        spend.swap(check.spend);
+        std::swap(nHeight, check.nHeight);
+        std::swap(hashBlock, check.hashBlock);
+    }
+};
 
 #endif //PIVX_CONSENSUS_ZEROCOIN_VERIFY_H
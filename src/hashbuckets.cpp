@@ -0,0 +1,39 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashbuckets.h"
+
+#include "hash.h"
+
+#include <algorithm>
+
+CHashBuckets::CHashBuckets(std::vector<uint256> vHashes, unsigned int nBuckets)
+{
+    vDigests.resize(nBuckets ? nBuckets : GetBucketCount(vHashes.size()));
+
+    // sorted hashes, so that both sides commit to the same sequence per bucket
+    std::sort(vHashes.begin(), vHashes.end());
+    std::vector<CHashWriter> vWriters(vDigests.size(), CHashWriter(SER_GETHASH, 0));
+    for (const uint256& hash : vHashes) {
+        vWriters[GetBucket(hash)] << hash;
+    }
+    for (size_t i = 0; i < vDigests.size(); i++) {
+        vDigests[i] = vWriters[i].GetHash();
+    }
+}
+
+unsigned int CHashBuckets::GetBucketCount(size_t nItems)
+{
+    return std::max<size_t>(1, std::min<size_t>(MAX_HASH_BUCKETS, (nItems + HASH_BUCKET_ITEMS - 1) / HASH_BUCKET_ITEMS));
+}
+
+std::vector<bool> CHashBuckets::GetDifferences(const CHashBuckets& other) const
+{
+    std::vector<bool> vDiff(vDigests.size(), true);
+    if (other.vDigests.size() != vDigests.size()) return vDiff;
+    for (size_t i = 0; i < vDigests.size(); i++) {
+        vDiff[i] = vDigests[i] != other.vDigests[i];
+    }
+    return vDiff;
+}
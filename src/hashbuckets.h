@@ -0,0 +1,53 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef AllForOneBusiness_HASHBUCKETS_H
+#define AllForOneBusiness_HASHBUCKETS_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+/** Average number of items per bucket of a set digest */
+static const unsigned int HASH_BUCKET_ITEMS = 8;
+/** Maximum number of buckets of a set digest */
+static const unsigned int MAX_HASH_BUCKETS = 4096;
+
+/*
+ * Digest of a set of item hashes (e.g. the masternode list, or the votes of a
+ * budget proposal), split in buckets by hash value, each bucket committing to
+ * the sorted hashes that fall in it.
+ * A syncing node sends the digest of the items it already has: the peer builds
+ * the digest of its own items with the same number of buckets, and announces
+ * only the items of the buckets that differ.
+ */
+class CHashBuckets
+{
+public:
+    std::vector<uint256> vDigests;
+
+    CHashBuckets() {}
+    // Digest of vHashes in nBuckets buckets (by default, sized on the number of hashes)
+    explicit CHashBuckets(std::vector<uint256> vHashes, unsigned int nBuckets = 0);
+
+    static unsigned int GetBucketCount(size_t nItems);
+
+    bool IsValid() const { return !vDigests.empty() && vDigests.size() <= MAX_HASH_BUCKETS; }
+    unsigned int size() const { return vDigests.size(); }
+    unsigned int GetBucket(const uint256& hash) const { return hash.GetUint64(0) % vDigests.size(); }
+
+    // Flags of the buckets that differ from the ones of other (all of them, if the bucket count differs)
+    std::vector<bool> GetDifferences(const CHashBuckets& other) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(vDigests);
+    }
+};
+
+#endif // AllForOneBusiness_HASHBUCKETS_H
@@ -24,6 +24,7 @@
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/zerocoin_verify.h"
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
@@ -119,6 +120,12 @@ static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
 #define MIN_CORE_FILEDESCRIPTORS 150
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+static const char* DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* DEFAULT_SOCKETEVENTS = "select";
+#endif
+
 /** Used to pass flags to the Bind() function */
 enum BindFlags {
     BF_NONE = 0,
@@ -188,7 +195,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB* pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher* pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -234,6 +240,8 @@ void PrepareShutdown()
     MapPort(false);
 
     UnregisterValidationInterface(peerLogic.get());
+    // Don't destroy it while a background notification may still be running on it
+    SyncWithValidationInterfaceQueue();
     peerLogic.reset();
     g_connman.reset();
 
@@ -247,6 +255,10 @@ void PrepareShutdown()
     threadGroup.interrupt_all();
     threadGroup.join_all();
 
+    if (g_is_mempool_loaded && gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpMempool(mempool);
+    }
+
     if (fFeeEstimatesInitialized) {
         fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
         CAutoFile est_fileout(fsbridge::fopen(est_path, "wb"), SER_DISK, CLIENT_VERSION);
@@ -265,6 +277,9 @@ void PrepareShutdown()
             //record that client took the proper shutdown procedure
             pblocktree->WriteFlag("shutdown", true);
         }
+        // The scheduler thread is gone: deliver the notifications still queued
+        // (including the SetBestChain of the flush above) before the teardown
+        GetMainSignals().FlushBackgroundCallbacks();
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
@@ -278,6 +293,12 @@ void PrepareShutdown()
         delete pSporkDB;
         pSporkDB = NULL;
     }
+    delete pMasternodeDB;
+    pMasternodeDB = nullptr;
+    delete pBudgetDB;
+    pBudgetDB = nullptr;
+    delete pMasternodePaymentDB;
+    pMasternodePaymentDB = nullptr;
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         bitdb.Flush(true);
@@ -292,6 +313,7 @@ void PrepareShutdown()
 #endif
 
     // Disconnect all slots
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
     UnregisterAllValidationInterfaces();
 
 #ifndef WIN32
@@ -327,6 +349,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    g_logger->StopWriterThread();
 }
 
 /**
@@ -386,6 +409,11 @@ void OnRPCPreCommand(const CRPCCommand& cmd)
     if (strWarning != "" && !gArgs.GetBoolArg("-disablesafemode", DEFAULT_DISABLE_SAFEMODE) &&
         !cmd.okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, std::string("Safe mode: ") + strWarning);
+
+    // Let the wallet process the blocks and transactions notified so far,
+    // so that it answers consistently with the chain and the mempool
+    if (cmd.category == "wallet")
+        SyncWithValidationInterfaceQueue();
 }
 
 std::string HelpMessage(HelpMessageMode mode)
@@ -416,6 +444,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), AllForOneBusiness_PID_FILENAME));
@@ -434,6 +463,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), DEFAULT_MISBEHAVING_BANTIME));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s); -noconnect or -connect=0 alone to disable automatic connections"));
+    strUsage += HelpMessageOpt("-compactblocks", strprintf(_("Relay blocks as compact blocks, reconstructed from the mempool, with the peers supporting them (default: %u)"), DEFAULT_COMPACT_BLOCKS));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP address (default: 1 when listening and no -externalip)"));
     strUsage += HelpMessageOpt("-dns", strprintf(_("Allow DNS lookups for -addnode, -seednode and -connect (default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect/-noconnect)"));
@@ -451,6 +481,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
+    std::string strSocketEventsModes = "select";
+#ifdef HAVE_SYS_EPOLL_H
+    strSocketEventsModes += ", epoll";
+#endif
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: %s (default: %s)"), strSocketEventsModes, DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
@@ -484,6 +519,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf(_("Only accept block chain matching built-in checkpoints (default: %u)"), DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf(_("Force safe mode (default: %u)"), DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-deprecatedrpc=<method>", _("Allows deprecated RPC method(s) to be used"));
@@ -706,6 +742,12 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    // Reload the mempool of the last run, revalidating it against the tip
+    if (gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool(mempool);
+    }
+    g_is_mempool_loaded = !fRequestShutdown;
 }
 
 /** Sanity checks
@@ -785,6 +827,16 @@ bool AppInitServers()
     std::terminate();
 };
 
+static std::terminate_handler prevTerminateHandler = nullptr;
+
+[[noreturn]] static void terminate_handler_flush_log()
+{
+    // Don't lose the messages queued for the log writer thread (they may explain the failure)
+    g_logger->FlushBuffered();
+    if (prevTerminateHandler) prevTerminateHandler();
+    std::abort();
+}
+
 bool AppInitBasicSetup()
 {
 // ********************************************************* Step 1: setup
@@ -836,6 +888,7 @@ bool AppInitBasicSetup()
 #endif
 
     std::set_new_handler(new_handler_terminate);
+    prevTerminateHandler = std::set_terminate(terminate_handler_flush_log);
 
     return true;
 }
@@ -1044,8 +1097,22 @@ bool AppInit2()
     int nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     int nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    const std::string strSocketEventsMode = gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    SocketEventsMode socketEventsMode;
+    if (strSocketEventsMode == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef HAVE_SYS_EPOLL_H
+    } else if (strSocketEventsMode == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return UIError(strprintf(_("Invalid -socketevents ('%s') specified"), strSocketEventsMode));
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    // (select() can't watch the descriptors beyond FD_SETSIZE)
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return UIError(_("Not enough file descriptors available."));
@@ -1173,6 +1240,9 @@ bool AppInit2()
     if (gArgs.GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (gArgs.GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_BLOCKS);
+
     nMaxTipAge = gArgs.GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     if (!InitNUParams())
@@ -1181,6 +1251,8 @@ bool AppInit2()
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
     // Initialize elliptic curve code
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1210,6 +1282,9 @@ bool AppInit2()
         if (!g_logger->OpenDebugLog())
             return UIError(strprintf("Could not open debug log file %s", g_logger->m_file_path.string()));
     }
+    // From now on the logging threads don't wait for the disk (or the console)
+    if (g_logger->Enabled())
+        g_logger->StartWriterThread();
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1225,8 +1300,12 @@ bool AppInit2()
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSaplingProofCheck);
+            threadGroup.create_thread(&ThreadZerocoinSpendCheck);
+            threadGroup.create_thread(&ThreadHashSigCheck);
+        }
     }
 
     if (gArgs.IsArgSet("-sporkkey")) // spork priv key
@@ -1239,6 +1318,9 @@ bool AppInit2()
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
+    // Deliver the validation notifications to the wallet, ZMQ and the peer logic in the background
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
     // Initialize Sapling circuit parameters
     // LoadSaplingParams();
 
@@ -1652,6 +1734,24 @@ bool AppInit2()
                     }
                 }
 
+                // Record the block of the spent serials, if written by an older version: from the
+                // txindex, or re-scanning the blocks (the reindex below writes the new version)
+                if (!fReindexZerocoin || !fZerocoinActive) {
+                    LOCK(cs_main);
+                    int nSpendsVersion = 0;
+                    if (!zerocoinDB->ReadCoinSpendsVersion(nSpendsVersion) || nSpendsVersion < ZC_SPENDS_DB_VERSION) {
+                        if (fZerocoinActive && !fTxIndex) {
+                            fReindexZerocoin = true;
+                        } else {
+                            uiInterface.InitMessage(_("Upgrading zerocoin database..."));
+                            if (!UpgradeZerocoinSpendsDB()) {
+                                strLoadError = _("Error upgrading zerocoin database");
+                                break;
+                            }
+                        }
+                    }
+                }
+
                 // Drop all information from the zerocoinDB and repopulate
                 if (fReindexZerocoin && fZerocoinActive) {
                     LOCK(cs_main);
@@ -1800,34 +1900,15 @@ bool AppInit2()
 
     mnodeman.SetBestHeight(nChainHeight);
     LoadBlockHashesCache(mnodeman);
-    CMasternodeDB mndb;
-    CMasternodeDB::ReadResult readResult = mndb.Read(mnodeman);
-    if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrintf("Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+    pMasternodeDB = new CMasternodeDB(TIERTWO_DB_CACHE_SIZE);
+    pMasternodeDB->Read(mnodeman);
 
     uiInterface.InitMessage(_("Loading budget cache..."));
 
-    CBudgetDB budgetdb;
+    pBudgetDB = new CBudgetDB(TIERTWO_DB_CACHE_SIZE);
     const bool fDryRun = (nChainHeight <= 0);
     if (!fDryRun) budget.SetBestHeight(nChainHeight);
-    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budget, fDryRun);
-
-    if (readResult2 == CBudgetDB::FileError)
-        LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
-    else if (readResult2 != CBudgetDB::Ok) {
-        LogPrintf("Error reading budget.dat: ");
-        if (readResult2 == CBudgetDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+    pBudgetDB->Read(budget, fDryRun);
 
     //flag our cached items so we send them to our peers
     budget.ResetSync();
@@ -1836,17 +1917,12 @@ bool AppInit2()
 
     uiInterface.InitMessage(_("Loading masternode payment cache..."));
 
-    CMasternodePaymentDB mnpayments;
-    CMasternodePaymentDB::ReadResult readResult3 = mnpayments.Read(masternodePayments);
-
-    if (readResult3 == CMasternodePaymentDB::FileError)
-        LogPrintf("Missing masternode payment cache - mnpayments.dat, will try to recreate\n");
-    else if (readResult3 != CMasternodePaymentDB::Ok) {
-        LogPrintf("Error reading mnpayments.dat: ");
-        if (readResult3 == CMasternodePaymentDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
+    pMasternodePaymentDB = new CMasternodePaymentDB(TIERTWO_DB_CACHE_SIZE);
+    pMasternodePaymentDB->Read(masternodePayments);
+    {
+        // build the last paid index from the loaded votes
+        LOCK(cs_main);
+        masternodePayments.LoadLastPaidIndex(chainActive.Tip());
     }
 
     fMasterNode = gArgs.GetBoolArg("-masternode", DEFAULT_MASTERNODE);
@@ -1950,6 +2026,7 @@ bool AppInit2()
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.socketEventsMode = socketEventsMode;
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return UIError(strNodeError);
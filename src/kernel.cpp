@@ -110,7 +110,7 @@ bool LoadStakeInput(const CBlock& block, const CBlockIndex* pindexPrev, std::uni
     const CTxIn& txin = block.vtx[1]->vin[0];
     stake = txin.IsZerocoinSpend() ?
             std::unique_ptr<CStakeInput>(new CLegacyZAfoStake()) :
-            std::unique_ptr<CStakeInput>(CAfoStake::NewAfoStake(txin));
+            std::unique_ptr<CStakeInput>(CAfoStake::NewAfoStake(txin, pindexPrev));
 
     return stake && stake->InitFromTxIn(txin);
 }
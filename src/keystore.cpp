@@ -37,6 +37,7 @@ bool CBasicKeyStore::AddKeyPubKey(const CKey& key, const CPubKey& pubkey)
 {
     LOCK(cs_KeyStore);
     mapKeys[pubkey.GetID()] = key;
+    nAdditions++;
     return true;
 }
 
@@ -47,6 +48,7 @@ bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 
     LOCK(cs_KeyStore);
     mapScripts[CScriptID(redeemScript)] = redeemScript;
+    nAdditions++;
     return true;
 }
 
@@ -90,6 +92,7 @@ bool CBasicKeyStore::AddWatchOnly(const CScript& dest)
     CPubKey pubKey;
     if (ExtractPubKey(dest, pubKey))
         mapWatchKeys[pubKey.GetID()] = pubKey;
+    nAdditions++;
     return true;
 }
 
@@ -174,6 +177,7 @@ bool CBasicKeyStore::AddSaplingFullViewingKey(
     LOCK(cs_KeyStore);
     auto ivk = extfvk.fvk.in_viewing_key();
     mapSaplingFullViewingKeys[ivk] = extfvk;
+    nAdditions++;
 
     return CBasicKeyStore::AddSaplingIncomingViewingKey(ivk, extfvk.DefaultAddress());
 }
@@ -267,4 +271,8 @@ void CBasicKeyStore::GetSaplingPaymentAddresses(std::set<libzcash::SaplingPaymen
             mi++;
         }
     }
-}
\ No newline at end of file
+}
+uint64_t CBasicKeyStore::GetAdditionsCount() const
+{
+    return WITH_LOCK(cs_KeyStore, return nAdditions);
+}
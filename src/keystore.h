@@ -102,6 +102,8 @@ protected:
     WatchKeyMap mapWatchKeys;
     ScriptMap mapScripts;
     WatchOnlySet setWatchOnly;
+    //! Number of keys, scripts and viewing keys added so far (guarded by cs_KeyStore)
+    uint64_t nAdditions = 0;
 
 public:
 
@@ -148,6 +150,9 @@ public:
             libzcash::SaplingExtendedSpendingKey &extskOut) const;
 
     void GetSaplingPaymentAddresses(std::set<libzcash::SaplingPaymentAddress> &setAddress) const;
+
+    //! Changes whenever something that can make a script or a note ours is added
+    uint64_t GetAdditionsCount() const;
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
@@ -6,8 +6,11 @@
 
 #include "chainparamsbase.h"
 #include "logging.h"
+#include "util/threadnames.h"
 #include "utiltime.h"
 
+#include <chrono>
+
 
 const char * const DEFAULT_DEBUGLOGFILE = "debug.log";
 
@@ -29,11 +32,65 @@ BCLog::Logger* const g_logger = new BCLog::Logger();
 bool fLogIPs = DEFAULT_LOGIPS;
 
 
+/** Maximum size of the batches written by the writer thread */
+static const size_t LOG_WRITE_BATCH_SIZE = 1 << 20;
+/** Time the idle writer thread waits, when it may have missed a wake up */
+static const int LOG_WRITER_WAIT_MS = 100;
+/** Maximum time (in milliseconds) FlushBuffered waits for the writer thread to finish its batch */
+static const int LOG_FLUSH_WAIT_MS = 1000;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
 }
 
+// Bounded MPMC queue by Dmitry Vyukov (used here with a single consumer): each slot
+// carries a sequence number telling whether it's free for the push at position pos
+// (seq == pos) or holds the message to pop at position pos (seq == pos + 1).
+BCLog::MessageRing::MessageRing(size_t nSlots) :
+        m_slots(new Slot[nSlots]),
+        m_mask(nSlots - 1)
+{
+    assert(nSlots >= 2 && (nSlots & m_mask) == 0);
+    for (size_t i = 0; i < nSlots; i++) {
+        m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool BCLog::MessageRing::TryPush(std::string& msg)
+{
+    size_t pos = m_push_pos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = m_slots[pos & m_mask];
+        const size_t seq = slot.seq.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.msg.swap(msg);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (dif < 0) {
+            // full: the slot still holds the message pushed a lap before
+            return false;
+        } else {
+            pos = m_push_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool BCLog::MessageRing::TryPop(std::string& msg)
+{
+    Slot& slot = m_slots[m_pop_pos & m_mask];
+    const size_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != m_pop_pos + 1) return false;
+    msg.clear();
+    msg.swap(slot.msg);
+    slot.seq.store(m_pop_pos + m_mask + 1, std::memory_order_release);
+    m_pop_pos++;
+    return true;
+}
+
 bool BCLog::Logger::OpenDebugLog()
 {
     std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
@@ -196,6 +253,25 @@ std::string BCLog::Logger::LogTimestampStr(const std::string &str)
 
 int BCLog::Logger::LogPrintStr(const std::string &str)
 {
+    // announce the push before checking m_writer_running: StopWriterThread clears it,
+    // then waits for the pushes in progress before writing out the last messages
+    m_pushing++;
+    if (m_writer_running) {
+        // queue the message for the writer thread, never waiting on the output
+        std::string msg = m_print_to_console ? str : LogTimestampStr(str);
+        int ret = msg.size();
+        if (!m_buffer->TryPush(msg)) {
+            m_dropped++;
+            m_dropped_unreported++;
+            ret = 0;
+        } else if (m_writer_sleeping.load(std::memory_order_relaxed)) {
+            m_writer_cond.notify_one();
+        }
+        m_pushing--;
+        return ret;
+    }
+    m_pushing--;
+
     int ret = 0; // Returns total number of characters written
     if (m_print_to_console) {
         // print to console
@@ -226,6 +302,98 @@ int BCLog::Logger::LogPrintStr(const std::string &str)
     return ret;
 }
 
+void BCLog::Logger::WriteBatch(const std::string& batch)
+{
+    if (m_print_to_console) {
+        fwrite(batch.data(), 1, batch.size(), stdout);
+        fflush(stdout);
+    } else if (m_print_to_file) {
+        std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
+        if (m_fileout == nullptr) {
+            m_msgs_before_open.push_back(batch);
+            return;
+        }
+        // reopen the log file, if requested
+        if (m_reopen_file) {
+            m_reopen_file = false;
+            if (fsbridge::freopen(m_file_path,"a",m_fileout) != NULL)
+                setbuf(m_fileout, NULL); // unbuffered
+        }
+        FileWriteStr(batch, m_fileout);
+    }
+}
+
+bool BCLog::Logger::WriteBuffered()
+{
+    std::string batch, msg;
+    while (batch.size() < LOG_WRITE_BATCH_SIZE && m_buffer->TryPop(msg)) {
+        batch += msg;
+    }
+    const uint64_t nDropped = m_dropped_unreported.exchange(0);
+    if (nDropped > 0) {
+        if (m_log_timestamps && !m_print_to_console)
+            batch += DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) + ' ';
+        batch += strprintf("%u log messages dropped: the log buffer was full\n", nDropped);
+    }
+    if (batch.empty()) return false;
+    WriteBatch(batch);
+    return true;
+}
+
+void BCLog::Logger::ThreadWriter()
+{
+    util::ThreadRename("allforonebusiness-log");
+    while (true) {
+        {
+            std::lock_guard<std::timed_mutex> lock(m_pop_mutex);
+            if (WriteBuffered()) continue;
+        }
+        // the buffer is empty: everything logged before the stop request has been written
+        if (m_stop_writer) break;
+        std::unique_lock<std::mutex> lock(m_writer_mutex);
+        m_writer_sleeping = true;
+        m_writer_cond.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_WAIT_MS), [this]{ return m_stop_writer.load(); });
+        m_writer_sleeping = false;
+    }
+}
+
+void BCLog::Logger::StartWriterThread()
+{
+    if (m_writer.joinable()) return;
+    if (!m_buffer) m_buffer.reset(new MessageRing(LOG_BUFFER_MESSAGES));
+    m_stop_writer = false;
+    m_writer = std::thread(&BCLog::Logger::ThreadWriter, this);
+    m_writer_running = true;
+}
+
+void BCLog::Logger::StopWriterThread()
+{
+    if (!m_writer.joinable()) return;
+    m_writer_running = false;
+    // the threads which saw the writer running are queueing their message
+    while (m_pushing > 0) {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        m_stop_writer = true;
+    }
+    m_writer_cond.notify_one();
+    m_writer.join();
+    // messages queued after the last batch of the writer thread
+    std::lock_guard<std::timed_mutex> lock(m_pop_mutex);
+    while (WriteBuffered()) {}
+}
+
+void BCLog::Logger::FlushBuffered()
+{
+    // the writer thread would wait for itself
+    if (!m_buffer || std::this_thread::get_id() == m_writer.get_id()) return;
+    std::unique_lock<std::timed_mutex> lock(m_pop_mutex, std::chrono::milliseconds(LOG_FLUSH_WAIT_MS));
+    if (!lock.owns_lock()) return;
+    while (WriteBuffered()) {}
+}
+
 void BCLog::Logger::ShrinkDebugFile()
 {
     // Amount of debug.log to save at end when shrinking (must fit in memory)
@@ -15,15 +15,20 @@
 #include "tinyformat.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+/** Number of messages the log buffer holds, waiting for the writer thread (a power of two) */
+static const size_t LOG_BUFFER_MESSAGES = 1 << 14;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fLogIPs;
@@ -67,6 +72,34 @@ namespace BCLog {
         ALL         = ~(uint32_t)0,
     };
 
+    /**
+     * Bounded lock-free queue of log messages, with many producers (the logging threads)
+     * and a single consumer (the writer thread). Pushing never blocks: it fails when
+     * the queue is full.
+     */
+    class MessageRing
+    {
+    private:
+        struct Slot {
+            std::atomic<size_t> seq;
+            std::string msg;
+        };
+        std::unique_ptr<Slot[]> m_slots;
+        const size_t m_mask;
+        // claimed by the producers
+        std::atomic<size_t> m_push_pos{0};
+        // owned by the consumer
+        size_t m_pop_pos{0};
+
+    public:
+        explicit MessageRing(size_t nSlots);
+
+        /** Queue msg (moved from on success). Returns false if the queue is full. */
+        bool TryPush(std::string& msg);
+        /** Take the oldest message into msg (consumer only). Returns false if the queue is empty. */
+        bool TryPop(std::string& msg);
+    };
+
     class Logger
     {
     private:
@@ -74,6 +107,31 @@ namespace BCLog {
         std::mutex m_file_mutex;
         std::list<std::string> m_msgs_before_open;
 
+        /**
+         * Asynchronous output: once the writer thread is started, the logging threads
+         * queue their messages in m_buffer and m_writer writes them out in batches.
+         * Messages are dropped (and counted) when the buffer is full.
+         */
+        std::unique_ptr<MessageRing> m_buffer;
+        std::thread m_writer;
+        std::atomic<bool> m_writer_running{false};
+        std::atomic<bool> m_stop_writer{false};
+        std::atomic<bool> m_writer_sleeping{false};
+        std::mutex m_writer_mutex;
+        std::condition_variable m_writer_cond;
+        std::atomic<uint64_t> m_dropped{0};
+        std::atomic<uint64_t> m_dropped_unreported{0};
+        // number of logging threads queueing a message (checked by StopWriterThread)
+        std::atomic<int> m_pushing{0};
+        // held by the consumer of m_buffer: the writer thread, or FlushBuffered on fatal errors
+        std::timed_mutex m_pop_mutex;
+
+        void ThreadWriter();
+        /** Write out the next batch of buffered messages (requires m_pop_mutex). Returns false if there were none. */
+        bool WriteBuffered();
+        /** Write a batch of (already timestamped) messages to the output */
+        void WriteBatch(const std::string& batch);
+
         /**
          * m_started_new_line is a state variable that will suppress printing of
          * the timestamp when multiple calls are made that don't end in a
@@ -99,6 +157,17 @@ namespace BCLog {
         /** Send a string to the log output */
         int LogPrintStr(const std::string &str);
 
+        /** Hand the output over to a dedicated writer thread (after OpenDebugLog) */
+        void StartWriterThread();
+        /** Write out the buffered messages and stop the writer thread:
+         *  the messages logged afterwards are written synchronously */
+        void StopWriterThread();
+        /** Write out the buffered messages from the calling thread, on fatal errors
+         *  (the writer thread may never get to them) */
+        void FlushBuffered();
+        /** Number of messages dropped because the log buffer was full */
+        uint64_t GetDroppedMessages() const { return m_dropped.load(); }
+
         /** Returns whether logs will be written to any output */
         bool Enabled() const { return m_print_to_console || m_print_to_file; }
 
@@ -231,115 +231,89 @@ void CBudgetManager::SubmitFinalBudget()
 // CBudgetDB
 //
 
-CBudgetDB::CBudgetDB()
+CBudgetDB* pBudgetDB = nullptr;
+
+static const char DB_PROPOSAL = 'p';
+static const char DB_FINALIZED_BUDGET = 'f';
+static const char DB_SEEN_PROPOSAL_VOTE = 'v';
+static const char DB_ORPHAN_PROPOSAL_VOTE = 'o';
+static const char DB_SEEN_BUDGET_VOTE = 'V';
+static const char DB_ORPHAN_BUDGET_VOTE = 'O';
+
+CBudgetDB::CBudgetDB(size_t nCacheSize, bool fMemory, bool fWipe) : CTierTwoDB("budget", nCacheSize, fMemory, fWipe) {}
+
+template <typename T>
+static void InsertEntries(std::map<uint256, T>& mapEntries, std::vector<std::pair<uint256, T>>& vEntries)
 {
-    pathDB = GetDataDir() / "budget.dat";
-    strMagicMessage = "MasternodeBudget";
+    mapEntries.insert(std::make_move_iterator(vEntries.begin()), std::make_move_iterator(vEntries.end()));
 }
 
 bool CBudgetDB::Write(const CBudgetManager& objToSave)
 {
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathDB, "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    LOCK(cs_db);
+    {
+        LOCK(objToSave.cs_proposals);
+        for (const auto& it : objToSave.mapProposals) StageEntry(DB_PROPOSAL, it.first, it.second);
     }
-    fileout.fclose();
-
-    LogPrint(BCLog::MNBUDGET,"Written info to budget.dat  %dms\n", GetTimeMillis() - nStart);
+    {
+        LOCK(objToSave.cs_votes);
+        for (const auto& it : objToSave.mapSeenProposalVotes) StageEntry(DB_SEEN_PROPOSAL_VOTE, it.first, it.second);
+        for (const auto& it : objToSave.mapOrphanProposalVotes) StageEntry(DB_ORPHAN_PROPOSAL_VOTE, it.first, it.second);
+    }
+    {
+        LOCK(objToSave.cs_budgets);
+        for (const auto& it : objToSave.mapFinalizedBudgets) StageEntry(DB_FINALIZED_BUDGET, it.first, it.second);
+    }
+    {
+        LOCK(objToSave.cs_finalizedvotes);
+        for (const auto& it : objToSave.mapSeenFinalizedBudgetVotes) StageEntry(DB_SEEN_BUDGET_VOTE, it.first, it.second);
+        for (const auto& it : objToSave.mapOrphanFinalizedBudgetVotes) StageEntry(DB_ORPHAN_BUDGET_VOTE, it.first, it.second);
+    }
+    if (!CommitEntries())
+        return error("%s : Failed to write the budgets", __func__);
 
+    LogPrint(BCLog::MNBUDGET,"%s\n", objToSave.ToString());
     return true;
 }
 
-CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
+bool CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathDB, "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = fs::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
+    {
+        LOCK(cs_db);
+        std::vector<std::pair<uint256, CBudgetProposal>> vProposals;
+        ReadEntries(DB_PROPOSAL, vProposals);
+        WITH_LOCK(objToLoad.cs_proposals, InsertEntries(objToLoad.mapProposals, vProposals); );
+
+        std::vector<std::pair<uint256, CFinalizedBudget>> vBudgets;
+        ReadEntries(DB_FINALIZED_BUDGET, vBudgets);
+        WITH_LOCK(objToLoad.cs_budgets, InsertEntries(objToLoad.mapFinalizedBudgets, vBudgets); );
+
+        std::vector<std::pair<uint256, CBudgetVote>> vSeenVotes, vOrphanVotes;
+        ReadEntries(DB_SEEN_PROPOSAL_VOTE, vSeenVotes);
+        ReadEntries(DB_ORPHAN_PROPOSAL_VOTE, vOrphanVotes);
+        {
+            LOCK(objToLoad.cs_votes);
+            InsertEntries(objToLoad.mapSeenProposalVotes, vSeenVotes);
+            InsertEntries(objToLoad.mapOrphanProposalVotes, vOrphanVotes);
         }
 
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
+        std::vector<std::pair<uint256, CFinalizedBudgetVote>> vSeenBudgetVotes, vOrphanBudgetVotes;
+        ReadEntries(DB_SEEN_BUDGET_VOTE, vSeenBudgetVotes);
+        ReadEntries(DB_ORPHAN_BUDGET_VOTE, vOrphanBudgetVotes);
+        {
+            LOCK(objToLoad.cs_finalizedvotes);
+            InsertEntries(objToLoad.mapSeenFinalizedBudgetVotes, vSeenBudgetVotes);
+            InsertEntries(objToLoad.mapOrphanFinalizedBudgetVotes, vOrphanBudgetVotes);
         }
+    }
 
-        // de-serialize data into CBudgetManager object
-        ssObj >> objToLoad;
-    } catch (const std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
+    // the flat file of older versions, if any, is imported only into an empty database
+    if (ImportFlatFile("budget.dat", "MasternodeBudget", objToLoad)) {
+        Write(objToLoad);
     }
 
-    LogPrint(BCLog::MNBUDGET,"Loaded info from budget.dat  %dms\n", GetTimeMillis() - nStart);
+    LogPrint(BCLog::MNBUDGET,"Loaded info from budget  %dms\n", GetTimeMillis() - nStart);
     LogPrint(BCLog::MNBUDGET,"%s\n", objToLoad.ToString());
     if (!fDryRun) {
         LogPrint(BCLog::MNBUDGET,"Budget manager - cleaning....\n");
@@ -347,33 +321,14 @@ CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
         LogPrint(BCLog::MNBUDGET,"Budget manager - result: %s\n", objToLoad.ToString());
     }
 
-    return Ok;
+    return true;
 }
 
 void DumpBudgets()
 {
+    if (!pBudgetDB) return;
     int64_t nStart = GetTimeMillis();
-
-    CBudgetDB budgetdb;
-    CBudgetManager tempBudget;
-
-    LogPrint(BCLog::MNBUDGET,"Verifying budget.dat format...\n");
-    CBudgetDB::ReadResult readResult = budgetdb.Read(tempBudget, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CBudgetDB::FileError)
-        LogPrint(BCLog::MNBUDGET,"Missing budgets file - budget.dat, will try to recreate\n");
-    else if (readResult != CBudgetDB::Ok) {
-        LogPrint(BCLog::MNBUDGET,"Error reading budget.dat: ");
-        if (readResult == CBudgetDB::IncorrectFormat)
-            LogPrint(BCLog::MNBUDGET,"magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint(BCLog::MNBUDGET,"file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint(BCLog::MNBUDGET,"Writting info to budget.dat...\n");
-    budgetdb.Write(budget);
-
+    pBudgetDB->Write(budget);
     LogPrint(BCLog::MNBUDGET,"Budget dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
@@ -1014,6 +969,10 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
     if (strCommand == NetMsgType::BUDGETVOTESYNC) { //Masternode vote sync
         uint256 nProp;
         vRecv >> nProp;
+        // digests of the votes the peer already has, per proposal/budget
+        // (not sent by older peers, which get everything)
+        std::map<uint256, CHashBuckets> mapPeerBuckets;
+        if (!vRecv.empty()) vRecv >> mapPeerBuckets;
 
         if (Params().NetworkID() == CBaseChainParams::MAIN) {
             if (nProp.IsNull()) {
@@ -1027,7 +986,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             }
         }
 
-        Sync(pfrom, nProp);
+        Sync(pfrom, nProp, false, mapPeerBuckets.empty() ? nullptr : &mapPeerBuckets);
         LogPrint(BCLog::MNBUDGET, "mnvs - Sent Masternode votes to peer %i\n", pfrom->GetId());
     }
 
@@ -1184,7 +1143,7 @@ void CBudgetManager::SetSynced(bool synced)
     }
 }
 
-void CBudgetManager::Sync(CNode* pfrom, const uint256& nProp, bool fPartial)
+void CBudgetManager::Sync(CNode* pfrom, const uint256& nProp, bool fPartial, const std::map<uint256, CHashBuckets>* pPeerBuckets)
 {
     CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     int nInvCount = 0;
@@ -1193,9 +1152,17 @@ void CBudgetManager::Sync(CNode* pfrom, const uint256& nProp, bool fPartial)
         for (auto& it: mapProposals) {
             CBudgetProposal* pbudgetProposal = &(it.second);
             if (pbudgetProposal && pbudgetProposal->IsValid() && (nProp.IsNull() || it.first == nProp)) {
-                pfrom->PushInventory(CInv(MSG_BUDGET_PROPOSAL, it.second.GetHash()));
-                nInvCount++;
-                pbudgetProposal->SyncVotes(pfrom, fPartial, nInvCount);
+                // proposals known by the peer: only send the votes it is missing
+                const CHashBuckets* pVoteBuckets = nullptr;
+                if (pPeerBuckets) {
+                    auto itBuckets = pPeerBuckets->find(it.first);
+                    if (itBuckets != pPeerBuckets->end()) pVoteBuckets = &itBuckets->second;
+                }
+                if (!pVoteBuckets) {
+                    pfrom->PushInventory(CInv(MSG_BUDGET_PROPOSAL, it.second.GetHash()));
+                    nInvCount++;
+                }
+                pbudgetProposal->SyncVotes(pfrom, fPartial, nInvCount, pVoteBuckets);
             }
         }
     }
@@ -1208,9 +1175,16 @@ void CBudgetManager::Sync(CNode* pfrom, const uint256& nProp, bool fPartial)
         for (auto& it: mapFinalizedBudgets) {
             CFinalizedBudget* pfinalizedBudget = &(it.second);
             if (pfinalizedBudget && pfinalizedBudget->IsValid() && (nProp.IsNull() || it.first == nProp)) {
-                pfrom->PushInventory(CInv(MSG_BUDGET_FINALIZED, it.second.GetHash()));
-                nInvCount++;
-                pfinalizedBudget->SyncVotes(pfrom, fPartial, nInvCount);
+                const CHashBuckets* pVoteBuckets = nullptr;
+                if (pPeerBuckets) {
+                    auto itBuckets = pPeerBuckets->find(it.first);
+                    if (itBuckets != pPeerBuckets->end()) pVoteBuckets = &itBuckets->second;
+                }
+                if (!pVoteBuckets) {
+                    pfrom->PushInventory(CInv(MSG_BUDGET_FINALIZED, it.second.GetHash()));
+                    nInvCount++;
+                }
+                pfinalizedBudget->SyncVotes(pfrom, fPartial, nInvCount, pVoteBuckets);
             }
         }
     }
@@ -1218,6 +1192,24 @@ void CBudgetManager::Sync(CNode* pfrom, const uint256& nProp, bool fPartial)
     LogPrint(BCLog::MNBUDGET, "%s: sent %d items\n", __func__, nInvCount);
 }
 
+std::map<uint256, CHashBuckets> CBudgetManager::GetSyncBuckets() const
+{
+    std::map<uint256, CHashBuckets> mapBuckets;
+    {
+        LOCK(cs_proposals);
+        for (const auto& it: mapProposals) {
+            if (it.second.IsValid()) mapBuckets.emplace(it.first, it.second.GetVoteBuckets());
+        }
+    }
+    {
+        LOCK(cs_budgets);
+        for (const auto& it: mapFinalizedBudgets) {
+            if (it.second.IsValid()) mapBuckets.emplace(it.first, it.second.GetVoteBuckets());
+        }
+    }
+    return mapBuckets;
+}
+
 bool CBudgetManager::UpdateProposal(const CBudgetVote& vote, CNode* pfrom, std::string& strError)
 {
     LOCK(cs_proposals);
@@ -1334,10 +1326,17 @@ bool CBudgetProposal::ParseBroadcast(CDataStream& broadcast)
     return true;
 }
 
-void CBudgetProposal::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) const
+void CBudgetProposal::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount, const CHashBuckets* pPeerBuckets) const
 {
+    // buckets where the votes of the peer differ from ours (empty: send all)
+    std::vector<bool> vDiff;
+    if (pPeerBuckets && pPeerBuckets->IsValid()) {
+        vDiff = GetVoteBuckets(pPeerBuckets->size()).GetDifferences(*pPeerBuckets);
+    }
+
     for (const auto& it: mapVotes) {
         const CBudgetVote& vote = it.second;
+        if (!vDiff.empty() && !vDiff[pPeerBuckets->GetBucket(vote.GetHash())]) continue;
         if (vote.IsValid() && (!fPartial || !vote.IsSynced())) {
             pfrom->PushInventory(CInv(MSG_BUDGET_VOTE, vote.GetHash()));
             nInvCount++;
@@ -1345,6 +1344,15 @@ void CBudgetProposal::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) con
     }
 }
 
+CHashBuckets CBudgetProposal::GetVoteBuckets(unsigned int nBuckets) const
+{
+    std::vector<uint256> vHashes;
+    for (const auto& it: mapVotes) {
+        if (it.second.IsValid()) vHashes.emplace_back(it.second.GetHash());
+    }
+    return CHashBuckets(vHashes, nBuckets);
+}
+
 bool CBudgetProposal::IsHeavilyDownvoted()
 {
     if (GetNays() - GetYeas() > mnodeman.CountEnabled(ActiveProtocol()) / 10) {
@@ -1908,10 +1916,17 @@ std::vector<uint256> CFinalizedBudget::GetProposalsHashes() const
     return vHashes;
 }
 
-void CFinalizedBudget::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) const
+void CFinalizedBudget::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount, const CHashBuckets* pPeerBuckets) const
 {
+    // buckets where the votes of the peer differ from ours (empty: send all)
+    std::vector<bool> vDiff;
+    if (pPeerBuckets && pPeerBuckets->IsValid()) {
+        vDiff = GetVoteBuckets(pPeerBuckets->size()).GetDifferences(*pPeerBuckets);
+    }
+
     for (const auto& it: mapVotes) {
         const CFinalizedBudgetVote& vote = it.second;
+        if (!vDiff.empty() && !vDiff[pPeerBuckets->GetBucket(vote.GetHash())]) continue;
         if (vote.IsValid() && (!fPartial || !vote.IsSynced())) {
             pfrom->PushInventory(CInv(MSG_BUDGET_FINALIZED_VOTE, vote.GetHash()));
             nInvCount++;
@@ -1919,6 +1934,15 @@ void CFinalizedBudget::SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) co
     }
 }
 
+CHashBuckets CFinalizedBudget::GetVoteBuckets(unsigned int nBuckets) const
+{
+    std::vector<uint256> vHashes;
+    for (const auto& it: mapVotes) {
+        if (it.second.IsValid()) vHashes.emplace_back(it.second.GetHash());
+    }
+    return CHashBuckets(vHashes, nBuckets);
+}
+
 bool CFinalizedBudget::CheckStartEnd()
 {
     if (nBlockStart == 0) {
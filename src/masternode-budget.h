@@ -8,11 +8,13 @@
 #define MASTERNODE_BUDGET_H
 
 #include "base58.h"
+#include "hashbuckets.h"
 #include "init.h"
 #include "key.h"
 #include "masternode.h"
 #include "net.h"
 #include "sync.h"
+#include "tiertwodb.h"
 #include "util.h"
 
 #include <atomic>
@@ -169,36 +171,28 @@ public:
     }
 };
 
-/** Save Budget Manager (budget.dat)
+/** Access to the budget database (budget): the proposals, the finalized budgets
+ *  and their (seen and orphan) votes, by hash
  */
-class CBudgetDB
+class CBudgetDB : public CTierTwoDB
 {
-private:
-    fs::path pathDB;
-    std::string strMagicMessage;
-
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
-    };
-
-    CBudgetDB();
+    CBudgetDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    // Write the entries changed since the last write
     bool Write(const CBudgetManager& objToSave);
-    ReadResult Read(CBudgetManager& objToLoad, bool fDryRun = false);
+    bool Read(CBudgetManager& objToLoad, bool fDryRun = false);
 };
 
+extern CBudgetDB* pBudgetDB;
+
 
 //
 // Budget Manager : Contains all proposals for the budget
 //
 class CBudgetManager
 {
+    friend class CBudgetDB;
+
 private:
     // map budget hash --> CollTx hash.
     // hold finalized-budgets collateral txes until they mature enough to use
@@ -268,7 +262,12 @@ public:
 
     void ResetSync() { SetSynced(false); }
     void MarkSynced() { SetSynced(true); }
-    void Sync(CNode* node, const uint256& nProp, bool fPartial = false);
+    // announce the proposals/budgets (nProp, or all of them if null) and their votes to a node.
+    // With pPeerBuckets (digests of the peer's items), only the ones the peer is missing
+    void Sync(CNode* node, const uint256& nProp, bool fPartial = false, const std::map<uint256, CHashBuckets>* pPeerBuckets = nullptr);
+    // digests of the votes of each valid proposal and finalized budget, sent along with BUDGETVOTESYNC
+    std::map<uint256, CHashBuckets> GetSyncBuckets() const;
+    bool HaveProposals() const { LOCK(cs_proposals); return !mapProposals.empty(); }
     void SetBestHeight(int height) { nBestHeight.store(height, std::memory_order_release); };
     int GetBestHeight() const { return nBestHeight.load(std::memory_order_acquire); }
 
@@ -407,8 +406,10 @@ public:
     UniValue GetVotesObject() const;
     void SetSynced(bool synced);    // sets fSynced on votes (true only if valid)
 
-    // sync budget votes with a node
-    void SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) const;
+    // sync budget votes with a node (only the ones not in pPeerBuckets, if any)
+    void SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount, const CHashBuckets* pPeerBuckets = nullptr) const;
+    // digest of the valid votes
+    CHashBuckets GetVoteBuckets(unsigned int nBuckets = 0) const;
 
     // sets fValid and strInvalid, returns fValid
     bool UpdateValid(int nHeight);
@@ -514,8 +515,10 @@ public:
     UniValue GetVotesArray() const;
     void SetSynced(bool synced);    // sets fSynced on votes (true only if valid)
 
-    // sync proposal votes with a node
-    void SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount) const;
+    // sync proposal votes with a node (only the ones not in pPeerBuckets, if any)
+    void SyncVotes(CNode* pfrom, bool fPartial, int& nInvCount, const CHashBuckets* pPeerBuckets = nullptr) const;
+    // digest of the valid votes
+    CHashBuckets GetVoteBuckets(unsigned int nBuckets = 0) const;
 
     // sets fValid and strInvalid, returns fValid
     bool UpdateValid(int nHeight);
@@ -29,114 +29,58 @@ RecursiveMutex cs_mapMasternodePayeeVotes;
 // CMasternodePaymentDB
 //
 
-CMasternodePaymentDB::CMasternodePaymentDB()
-{
-    pathDB = GetDataDir() / "mnpayments.dat";
-    strMagicMessage = "MasternodePayments";
-}
-
-bool CMasternodePaymentDB::Write(const CMasternodePayments& objToSave)
-{
-    int64_t nStart = GetTimeMillis();
+CMasternodePaymentDB* pMasternodePaymentDB = nullptr;
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
+static const char DB_PAYMENT_VOTE = 'w';
+static const char DB_BLOCK_PAYEES = 'k';
 
-    // open output file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathDB, "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
+CMasternodePaymentDB::CMasternodePaymentDB(size_t nCacheSize, bool fMemory, bool fWipe) : CTierTwoDB("mnpayments", nCacheSize, fMemory, fWipe) {}
 
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+bool CMasternodePaymentDB::Write(const CMasternodePayments& objToSave)
+{
+    LOCK(cs_db);
+    {
+        LOCK(cs_mapMasternodePayeeVotes);
+        for (const auto& it : objToSave.mapMasternodePayeeVotes) {
+            StageEntry(DB_PAYMENT_VOTE, it.first, it.second);
+        }
     }
-    fileout.fclose();
-
-    LogPrint(BCLog::MASTERNODE,"Written info to mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
+    {
+        LOCK(cs_mapMasternodeBlocks);
+        for (const auto& it : objToSave.mapMasternodeBlocks) {
+            StageEntry(DB_BLOCK_PAYEES, SerializeHash(it.first), it.second);
+        }
+    }
+    if (!CommitEntries())
+        return error("%s : Failed to write the masternode payments", __func__);
 
+    LogPrint(BCLog::MASTERNODE,"  %s\n", objToSave.ToString());
     return true;
 }
 
-CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments& objToLoad, bool fDryRun)
+bool CMasternodePaymentDB::Read(CMasternodePayments& objToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathDB, "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = fs::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode payement cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
+    {
+        LOCK(cs_db);
+        std::vector<std::pair<uint256, CMasternodePaymentWinner>> vVotes;
+        ReadEntries(DB_PAYMENT_VOTE, vVotes);
+        std::vector<std::pair<uint256, CMasternodeBlockPayees>> vBlockPayees;
+        ReadEntries(DB_BLOCK_PAYEES, vBlockPayees);
+
+        LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
+        objToLoad.mapMasternodePayeeVotes.insert(vVotes.begin(), vVotes.end());
+        for (const auto& it : vBlockPayees) {
+            objToLoad.mapMasternodeBlocks.emplace(it.second.nBlockHeight, it.second);
         }
+    }
 
-        // de-serialize data into CMasternodePayments object
-        ssObj >> objToLoad;
-    } catch (const std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
+    // the flat file of older versions, if any, is imported only into an empty database
+    if (ImportFlatFile("mnpayments.dat", "MasternodePayments", objToLoad)) {
+        Write(objToLoad);
     }
 
-    LogPrint(BCLog::MASTERNODE,"Loaded info from mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
+    LogPrint(BCLog::MASTERNODE,"Loaded info from mnpayments  %dms\n", GetTimeMillis() - nStart);
     LogPrint(BCLog::MASTERNODE,"  %s\n", objToLoad.ToString());
     if (!fDryRun) {
         LogPrint(BCLog::MASTERNODE,"Masternode payments manager - cleaning....\n");
@@ -145,7 +89,14 @@ CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments&
         LogPrint(BCLog::MASTERNODE,"  %s\n", objToLoad.ToString());
     }
 
-    return Ok;
+    return true;
+}
+
+// Number of blocks (behind the tip) for which payment votes are kept
+static int GetPaymentsHistoryDepth()
+{
+    //keep up to five cycles for historical sake
+    return std::max(int(mnodeman.size() * 1.25), 1000);
 }
 
 uint256 CMasternodePaymentWinner::GetHash() const
@@ -203,29 +154,10 @@ void CMasternodePaymentWinner::Relay()
 
 void DumpMasternodePayments()
 {
+    if (!pMasternodePaymentDB) return;
     int64_t nStart = GetTimeMillis();
-
-    CMasternodePaymentDB paymentdb;
-    CMasternodePayments tempPayments;
-
-    LogPrint(BCLog::MASTERNODE,"Verifying mnpayments.dat format...\n");
-    CMasternodePaymentDB::ReadResult readResult = paymentdb.Read(tempPayments, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodePaymentDB::FileError)
-        LogPrint(BCLog::MASTERNODE,"Missing budgets file - mnpayments.dat, will try to recreate\n");
-    else if (readResult != CMasternodePaymentDB::Ok) {
-        LogPrint(BCLog::MASTERNODE,"Error reading mnpayments.dat: ");
-        if (readResult == CMasternodePaymentDB::IncorrectFormat)
-            LogPrint(BCLog::MASTERNODE,"magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint(BCLog::MASTERNODE,"file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint(BCLog::MASTERNODE,"Writting info to mnpayments.dat...\n");
-    paymentdb.Write(masternodePayments);
-
-    LogPrint(BCLog::MASTERNODE,"Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+    pMasternodePaymentDB->Write(masternodePayments);
+    LogPrint(BCLog::MASTERNODE,"Masternode payments dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
 bool IsBlockValueValid(int nHeight, CAmount nExpectedValue, CAmount nMinted)
@@ -525,10 +457,129 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
             CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
+
+        mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        UpdateLastPaid(winnerIn.payee, winnerIn.nBlockHeight);
+    }
+
+    return true;
+}
+
+void CMasternodePayments::UpdateLastPaid(const CScript& payee, int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    // only blocks already connected to the active chain count as payments
+    if (nBlockHeight <= 0 || nBlockHeight > nLastPaidTipHeight) return;
+
+    /*
+        Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
+        to converge on the same payees quickly, then keep the same schedule.
+    */
+    auto itBlock = mapMasternodeBlocks.find(nBlockHeight);
+    if (itBlock == mapMasternodeBlocks.end() || !itBlock->second.HasPayeeWithVotes(payee, 2)) return;
+
+    auto itTime = mapBlockTimes.find(nBlockHeight);
+    if (itTime == mapBlockTimes.end()) return;
+
+    auto it = mapPayeeLastPaid.find(payee);
+    if (it == mapPayeeLastPaid.end()) {
+        mapPayeeLastPaid.emplace(payee, std::make_pair(nBlockHeight, itTime->second));
+    } else if (it->second.first <= nBlockHeight) {
+        it->second = std::make_pair(nBlockHeight, itTime->second);
+    }
+}
+
+void CMasternodePayments::RecomputeLastPaid(const CScript& payee, int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    mapPayeeLastPaid.erase(payee);
+
+    // walk back the (bounded) list of blocks with votes, starting right below nBlockHeight
+    auto it = mapMasternodeBlocks.lower_bound(nBlockHeight);
+    while (it != mapMasternodeBlocks.begin()) {
+        --it;
+        if (it->first <= 0) break;
+        if (it->second.HasPayeeWithVotes(payee, 2)) {
+            auto itTime = mapBlockTimes.find(it->first);
+            if (itTime == mapBlockTimes.end()) break;
+            mapPayeeLastPaid.emplace(payee, std::make_pair(it->first, itTime->second));
+            return;
+        }
     }
+}
+
+void CMasternodePayments::LoadLastPaidIndex(const CBlockIndex* pindexTip)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPayeeLastPaid.clear();
+    mapBlockTimes.clear();
+    nLastPaidTipHeight = pindexTip ? pindexTip->nHeight : -1;
+
+    // keep the times of the blocks that may still have votes (see CleanPaymentList)
+    const int nFirstHeight = nLastPaidTipHeight - GetPaymentsHistoryDepth();
+    for (const CBlockIndex* pindex = pindexTip; pindex && pindex->nHeight >= nFirstHeight; pindex = pindex->pprev) {
+        mapBlockTimes.emplace(pindex->nHeight, pindex->GetBlockTime());
+    }
+
+    for (auto& it : mapMasternodeBlocks) {
+        LOCK(cs_vecPayments);
+        for (const CMasternodePayee& p : it.second.vecPayments) {
+            UpdateLastPaid(p.scriptPubKey, it.first);
+        }
+    }
+
+    LogPrint(BCLog::MASTERNODE, "%s: %d payees indexed at height %d\n", __func__, mapPayeeLastPaid.size(), nLastPaidTipHeight);
+}
+
+void CMasternodePayments::BlockConnected(const CBlockIndex* pindex)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    nLastPaidTipHeight = pindex->nHeight;
+    mapBlockTimes[pindex->nHeight] = pindex->GetBlockTime();
+    // don't wait for CleanPaymentList (not run during the initial sync or a reindex)
+    mapBlockTimes.erase(mapBlockTimes.begin(), mapBlockTimes.lower_bound(pindex->nHeight - GetPaymentsHistoryDepth()));
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    auto it = mapMasternodeBlocks.find(pindex->nHeight);
+    if (it == mapMasternodeBlocks.end()) return;
 
+    LOCK(cs_vecPayments);
+    for (const CMasternodePayee& p : it->second.vecPayments) {
+        UpdateLastPaid(p.scriptPubKey, pindex->nHeight);
+    }
+}
+
+void CMasternodePayments::BlockDisconnected(const CBlockIndex* pindex)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    nLastPaidTipHeight = pindex->nHeight - 1;
+    mapBlockTimes.erase(pindex->nHeight);
+
+    // payees last paid in the disconnected block have to be searched again in the previous ones
+    std::vector<CScript> vPayees;
+    for (const auto& it : mapPayeeLastPaid) {
+        if (it.second.first >= pindex->nHeight) vPayees.push_back(it.first);
+    }
+    for (const CScript& payee : vPayees) {
+        RecomputeLastPaid(payee, pindex->nHeight);
+    }
+}
+
+bool CMasternodePayments::GetLastPaidBlockTime(const CScript& payee, int nMaxDepth, int64_t& nTimeRet) const
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    auto it = mapPayeeLastPaid.find(payee);
+    if (it == mapPayeeLastPaid.end()) return false;
+
+    // only look at the last nMaxDepth blocks
+    if (nLastPaidTipHeight - it->second.first >= nMaxDepth) return false;
+
+    nTimeRet = it->second.second;
     return true;
 }
 
@@ -624,8 +675,7 @@ void CMasternodePayments::CleanPaymentList()
 
     int nHeight = mnodeman.GetBestHeight();
 
-    //keep up to five cycles for historical sake
-    int nLimit = std::max(int(mnodeman.size() * 1.25), 1000);
+    int nLimit = GetPaymentsHistoryDepth();
 
     std::map<uint256, CMasternodePaymentWinner>::iterator it = mapMasternodePayeeVotes.begin();
     while (it != mapMasternodePayeeVotes.end()) {
@@ -640,6 +690,17 @@ void CMasternodePayments::CleanPaymentList()
             ++it;
         }
     }
+
+    // prune the last paid index too
+    mapBlockTimes.erase(mapBlockTimes.begin(), mapBlockTimes.lower_bound(nHeight - nLimit));
+    auto it2 = mapPayeeLastPaid.begin();
+    while (it2 != mapPayeeLastPaid.end()) {
+        if (nHeight - it2->second.first > nLimit) {
+            it2 = mapPayeeLastPaid.erase(it2);
+        } else {
+            ++it2;
+        }
+    }
 }
 
 void CMasternodePayments::ProcessBlock(int nBlockHeight)
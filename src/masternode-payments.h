@@ -8,6 +8,7 @@
 
 #include "key.h"
 #include "masternode.h"
+#include "tiertwodb.h"
 
 
 extern RecursiveMutex cs_vecPayments;
@@ -31,30 +32,20 @@ void FillBlockPayee(CMutableTransaction& txNew, const CBlockIndex* pindexPrev, b
 
 void DumpMasternodePayments();
 
-/** Save Masternode Payment Data (mnpayments.dat)
+/** Access to the masternode payments database (mnpayments): the payment
+ *  votes by hash, and the payees of each block by height
  */
-class CMasternodePaymentDB
+class CMasternodePaymentDB : public CTierTwoDB
 {
-private:
-    fs::path pathDB;
-    std::string strMagicMessage;
-
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
-    };
-
-    CMasternodePaymentDB();
+    CMasternodePaymentDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    // Write the entries changed since the last write
     bool Write(const CMasternodePayments& objToSave);
-    ReadResult Read(CMasternodePayments& objToLoad, bool fDryRun = false);
+    bool Read(CMasternodePayments& objToLoad, bool fDryRun = false);
 };
 
+extern CMasternodePaymentDB* pMasternodePaymentDB;
+
 class CMasternodePayee
 {
 public:
@@ -230,6 +221,19 @@ class CMasternodePayments
 private:
     int nLastBlockHeight;
 
+    // Memory only. Last block (height, time) in which each payee was voted with at least 2 votes.
+    // Kept up to date on new votes and on block connect/disconnect, so GetLastPaid doesn't need to walk the chain.
+    std::map<CScript, std::pair<int, int64_t>> mapPayeeLastPaid;
+    // Memory only. Time of the recent blocks of the active chain, keyed by height.
+    std::map<int, int64_t> mapBlockTimes;
+    // Memory only. Height of the active chain tip as seen by the last paid index.
+    int nLastPaidTipHeight;
+
+    // Update the last paid entry of a payee voted at nBlockHeight (requires cs_mapMasternodeBlocks)
+    void UpdateLastPaid(const CScript& payee, int nBlockHeight);
+    // Find again the last paid block of a payee, before nBlockHeight (requires cs_mapMasternodeBlocks)
+    void RecomputeLastPaid(const CScript& payee, int nBlockHeight);
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -238,6 +242,7 @@ public:
     CMasternodePayments()
     {
         nLastBlockHeight = 0;
+        nLastPaidTipHeight = -1;
     }
 
     void Clear()
@@ -245,9 +250,12 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeLastPaid.clear();
+        mapBlockTimes.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
+    bool HaveSeenPaymentWinner(const uint256& hash) const { LOCK(cs_mapMasternodePayeeVotes); return mapMasternodePayeeVotes.count(hash); }
     void ProcessBlock(int nBlockHeight);
 
     void Sync(CNode* node, int nCountNeeded);
@@ -257,6 +265,13 @@ public:
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
 
+    // Last paid index management
+    void LoadLastPaidIndex(const CBlockIndex* pindexTip);
+    void BlockConnected(const CBlockIndex* pindex);
+    void BlockDisconnected(const CBlockIndex* pindex);
+    /** Time of the last block, within nMaxDepth blocks from the tip, paying the given payee */
+    bool GetLastPaidBlockTime(const CScript& payee, int nMaxDepth, int64_t& nTimeRet) const;
+
     bool CanVote(const COutPoint& outMasternode, int nBlockHeight)
     {
         LOCK(cs_mapMasternodePayeeVotes);
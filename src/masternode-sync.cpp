@@ -220,6 +220,8 @@ void CMasternodeSync::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
             if (nItemID != RequestedMasternodeAssets) return;
             sumMasternodeList += nCount;
             countMasternodeList++;
+            // a peer reconciling with our list announces only the entries we miss, possibly none
+            if (nCount == 0 && mnodeman.CountEnabled() > 0) lastMasternodeList = GetTime();
             break;
         case (MASTERNODE_SYNC_MNW):
             if (nItemID != RequestedMasternodeAssets) return;
@@ -230,6 +232,8 @@ void CMasternodeSync::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
             if (RequestedMasternodeAssets != MASTERNODE_SYNC_BUDGET) return;
             sumBudgetItemProp += nCount;
             countBudgetItemProp++;
+            // same for the proposals and votes
+            if (nCount == 0 && budget.HaveProposals()) lastBudgetItem = GetTime();
             break;
         case (MASTERNODE_SYNC_BUDGET_FIN):
             if (RequestedMasternodeAssets != MASTERNODE_SYNC_BUDGET) return;
@@ -408,7 +412,7 @@ bool CMasternodeSync::SyncWithNode(CNode* pnode)
             if (RequestedMasternodeAttempt >= MASTERNODE_SYNC_THRESHOLD * 3) return false;
 
             uint256 n;
-            g_connman->PushMessage(pnode, msgMaker.Make(NetMsgType::BUDGETVOTESYNC, n)); //sync masternode votes
+            g_connman->PushMessage(pnode, msgMaker.Make(NetMsgType::BUDGETVOTESYNC, n, budget.GetSyncBuckets())); //sync masternode votes
             RequestedMasternodeAttempt++;
             return false;
         }
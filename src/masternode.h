@@ -210,7 +210,8 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    // nMnCount: number of enabled masternodes (-1 to count them)
+    int64_t SecondsSincePayment(int nMnCount = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -260,7 +261,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nMnCount = -1);
     bool IsValidNetAddr();
 
     /// Is the input associated with collateral public key? (and there is 10000 PIV - checking if valid masternode)
@@ -290,6 +291,8 @@ public:
     bool Sign(const CKey& key, const CPubKey& pubKey);
     bool Sign(const std::string strSignKey);
     bool CheckSignature() const;
+    // The signature to check (by the collateral key) for CheckSignature
+    CHashSigCheck GetSignatureCheck() const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -7,6 +7,7 @@
 
 #include "addrman.h"
 #include "fs.h"
+#include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
 #include "masternode.h"
@@ -19,6 +20,7 @@
 #include "util.h"
 
 #include <boost/thread/thread.hpp>
+#include <thread>
 
 #define MN_WINNER_MINIMUM_AGE 8000    // Age in seconds. This should be > MASTERNODE_REMOVAL_SECONDS to avoid misconfigured new nodes in the list.
 
@@ -30,142 +32,160 @@ CActiveMasternodeMan amnodeman;
 CActiveMasternode activeMasternode;
 
 struct CompareLastPaid {
-    bool operator()(const std::pair<int64_t, CTxIn>& t1,
-        const std::pair<int64_t, CTxIn>& t2) const
+    bool operator()(const std::pair<int64_t, CMasternode*>& t1,
+        const std::pair<int64_t, CMasternode*>& t2) const
     {
         return t1.first < t2.first;
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const std::pair<int64_t, CTxIn>& t1,
-        const std::pair<int64_t, CTxIn>& t2) const
+struct CompareScoreMN {
+    bool operator()(const std::pair<int64_t, CMasternode>& t1,
+        const std::pair<int64_t, CMasternode>& t2) const
     {
         return t1.first < t2.first;
     }
 };
 
-struct CompareScoreMN {
-    bool operator()(const std::pair<int64_t, CMasternode>& t1,
-        const std::pair<int64_t, CMasternode>& t2) const
+// Orders by the full 256-bit score. The rank functions used to compare the compact scores, leaving
+// the masternodes with equal compact scores in the order of the local list (which differs between
+// nodes): those ties are now broken by the full score, the same way on every node.
+struct CompareScoreRef {
+    bool operator()(const std::pair<uint256, MasternodeRef>& t1,
+        const std::pair<uint256, MasternodeRef>& t2) const
     {
-        return t1.first < t2.first;
+        return t1.first > t2.first;
     }
 };
 
+/** Minimum number of scores, per thread, to calculate them in parallel */
+static const size_t MIN_SCORES_PER_THREAD = 500;
+
 //
-// CMasternodeDB
+// CMasternodeScores
 //
 
-CMasternodeDB::CMasternodeDB()
-{
-    pathMN = GetDataDir() / "mncache.dat";
-    strMagicMessage = "MasternodeCache";
-}
-
-bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
+void CMasternodeScores::Build(const uint256& hashIn, const std::vector<MasternodeRef>& vMasternodes, uint64_t nListVersionIn, const CMasternodeScores* pprevScores)
 {
-    int64_t nStart = GetTimeMillis();
+    blockHash = hashIn;
+    nListVersion = nListVersionIn;
+    vScores.clear();
+    vScores.reserve(vMasternodes.size());
+
+    // re-use the scores already known, collect the ones to calculate
+    std::vector<size_t> vMissing;
+    for (const MasternodeRef& mn : vMasternodes) {
+        const uint256* pscore = (pprevScores && pprevScores->blockHash == hashIn) ? pprevScores->GetScore(mn->vin.prevout) : nullptr;
+        if (!pscore) vMissing.push_back(vScores.size());
+        vScores.emplace_back(pscore ? *pscore : UINT256_ZERO, mn);
+    }
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
-    ssMasternodes << strMagicMessage;                   // masternode cache file specific magic message
-    ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssMasternodes << mnodemanToSave;
-    uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    ssMasternodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathMN, "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssMasternodes;
-    } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    // two SHA256d per masternode: split the work across the cores
+    auto calculate = [this, &vMissing](size_t nStart, size_t nEnd) {
+        for (size_t i = nStart; i < nEnd; i++) {
+            auto& entry = vScores[vMissing[i]];
+            entry.first = entry.second->CalculateScore(blockHash);
+        }
+    };
+    const size_t nThreads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), vMissing.size() / MIN_SCORES_PER_THREAD));
+    if (nThreads == 1) {
+        calculate(0, vMissing.size());
+    } else {
+        std::vector<std::thread> vThreads;
+        const size_t nChunk = (vMissing.size() + nThreads - 1) / nThreads;
+        for (size_t nStart = nChunk; nStart < vMissing.size(); nStart += nChunk) {
+            vThreads.emplace_back(calculate, nStart, std::min(nStart + nChunk, vMissing.size()));
+        }
+        calculate(0, nChunk);
+        for (std::thread& t : vThreads) t.join();
     }
-    //    FileCommit(fileout);
-    fileout.fclose();
 
-    LogPrint(BCLog::MASTERNODE,"Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint(BCLog::MASTERNODE,"  %s\n", mnodemanToSave.ToString());
+    std::sort(vScores.begin(), vScores.end(), CompareScoreRef());
 
-    return true;
+    mapPositions.clear();
+    mapPositions.reserve(vScores.size());
+    for (size_t i = 0; i < vScores.size(); i++) {
+        mapPositions.emplace(vScores[i].second->vin.prevout, i);
+    }
 }
 
-CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fDryRun)
+const uint256* CMasternodeScores::GetScore(const COutPoint& collateral) const
 {
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathMN, "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = fs::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
+    auto it = mapPositions.find(collateral);
+    return it != mapPositions.end() ? &vScores[it->second].first : nullptr;
+}
 
-    CDataStream ssMasternodes(vchData, SER_DISK, CLIENT_VERSION);
+//
+// CMasternodeDB
+//
 
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
+CMasternodeDB* pMasternodeDB = nullptr;
 
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
+static const char DB_MASTERNODE = 'm';
+static const char DB_SEEN_BROADCAST = 'b';
+static const char DB_SEEN_PING = 'p';
+static const char DB_ASKED_US = 'a';
+static const char DB_WE_ASKED = 'A';
+static const char DB_WE_ASKED_ENTRY = 'e';
+static const char DB_DSQ_COUNT = 'd';
 
-        ssMasternodes >> strMagicMessageTmp;
+CMasternodeDB::CMasternodeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CTierTwoDB("mncache", nCacheSize, fMemory, fWipe) {}
 
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
+bool CMasternodeDB::Write(CMasternodeMan& mnodemanToSave)
+{
+    LOCK2(cs_db, mnodemanToSave.cs);
+    for (const MasternodeRef& mn : mnodemanToSave.vMasternodes) {
+        StageEntry(DB_MASTERNODE, SerializeHash(mn->vin.prevout), *mn);
+    }
+    for (const auto& it : mnodemanToSave.mapSeenMasternodeBroadcast) {
+        StageEntry(DB_SEEN_BROADCAST, it.first, it.second);
+    }
+    for (const auto& it : mnodemanToSave.mapSeenMasternodePing) {
+        StageEntry(DB_SEEN_PING, it.first, it.second);
+    }
+    StageEntry(DB_ASKED_US, UINT256_ZERO, mnodemanToSave.mAskedUsForMasternodeList);
+    StageEntry(DB_WE_ASKED, UINT256_ZERO, mnodemanToSave.mWeAskedForMasternodeList);
+    StageEntry(DB_WE_ASKED_ENTRY, UINT256_ZERO, mnodemanToSave.mWeAskedForMasternodeListEntry);
+    StageEntry(DB_DSQ_COUNT, UINT256_ZERO, mnodemanToSave.nDsqCount);
+    if (!CommitEntries())
+        return error("%s : Failed to write the masternode cache", __func__);
 
-        // de-serialize file header (network specific magic number) and ..
-        ssMasternodes >> FLATDATA(pchMsgTmp);
+    LogPrint(BCLog::MASTERNODE,"  %s\n", mnodemanToSave.ToString());
+    return true;
+}
 
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
+bool CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fDryRun)
+{
+    int64_t nStart = GetTimeMillis();
+    {
+        LOCK2(cs_db, mnodemanToLoad.cs);
+        std::vector<std::pair<uint256, CMasternode>> vMasternodes;
+        ReadEntries(DB_MASTERNODE, vMasternodes);
+        std::vector<CMasternode> vTmp;
+        for (auto& it : vMasternodes) {
+            vTmp.emplace_back(std::move(it.second));
         }
-        // de-serialize data into CMasternodeMan object
-        ssMasternodes >> mnodemanToLoad;
-    } catch (const std::exception& e) {
-        mnodemanToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
+        mnodemanToLoad.SetMasternodes(vTmp);
+
+        std::vector<std::pair<uint256, CMasternodeBroadcast>> vBroadcasts;
+        ReadEntries(DB_SEEN_BROADCAST, vBroadcasts);
+        mnodemanToLoad.mapSeenMasternodeBroadcast.insert(vBroadcasts.begin(), vBroadcasts.end());
+        std::vector<std::pair<uint256, CMasternodePing>> vPings;
+        ReadEntries(DB_SEEN_PING, vPings);
+        mnodemanToLoad.mapSeenMasternodePing.insert(vPings.begin(), vPings.end());
+
+        ReadEntry(DB_ASKED_US, mnodemanToLoad.mAskedUsForMasternodeList);
+        ReadEntry(DB_WE_ASKED, mnodemanToLoad.mWeAskedForMasternodeList);
+        ReadEntry(DB_WE_ASKED_ENTRY, mnodemanToLoad.mWeAskedForMasternodeListEntry);
+        ReadEntry(DB_DSQ_COUNT, mnodemanToLoad.nDsqCount);
+    }
+
+    // the flat file of older versions, if any, is imported only into an empty database
+    if (ImportFlatFile("mncache.dat", "MasternodeCache", mnodemanToLoad)) {
+        Write(mnodemanToLoad);
     }
 
-    LogPrint(BCLog::MASTERNODE,"Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
+    LogPrint(BCLog::MASTERNODE,"Loaded info from mncache  %dms\n", GetTimeMillis() - nStart);
     LogPrint(BCLog::MASTERNODE,"  %s\n", mnodemanToLoad.ToString());
     if (!fDryRun) {
         LogPrint(BCLog::MASTERNODE,"Masternode manager - cleaning....\n");
@@ -174,41 +194,84 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bo
         LogPrint(BCLog::MASTERNODE,"  %s\n", mnodemanToLoad.ToString());
     }
 
-    return Ok;
+    return true;
 }
 
 void DumpMasternodes()
 {
+    if (!pMasternodeDB) return;
     int64_t nStart = GetTimeMillis();
-
-    CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
-
-    LogPrint(BCLog::MASTERNODE,"Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodeDB::FileError)
-        LogPrint(BCLog::MASTERNODE,"Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrint(BCLog::MASTERNODE,"Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrint(BCLog::MASTERNODE,"magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint(BCLog::MASTERNODE,"file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint(BCLog::MASTERNODE,"Writting info to mncache.dat...\n");
-    mndb.Write(mnodeman);
-
+    pMasternodeDB->Write(mnodeman);
     LogPrint(BCLog::MASTERNODE,"Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+SaltedKeyIDHasher::SaltedKeyIDHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
 CMasternodeMan::CMasternodeMan():
         cvLastBlockHashes(CACHED_BLOCK_HASHES, UINT256_ZERO),
+        nListVersion(0),
         nDsqCount(0)
 {}
 
+const CMasternodeScores& CMasternodeMan::GetScores(const uint256& hash)
+{
+    AssertLockHeld(cs);
+
+    auto it = std::find_if(lScoresCache.begin(), lScoresCache.end(),
+            [&hash](const CMasternodeScores& scores) { return scores.blockHash == hash; });
+    if (it != lScoresCache.end() && it->nListVersion == nListVersion) {
+        // most recently used first
+        lScoresCache.splice(lScoresCache.begin(), lScoresCache, it);
+        return lScoresCache.front();
+    }
+
+    // new block hash, or the list changed: in the latter case calculate only the scores of the new entries
+    lScoresCache.emplace_front();
+    if (it != lScoresCache.end()) {
+        lScoresCache.front().Build(hash, vMasternodes, nListVersion, &(*it));
+        lScoresCache.erase(it);
+    } else {
+        lScoresCache.front().Build(hash, vMasternodes, nListVersion);
+        if (lScoresCache.size() > CACHED_SCORE_TABLES) lScoresCache.pop_back();
+    }
+    return lScoresCache.front();
+}
+
+void CMasternodeMan::AddToList(const MasternodeRef& mn)
+{
+    AssertLockHeld(cs);
+    vMasternodes.push_back(mn);
+    mapMasternodesByOutpoint.emplace(mn->vin.prevout, vMasternodes.size() - 1);
+    mapMasternodesByPayee.emplace(mn->pubKeyCollateralAddress.GetID(), mn);
+    mapMasternodesByPubKey.emplace(mn->pubKeyMasternode.GetID(), mn);
+}
+
+void CMasternodeMan::RemoveKeyIndex(std::unordered_multimap<CKeyID, MasternodeRef, SaltedKeyIDHasher>& mapIndex, const CKeyID& keyID, const CMasternode* pmn)
+{
+    AssertLockHeld(cs);
+    auto range = mapIndex.equal_range(keyID);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.get() == pmn) {
+            mapIndex.erase(it);
+            return;
+        }
+    }
+}
+
+void CMasternodeMan::RemoveFromList(size_t nPos)
+{
+    AssertLockHeld(cs);
+    const MasternodeRef mn = vMasternodes[nPos];
+    mapMasternodesByOutpoint.erase(mn->vin.prevout);
+    RemoveKeyIndex(mapMasternodesByPayee, mn->pubKeyCollateralAddress.GetID(), mn.get());
+    RemoveKeyIndex(mapMasternodesByPubKey, mn->pubKeyMasternode.GetID(), mn.get());
+    if (nPos != vMasternodes.size() - 1) {
+        vMasternodes[nPos] = vMasternodes.back();
+        mapMasternodesByOutpoint[vMasternodes[nPos]->vin.prevout] = nPos;
+    }
+    vMasternodes.pop_back();
+}
+
 bool CMasternodeMan::Add(CMasternode& mn)
 {
     LOCK(cs);
@@ -219,13 +282,32 @@ bool CMasternodeMan::Add(CMasternode& mn)
     CMasternode* pmn = Find(mn.vin);
     if (pmn == NULL) {
         LogPrint(BCLog::MASTERNODE, "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
-        vMasternodes.push_back(mn);
+        AddToList(std::make_shared<CMasternode>(mn));
+        nListVersion++;
         return true;
     }
 
     return false;
 }
 
+void CMasternodeMan::SetMasternodes(const std::vector<CMasternode>& vMasternodesIn)
+{
+    LOCK(cs);
+
+    vMasternodes.clear();
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPayee.clear();
+    mapMasternodesByPubKey.clear();
+
+    nListVersion++;
+    vMasternodes.reserve(vMasternodesIn.size());
+    for (const CMasternode& mn : vMasternodesIn) {
+        // skip duplicated collaterals
+        if (mapMasternodesByOutpoint.count(mn.vin.prevout)) continue;
+        AddToList(std::make_shared<CMasternode>(mn));
+    }
+}
+
 void CMasternodeMan::AskForMN(CNode* pnode, const CTxIn& vin)
 {
     std::map<COutPoint, int64_t>::iterator i = mWeAskedForMasternodeListEntry.find(vin.prevout);
@@ -246,8 +328,8 @@ void CMasternodeMan::Check()
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+    for (const MasternodeRef& mn : vMasternodes) {
+        mn->Check();
     }
 }
 
@@ -258,20 +340,21 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
-    std::vector<CMasternode>::iterator it = vMasternodes.begin();
-    while (it != vMasternodes.end()) {
-        if ((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
-            (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT ||
-            (forceExpiredRemoval && (*it).activeState == CMasternode::MASTERNODE_EXPIRED) ||
-            (*it).protocolVersion < ActiveProtocol()) {
-            LogPrint(BCLog::MASTERNODE, "CMasternodeMan: Removing inactive Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+    size_t i = 0;
+    while (i < vMasternodes.size()) {
+        const MasternodeRef mn = vMasternodes[i];
+        if (mn->activeState == CMasternode::MASTERNODE_REMOVE ||
+            mn->activeState == CMasternode::MASTERNODE_VIN_SPENT ||
+            (forceExpiredRemoval && mn->activeState == CMasternode::MASTERNODE_EXPIRED) ||
+            mn->protocolVersion < ActiveProtocol()) {
+            LogPrint(BCLog::MASTERNODE, "CMasternodeMan: Removing inactive Masternode %s - %i now\n", mn->vin.prevout.hash.ToString(), size() - 1);
 
             //erase all of the broadcasts we've seen from this vin
             // -- if we missed a few pings and the node was removed, this will allow is to get it back without them
             //    sending a brand new mnb
             std::map<uint256, CMasternodeBroadcast>::iterator it3 = mapSeenMasternodeBroadcast.begin();
             while (it3 != mapSeenMasternodeBroadcast.end()) {
-                if ((*it3).second.vin == (*it).vin) {
+                if ((*it3).second.vin == mn->vin) {
                     masternodeSync.mapSeenSyncMNB.erase((*it3).first);
                     mapSeenMasternodeBroadcast.erase(it3++);
                 } else {
@@ -280,18 +363,12 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             // allow us to ask for this masternode again if we see another ping
-            std::map<COutPoint, int64_t>::iterator it2 = mWeAskedForMasternodeListEntry.begin();
-            while (it2 != mWeAskedForMasternodeListEntry.end()) {
-                if ((*it2).first == (*it).vin.prevout) {
-                    mWeAskedForMasternodeListEntry.erase(it2++);
-                } else {
-                    ++it2;
-                }
-            }
+            mWeAskedForMasternodeListEntry.erase(mn->vin.prevout);
 
-            it = vMasternodes.erase(it);
+            RemoveFromList(i);
+            nListVersion++;
         } else {
-            ++it;
+            ++i;
         }
     }
 
@@ -351,6 +428,11 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPayee.clear();
+    mapMasternodesByPubKey.clear();
+    lScoresCache.clear();
+    nListVersion++;
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -366,18 +448,18 @@ int CMasternodeMan::stable_size ()
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.protocolVersion < nMinProtocol) {
+    for (const MasternodeRef& mn : vMasternodes) {
+        if (mn->protocolVersion < nMinProtocol) {
             continue; // Skip obsolete versions
         }
         if (sporkManager.IsSporkActive (SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
-            nMasternode_Age = GetAdjustedTime() - mn.sigTime;
+            nMasternode_Age = GetAdjustedTime() - mn->sigTime;
             if ((nMasternode_Age) < nMasternode_Min_Age) {
                 continue; // Skip masternodes younger than (default) 8000 sec (MUST be > MASTERNODE_REMOVAL_SECONDS)
             }
         }
-        mn.Check ();
-        if (!mn.IsEnabled ())
+        mn->Check ();
+        if (!mn->IsEnabled ())
             continue; // Skip not-enabled masternodes
 
         nStable_size++;
@@ -391,9 +473,9 @@ int CMasternodeMan::CountEnabled(int protocolVersion)
     int i = 0;
     protocolVersion = protocolVersion == -1 ? ActiveProtocol() : protocolVersion;
 
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
-        if (mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
+    for (const MasternodeRef& mn : vMasternodes) {
+        mn->Check();
+        if (mn->protocolVersion < protocolVersion || !mn->IsEnabled()) continue;
         i++;
     }
 
@@ -402,11 +484,11 @@ int CMasternodeMan::CountEnabled(int protocolVersion)
 
 void CMasternodeMan::CountNetworks(int protocolVersion, int& ipv4, int& ipv6, int& onion)
 {
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+    for (const MasternodeRef& mn : vMasternodes) {
+        mn->Check();
         std::string strHost;
         int port;
-        SplitHostPort(mn.addr.ToString(), port, strHost);
+        SplitHostPort(mn->addr.ToString(), port, strHost);
         CNetAddr node;
         LookupHost(strHost.c_str(), node, false);
         int nNetwork = node.GetNetwork();
@@ -440,85 +522,103 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
         }
     }
 
-    g_connman->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(NetMsgType::GETMNLIST, CTxIn()));
+    // peers supporting the reconciliation announce only the entries we are missing
+    g_connman->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(NetMsgType::GETMNLIST, CTxIn(), GetSyncBuckets()));
     int64_t askAgain = GetTime() + MASTERNODES_DSEG_SECONDS;
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 }
 
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
-    LOCK(cs);
-    CScript payee2;
+    // masternodes are paid to the P2PKH script of their collateral key
+    CTxDestination dest;
+    if (!ExtractDestination(payee, dest)) return NULL;
+    const CKeyID* keyID = boost::get<CKeyID>(&dest);
+    if (!keyID || payee != GetScriptForDestination(*keyID)) return NULL;
 
-    for (CMasternode& mn : vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
-    }
-    return NULL;
+    LOCK(cs);
+    auto it = mapMasternodesByPayee.find(*keyID);
+    return it != mapMasternodesByPayee.end() ? it->second.get() : NULL;
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
-
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    auto it = mapMasternodesByOutpoint.find(vin.prevout);
+    return it != mapMasternodesByOutpoint.end() ? vMasternodes[it->second].get() : NULL;
 }
 
 
 CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
-
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+    auto range = mapMasternodesByPubKey.equal_range(pubKeyMasternode.GetID());
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->pubKeyMasternode == pubKeyMasternode)
+            return it->second.get();
     }
     return NULL;
 }
 
+std::vector<CMasternode> CMasternodeMan::GetFullMasternodeVector()
+{
+    Check();
+
+    LOCK(cs);
+    std::vector<CMasternode> vRet;
+    vRet.reserve(vMasternodes.size());
+    for (const MasternodeRef& mn : vMasternodes) {
+        vRet.push_back(*mn);
+    }
+    return vRet;
+}
+
 //
 // Deterministically select the oldest/best masternode to pay on the network
 //
 CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCount)
 {
+    // before locking cs: cs_main is never locked after it
+    const uint256& hashScores = GetHashAtHeight(nBlockHeight - 101);
+
     LOCK(cs);
 
     CMasternode* pBestMasternode = NULL;
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeLastPaid;
+    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeLastPaid;
 
     /*
         Make a vector with all of the last paid times
     */
 
     int nMnCount = CountEnabled();
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
-        if (!mn.IsEnabled()) continue;
-
-        // //check protocol version
-        if (mn.protocolVersion < ActiveProtocol()) continue;
+    auto collect = [&](bool fFilter) {
+        vecMasternodeLastPaid.clear();
+        for (const MasternodeRef& mnRef : vMasternodes) {
+            CMasternode& mn = *mnRef;
+            mn.Check();
+            if (!mn.IsEnabled()) continue;
 
-        //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if (masternodePayments.IsScheduled(mn, nBlockHeight)) continue;
+            // //check protocol version
+            if (mn.protocolVersion < ActiveProtocol()) continue;
 
-        //it's too new, wait for a cycle
-        if (fFilterSigTime && mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime()) continue;
+            //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
+            if (masternodePayments.IsScheduled(mn, nBlockHeight)) continue;
 
-        //make sure it has as many confirmations as there are masternodes
-        if (pcoinsTip->GetCoinDepthAtHeight(mn.vin.prevout, nBlockHeight) < nMnCount) continue;
+            //it's too new, wait for a cycle
+            if (fFilter && mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime()) continue;
 
-        vecMasternodeLastPaid.emplace_back(mn.SecondsSincePayment(), mn.vin);
-    }
+            //make sure it has as many confirmations as there are masternodes
+            if (pcoinsTip->GetCoinDepthAtHeight(mn.vin.prevout, nBlockHeight) < nMnCount) continue;
 
-    nCount = (int)vecMasternodeLastPaid.size();
+            // last paid time comes from the payments index (no chain walk)
+            vecMasternodeLastPaid.emplace_back(mn.SecondsSincePayment(nMnCount), &mn);
+        }
+        nCount = (int)vecMasternodeLastPaid.size();
+    };
+    collect(fFilterSigTime);
 
     //when the network is in the process of upgrading, don't penalize nodes that recently restarted
-    if (fFilterSigTime && nCount < nMnCount / 3) return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount);
+    if (fFilterSigTime && nCount < nMnCount / 3) collect(false);
 
     // Sort them high to low
     sort(vecMasternodeLastPaid.rbegin(), vecMasternodeLastPaid.rend(), CompareLastPaid());
@@ -527,15 +627,15 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = CountEnabled() / 10;
+    int nTenthNetwork = nMnCount / 10;
     int nCountTenth = 0;
     uint256 nHigh;
-    const uint256& hash = GetHashAtHeight(nBlockHeight - 101);
-    for (std::pair<int64_t, CTxIn> & s : vecMasternodeLastPaid) {
-        CMasternode* pmn = Find(s.second);
-        if (!pmn) break;
+    const CMasternodeScores& scores = GetScores(hashScores);
+    for (std::pair<int64_t, CMasternode*> & s : vecMasternodeLastPaid) {
+        CMasternode* pmn = s.second;
 
-        const uint256& n = pmn->CalculateScore(hash);
+        const uint256* pscore = scores.GetScore(pmn->vin.prevout);
+        const uint256& n = pscore ? *pscore : pmn->CalculateScore(scores.blockHash);
         if (n > nHigh) {
             nHigh = n;
             pBestMasternode = pmn;
@@ -548,32 +648,27 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
 
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    int64_t score = 0;
-    CMasternode* winner = NULL;
     const uint256& hash = GetHashAtHeight(nBlockHeight - 1);
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    LOCK(cs);
+
+    // scan for winner, starting from the highest score
+    for (const auto& s : GetScores(hash).vScores) {
+        // no score (the rest of the list has score zero too)
+        if (s.first.GetCompact(false) == 0) break;
+
+        CMasternode& mn = *s.second;
         mn.Check();
         if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
 
-        // calculate the score for each Masternode
-        uint256 n = mn.CalculateScore(hash);
-        int64_t n2 = n.GetCompact(false);
-
-        // determine the winner
-        if (n2 > score) {
-            score = n2;
-            winner = &mn;
-        }
+        return &mn;
     }
 
-    return winner;
+    return NULL;
 }
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
@@ -581,8 +676,17 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
     // height outside range
     if (!hash) return -1;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    LOCK(cs);
+
+    const CMasternodeScores& scores = GetScores(hash);
+    auto itPos = scores.mapPositions.find(vin.prevout);
+    // unknown masternode
+    if (itPos == scores.mapPositions.end()) return -1;
+
+    // count the eligible masternodes with a higher score
+    int rank = 0;
+    for (size_t i = 0; i <= itPos->second; i++) {
+        CMasternode& mn = *scores.vScores[i].second;
         if (mn.protocolVersion < minProtocol) {
             LogPrint(BCLog::MASTERNODE,"Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
             continue;                                                       // Skip obsolete versions
@@ -599,22 +703,13 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(hash);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.emplace_back(n2, mn.vin);
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    for (std::pair<int64_t, CTxIn> & s : vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
+        if (i == itPos->second) {
             return rank;
         }
     }
 
+    // the masternode itself is not eligible
     return -1;
 }
 
@@ -627,17 +722,19 @@ std::vector<std::pair<int64_t, CMasternode>> CMasternodeMan::GetMasternodeRanks(
     {
         LOCK(cs);
         // scan for winner
-        for (CMasternode& mn : vMasternodes) {
-            if (!mn.IsEnabled()) {
+        for (const auto& s : GetScores(hash).vScores) {
+            const CMasternode& mn = *s.second;
+            if (!s.second->IsEnabled()) {
                 vecMasternodeScores.emplace_back(9999, mn);
                 continue;
             }
 
-            int64_t n2 = mn.CalculateScore(hash).GetCompact(false);
+            int64_t n2 = s.first.GetCompact(false);
             vecMasternodeScores.emplace_back(n2, mn);
         }
     }
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    // already sorted by score, just move the disabled ones at the end
+    std::stable_sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
     return vecMasternodeScores;
 }
 
@@ -725,10 +822,24 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
     }
 }
 
+CHashBuckets CMasternodeMan::GetSyncBuckets(unsigned int nBuckets)
+{
+    LOCK(cs);
+    std::vector<uint256> vHashes;
+    for (const MasternodeRef& mn : vMasternodes) {
+        if (mn->addr.IsRFC1918() || !mn->IsEnabled()) continue;
+        vHashes.emplace_back(CMasternodeBroadcast(*mn).GetHash());
+    }
+    return CHashBuckets(vHashes, nBuckets);
+}
+
 void CMasternodeMan::ProcessGetMNList(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
     CTxIn vin;
     vRecv >> vin;
+    // digest of the list of the peer (not sent by older peers, which get the full list)
+    CHashBuckets peerBuckets;
+    if (!vRecv.empty()) vRecv >> peerBuckets;
 
     if (vin == CTxIn()) { //only should ask for this once
         //local network
@@ -753,46 +864,58 @@ void CMasternodeMan::ProcessGetMNList(CNode* pfrom, std::string& strCommand, CDa
 
     int nInvCount = 0;
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.addr.IsRFC1918()) continue; //local network
+    if (vin != CTxIn()) {
+        // asking for a specific entry
+        CMasternode* pmn = Find(vin);
+        if (pmn && !pmn->addr.IsRFC1918() && pmn->IsEnabled()) {
+            CMasternodeBroadcast mnb = CMasternodeBroadcast(*pmn);
+            uint256 hash = mnb.GetHash();
+            pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
 
-        if (mn.IsEnabled()) {
-            LogPrint(BCLog::MASTERNODE, "dseg - Sending Masternode entry - %s \n", mn.vin.prevout.hash.ToString());
-            if (vin == CTxIn() || vin == mn.vin) {
-                CMasternodeBroadcast mnb = CMasternodeBroadcast(mn);
-                uint256 hash = mnb.GetHash();
-                pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
-                nInvCount++;
+            if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.emplace(hash, mnb);
 
-                if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.emplace(hash, mnb);
-
-                if (vin == mn.vin) {
-                    LogPrint(BCLog::MASTERNODE, "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
-                    return;
-                }
-            }
+            LogPrint(BCLog::MASTERNODE, "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
         }
+        return;
     }
 
-    if (vin == CTxIn()) {
-        g_connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount));
-        LogPrint(BCLog::MASTERNODE, "dseg - Sent %d Masternode entries to peer %i\n", nInvCount, pfrom->GetId());
+    // buckets of the list where the peer differs from us (empty: send everything)
+    std::vector<bool> vDiff;
+    if (peerBuckets.IsValid()) {
+        vDiff = GetSyncBuckets(peerBuckets.size()).GetDifferences(peerBuckets);
+    }
+
+    for (const MasternodeRef& mn : vMasternodes) {
+        if (mn->addr.IsRFC1918()) continue; //local network
+
+        if (mn->IsEnabled()) {
+            CMasternodeBroadcast mnb = CMasternodeBroadcast(*mn);
+            uint256 hash = mnb.GetHash();
+            if (!vDiff.empty() && !vDiff[peerBuckets.GetBucket(hash)]) continue; // the peer has it already
+            LogPrint(BCLog::MASTERNODE, "dseg - Sending Masternode entry - %s \n", mn->vin.prevout.hash.ToString());
+            pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
+            nInvCount++;
+
+            if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.emplace(hash, mnb);
+        }
     }
+
+    g_connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount));
+    LogPrint(BCLog::MASTERNODE, "dseg - Sent %d Masternode entries to peer %i\n", nInvCount, pfrom->GetId());
 }
 
 void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    std::vector<CMasternode>::iterator it = vMasternodes.begin();
-    while (it != vMasternodes.end()) {
-        if ((*it).vin == vin) {
-            LogPrint(BCLog::MASTERNODE, "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
-            vMasternodes.erase(it);
-            break;
-        }
-        ++it;
-    }
+    auto itMap = mapMasternodesByOutpoint.find(vin.prevout);
+    if (itMap == mapMasternodesByOutpoint.end()) return;
+    const MasternodeRef& mn = vMasternodes[itMap->second];
+    if (mn->vin != vin) return;
+
+    LogPrint(BCLog::MASTERNODE, "CMasternodeMan: Removing Masternode %s - %i now\n", mn->vin.prevout.hash.ToString(), size() - 1);
+    RemoveFromList(itMap->second);
+    nListVersion++;
 }
 
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
@@ -803,15 +926,53 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
 
     LogPrint(BCLog::MASTERNODE,"CMasternodeMan::UpdateMasternodeList() -- masternode=%s\n", mnb.vin.prevout.ToString());
 
-    CMasternode* pmn = Find(mnb.vin);
-    if (pmn == NULL) {
+    if (Find(mnb.vin) == NULL) {
         CMasternode mn(mnb);
         Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        UpdateFromNewBroadcast(mnb);
     }
 }
 
+bool CMasternodeMan::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb)
+{
+    {
+        LOCK(cs);
+        auto it = mapMasternodesByOutpoint.find(mnb.vin.prevout);
+        if (it == mapMasternodesByOutpoint.end()) return false;
+        const MasternodeRef mn = vMasternodes[it->second];
+        const CKeyID oldPayeeID = mn->pubKeyCollateralAddress.GetID();
+        const CKeyID oldPubKeyID = mn->pubKeyMasternode.GetID();
+
+        if (!mn->UpdateFromNewBroadcast(mnb)) return false;
+
+        if (oldPayeeID != mn->pubKeyCollateralAddress.GetID()) {
+            RemoveKeyIndex(mapMasternodesByPayee, oldPayeeID, mn.get());
+            mapMasternodesByPayee.emplace(mn->pubKeyCollateralAddress.GetID(), mn);
+        }
+        if (oldPubKeyID != mn->pubKeyMasternode.GetID()) {
+            RemoveKeyIndex(mapMasternodesByPubKey, oldPubKeyID, mn.get());
+            mapMasternodesByPubKey.emplace(mn->pubKeyMasternode.GetID(), mn);
+        }
+    }
+
+    // The ping is signed with the masternode key of the broadcast, so it's checked once the entry
+    // is updated. Not holding cs: the ping checks lock cs_main. It looks the entry up again itself.
+    int nDoS = 0;
+    if (!mnb.lastPing.IsNull() && mnb.lastPing.CheckAndUpdate(nDoS, false)) {
+        LOCK(cs);
+        mapSeenMasternodePing.emplace(mnb.lastPing.GetHash(), mnb.lastPing);
+    }
+
+    // the entry may have been removed meanwhile
+    LOCK(cs);
+    auto it = mapMasternodesByOutpoint.find(mnb.vin.prevout);
+    if (it == mapMasternodesByOutpoint.end()) return false;
+    CMasternode& mn = *vMasternodes[it->second];
+    mn.Check();
+    return mn.IsEnabled();
+}
+
 std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
@@ -909,6 +1070,13 @@ void ThreadCheckMasternodes()
                     masternodePayments.CleanPaymentList();
                     CleanTransactionLocksList();
                 }
+
+                // write the tier two entries changed since the last dump
+                if (c % MASTERNODES_DUMP_SECONDS == 0) {
+                    DumpMasternodes();
+                    DumpBudgets();
+                    DumpMasternodePayments();
+                }
             }
         }
     } catch (boost::thread_interrupted&) {
@@ -9,19 +9,25 @@
 #include "activemasternode.h"
 #include "activemasternodeman.h"
 #include "base58.h"
+#include "coins.h"
 #include "cyclingvector.h"
+#include "hashbuckets.h"
 #include "key.h"
 #include "masternode.h"
 #include "net.h"
 #include "sync.h"
+#include "tiertwodb.h"
 #include "util.h"
 
-#define MASTERNODES_DUMP_SECONDS (15 * 60)
+#define MASTERNODES_DUMP_SECONDS (5 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
 
 /** Maximum number of block hashes to cache */
 static const unsigned int CACHED_BLOCK_HASHES = 200;
 
+/** Maximum number of masternode score tables to cache */
+static const unsigned int CACHED_SCORE_TABLES = 8;
+
 class CMasternodeMan;
 class CActiveMasternode;
 extern CActiveMasternodeMan amnodeman;
@@ -32,32 +38,64 @@ extern std::string strMasterNodePrivKey;
 
 void DumpMasternodes();
 
-/** Access to the MN database (mncache.dat)
- */
-class CMasternodeDB
+typedef std::shared_ptr<CMasternode> MasternodeRef;
+
+// Used on the masternode payee and pubkey indexes
+class SaltedKeyIDHasher
 {
 private:
-    fs::path pathMN;
-    std::string strMagicMessage;
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedKeyIDHasher();
+
+    size_t operator()(const CKeyID& id) const {
+        return CSipHasher(k0, k1).Write(id.begin(), id.size()).Finalize();
+    }
+};
+
+/** Access to the MN database (mncache): the masternodes by collateral, the seen
+ *  broadcasts and pings by hash, and the list requests
+ */
+class CMasternodeDB : public CTierTwoDB
+{
+public:
+    CMasternodeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    // Write the entries changed since the last write
+    bool Write(CMasternodeMan& mnodemanToSave);
+    bool Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
+};
 
+extern CMasternodeDB* pMasternodeDB;
+
+/** Scores of the masternode list for a given block hash, sorted from the highest
+ */
+class CMasternodeScores
+{
 public:
-    enum ReadResult {
-        Ok,
-        FileError,
-        HashReadError,
-        IncorrectHash,
-        IncorrectMagicMessage,
-        IncorrectMagicNumber,
-        IncorrectFormat
-    };
-
-    CMasternodeDB();
-    bool Write(const CMasternodeMan& mnodemanToSave);
-    ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
+    uint256 blockHash;
+    // version of the masternode list the scores were calculated on
+    uint64_t nListVersion;
+    // (score, masternode) sorted from the highest score
+    std::vector<std::pair<uint256, MasternodeRef>> vScores;
+    // position of each collateral outpoint in vScores
+    std::unordered_map<COutPoint, size_t, SaltedOutpointHasher> mapPositions;
+
+    CMasternodeScores() : nListVersion(0) {}
+
+    /// Calculate the scores of the masternodes for hashIn (in parallel for big lists),
+    /// re-using the ones already calculated in pprevScores, if any
+    void Build(const uint256& hashIn, const std::vector<MasternodeRef>& vMasternodes, uint64_t nListVersionIn, const CMasternodeScores* pprevScores = nullptr);
+
+    /// Score of the masternode with the given collateral (null if not in the table)
+    const uint256* GetScore(const COutPoint& collateral) const;
 };
 
 class CMasternodeMan
 {
+    friend class CMasternodeDB;
+
 private:
     // critical section to protect the inner data structures
     mutable RecursiveMutex cs;
@@ -65,8 +103,12 @@ private:
     // critical section to protect the inner data structures specifically on messaging
     mutable RecursiveMutex cs_process_message;
 
-    // map to hold all MNs
-    std::vector<CMasternode> vMasternodes;
+    // vector to hold all MNs (by reference, so pointers stay valid when the vector grows), in no particular order
+    std::vector<MasternodeRef> vMasternodes;
+    // indexes of vMasternodes by collateral outpoint (position), collateral key (payee) and masternode key
+    std::unordered_map<COutPoint, size_t, SaltedOutpointHasher> mapMasternodesByOutpoint;
+    std::unordered_multimap<CKeyID, MasternodeRef, SaltedKeyIDHasher> mapMasternodesByPayee;
+    std::unordered_multimap<CKeyID, MasternodeRef, SaltedKeyIDHasher> mapMasternodesByPubKey;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -80,12 +122,28 @@ private:
     // Memory Only. Cache last block hashes. Used to verify mn pings and winners.
     CyclingVector<uint256> cvLastBlockHashes;
 
+    // Memory only. Masternode scores for the last block hashes requested.
+    std::list<CMasternodeScores> lScoresCache;
+    // Memory only. Bumped when masternodes are added or removed (outdating the cached scores).
+    uint64_t nListVersion;
+
+    // Get the (cached) scores of the list for a block hash (requires cs)
+    const CMasternodeScores& GetScores(const uint256& hash);
+
+    // List and indexes management (require cs). Removing moves the last masternode to the freed position.
+    void AddToList(const MasternodeRef& mn);
+    void RemoveFromList(size_t nPos);
+    void RemoveKeyIndex(std::unordered_multimap<CKeyID, MasternodeRef, SaltedKeyIDHasher>& mapIndex, const CKeyID& keyID, const CMasternode* pmn);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
     // Keep track of all pings I've seen
     std::map<uint256, CMasternodePing> mapSeenMasternodePing;
 
+    bool HaveSeenMasternodeBroadcast(const uint256& hash) const { LOCK(cs); return mapSeenMasternodeBroadcast.count(hash); }
+    bool HaveSeenMasternodePing(const uint256& hash) const { LOCK(cs); return mapSeenMasternodePing.count(hash); }
+
     // keep track of dsq count to prevent masternodes from gaming obfuscation queue
     // TODO: Remove this from serialization
     int64_t nDsqCount;
@@ -96,7 +154,16 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
         LOCK(cs);
-        READWRITE(vMasternodes);
+        if (ser_action.ForRead()) {
+            std::vector<CMasternode> vTmp;
+            READWRITE(vTmp);
+            SetMasternodes(vTmp);
+        } else {
+            WriteCompactSize(s, vMasternodes.size());
+            for (const MasternodeRef& mn : vMasternodes) {
+                ::Serialize(s, *mn);
+            }
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -111,6 +178,9 @@ public:
     /// Add an entry
     bool Add(CMasternode& mn);
 
+    /// Replace the full list (rebuilding the indexes)
+    void SetMasternodes(const std::vector<CMasternode>& vMasternodesIn);
+
     /// Ask (source) node for mnb
     void AskForMN(CNode* pnode, const CTxIn& vin);
 
@@ -143,11 +213,7 @@ public:
     /// Get the current winner for this block
     CMasternode* GetCurrentMasterNode(int mod = 1, int64_t nBlockHeight = 0, int minProtocol = 0);
 
-    std::vector<CMasternode> GetFullMasternodeVector()
-    {
-        Check();
-        return vMasternodes;
-    }
+    std::vector<CMasternode> GetFullMasternodeVector();
     // Retrieve the known masternodes ordered by scoring without checking them. (Only used for listmasternodes RPC call)
     std::vector<std::pair<int64_t, CMasternode>> GetMasternodeRanks(int nBlockHeight);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
@@ -157,6 +223,10 @@ public:
     // Process GETMNLIST message
     void ProcessGetMNList(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
+    /// Digest of the broadcasts of the entries we would announce on a full list sync,
+    /// sent along with GETMNLIST (with nBuckets = 0, sized on the number of entries)
+    CHashBuckets GetSyncBuckets(unsigned int nBuckets = 0);
+
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
 
@@ -170,6 +240,9 @@ public:
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
 
+    /// Update the entry of the broadcast's collateral, keeping the indexes in sync. Returns whether it's enabled after the update.
+    bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
+
     // Block hashes cycling vector management
     void CacheBlockHash(const CBlockIndex* pindex);
     void UncacheBlockHash(const CBlockIndex* pindex);
@@ -4,12 +4,119 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "checkqueue.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "messagesigner.h"
 #include "masternodeman.h"  // For GetPublicKey (of MN from its vin)
+#include "random.h"
+#include "script/sigcache.h"
 #include "tinyformat.h"
+#include "util.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
+#include <mutex>
+
+#include <boost/thread.hpp>
+
+/** Size of the cache of the valid message signatures (in MiB) */
+static const size_t MESSAGE_SIG_CACHE_SIZE = 4;
+/** Maximum number of signatures handed to a worker at a time, when verifying a batch */
+static const unsigned int SIG_CHECK_BATCH_SIZE = 32;
+
+namespace {
+/**
+ * Valid message signature cache, to avoid recovering the public key of
+ * the same tier two message (relayed by several peers) more than once
+ */
+class CMessageSignatureCache
+{
+private:
+     //! Entries are SHA256(nonce || hash || key id || signature):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_sigcache;
+
+public:
+    CMessageSignatureCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup_bytes(MESSAGE_SIG_CACHE_SIZE << 20);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(keyID.begin(), keyID.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        setValid.insert(entry);
+    }
+};
+
+static CMessageSignatureCache messageSignatureCache;
+
+/**
+ * A signature of a batch to verify on the worker threads. The result is stored in *pfValid: the check
+ * itself always succeeds, so that an invalid signature doesn't stop the queue from verifying the others.
+ */
+class CHashSigVerification
+{
+private:
+    const CHashSigCheck* pcheck;
+    char* pfValid;
+
+public:
+    CHashSigVerification() : pcheck(nullptr), pfValid(nullptr) {}
+    CHashSigVerification(const CHashSigCheck* pcheckIn, char* pfValidIn) : pcheck(pcheckIn), pfValid(pfValidIn) {}
+
+    bool operator()()
+    {
+        std::string strError;
+        *pfValid = CHashSigner::VerifyHash(pcheck->hash, pcheck->keyID, pcheck->vchSig, strError);
+        return true;
+    }
+
+    void swap(CHashSigVerification& check)
+    {
+        std::swap(pcheck, check.pcheck);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+static CCheckQueue<CHashSigVerification> hashsigcheckqueue(SIG_CHECK_BATCH_SIZE);
+//! CCheckQueueControl needs an idle queue: one batch at a time
+static std::mutex cs_hashsigcheckqueue;
+//! Number of threads running ThreadHashSigCheck (none: the batches are verified by the caller)
+static std::atomic<int> nHashSigCheckThreads(0);
+}
+
+void ThreadHashSigCheck()
+{
+    util::ThreadRename("allforonebusiness-hashsigch");
+    nHashSigCheckThreads++;
+    try {
+        hashsigcheckqueue.Thread();
+    } catch (...) {
+        // interrupted
+        nHashSigCheckThreads--;
+        throw;
+    }
+    nHashSigCheckThreads--;
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string& strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     keyRet = DecodeSecret(strSecret);
@@ -55,6 +162,11 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey& pubkey, const s
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
+    uint256 entry;
+    messageSignatureCache.ComputeEntry(entry, hash, keyID, vchSig);
+    if (messageSignatureCache.Get(entry))
+        return true;
+
     CPubKey pubkeyFromSig;
     if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
         strErrorRet = "Error recovering public key.";
@@ -68,9 +180,51 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std
         return false;
     }
 
+    messageSignatureCache.Set(entry);
     return true;
 }
 
+size_t CHashSigner::VerifyHashes(const std::vector<CHashSigCheck>& vChecks)
+{
+    // verify once the signatures not in the cache (the duplicates share the result of the first one)
+    std::vector<CHashSigVerification> vVerifications;
+    std::vector<char> vValid;
+    vValid.reserve(vChecks.size()); // never reallocated: the verifications point to their result
+    std::map<uint256, size_t> mapToVerify;
+    std::vector<size_t> vResultIndex;
+    size_t nCached = 0;
+    for (const CHashSigCheck& check : vChecks) {
+        uint256 entry;
+        messageSignatureCache.ComputeEntry(entry, check.hash, check.keyID, check.vchSig);
+        if (messageSignatureCache.Get(entry)) {
+            nCached++;
+            continue;
+        }
+        auto res = mapToVerify.emplace(entry, vValid.size());
+        if (res.second) {
+            vValid.push_back(false);
+            vVerifications.emplace_back(&check, &vValid.back());
+        }
+        vResultIndex.push_back(res.first->second);
+    }
+
+    // one public key recovery per signature: hand them out to the worker threads
+    if (nHashSigCheckThreads > 0 && vVerifications.size() > 1) {
+        std::lock_guard<std::mutex> lock(cs_hashsigcheckqueue);
+        CCheckQueueControl<CHashSigVerification> control(&hashsigcheckqueue);
+        control.Add(vVerifications);
+        control.Wait();
+    } else {
+        for (CHashSigVerification& verification : vVerifications)
+            verification();
+    }
+
+    size_t nValid = nCached;
+    for (size_t nIndex : vResultIndex)
+        nValid += vValid[nIndex];
+    return nValid;
+}
+
 /** CSignedMessage Class
  *  Functions inherited by network signed-messages
  */
@@ -107,14 +261,17 @@ bool CSignedMessage::Sign(const std::string strSignKey)
 bool CSignedMessage::CheckSignature(const CPubKey& pubKey) const
 {
     std::string strError = "";
+    const CHashSigCheck& check = GetSignatureCheck(pubKey);
+    return CHashSigner::VerifyHash(check.hash, check.keyID, check.vchSig, strError);
+}
 
+CHashSigCheck CSignedMessage::GetSignatureCheck(const CPubKey& pubKey) const
+{
     if (nMessVersion == MessageVersion::MESS_VER_HASH) {
-        uint256 hash = GetSignatureHash();
-        return CHashSigner::VerifyHash(hash, pubKey, vchSig, strError);
+        return {GetSignatureHash(), pubKey.GetID(), vchSig};
     }
-
-    std::string strMessage = GetStrMessage();
-    return CMessageSigner::VerifyMessage(pubKey, vchSig, strMessage, strError);
+    // see CMessageSigner::VerifyMessage
+    return {CMessageSigner::GetMessageHash(GetStrMessage()), pubKey.GetID(), vchSig};
 }
 
 bool CSignedMessage::CheckSignature() const
@@ -31,7 +31,18 @@ public:
     static bool VerifyMessage(const CKeyID& keyID, const std::vector<unsigned char>& vchSig, const std::string& strMessage, std::string& strErrorRet);
 };
 
-/** Helper class for signing hashes and checking their signatures
+/** A signature to check: vchSig of hash, by the key with id keyID
+ */
+struct CHashSigCheck
+{
+    uint256 hash;
+    CKeyID keyID;
+    std::vector<unsigned char> vchSig;
+};
+
+/** Helper class for signing hashes and checking their signatures.
+ *  The valid signatures are cached, so that a message received from several
+ *  peers (or checked again later) is verified only once.
  */
 class CHashSigner
 {
@@ -42,8 +53,14 @@ public:
     static bool VerifyHash(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
     /// Verify the hash signature, returns true if successful
     static bool VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
+    /// Verify a batch of signatures on the worker threads (caching the valid ones), returns the number of
+    /// valid entries of vChecks (each duplicate is verified once, and counted as many times as it appears)
+    static size_t VerifyHashes(const std::vector<CHashSigCheck>& vChecks);
 };
 
+/** Run an instance of the hash signatures checking thread (see CHashSigner::VerifyHashes) */
+void ThreadHashSigCheck();
+
 /** Base Class for all signed messages on the network
  */
 class CSignedMessage
@@ -71,6 +88,8 @@ public:
     bool Sign(const std::string strSignKey);
     bool CheckSignature(const CPubKey& pubKey) const;
     bool CheckSignature() const;
+    // The signature to check (by pubKey) for CheckSignature
+    CHashSigCheck GetSignatureCheck(const CPubKey& pubKey) const;
 
     // Pure virtual functions (used in Sign-Verify functions)
     // Must be implemented in child classes
@@ -38,7 +38,6 @@
 
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -46,53 +45,9 @@
 // PIVXMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    std::set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
-
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
-
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
-    }
-};
-
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -148,6 +103,76 @@ bool CheckForDuplicatedSerials(const CTransaction& tx, const Consensus::Params&
     return true;
 }
 
+// Transactions in mapTx which are already in the block, or part of a package
+// already considered (and failed, or updated in mapModifiedTx) are skipped
+static bool SkipMapTxEntry(CTxMemPool::txiter it, const indexed_modified_transaction_set& mapModifiedTx,
+                           const CTxMemPool::setEntries& failedTx, const CTxMemPool::setEntries& inBlock)
+{
+    assert(it != mempool.mapTx.end());
+    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
+}
+
+// Add the descendants of the transactions just added to the block to
+// mapModifiedTx, with their ancestor state updated to not include them.
+static void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+                                   indexed_modified_transaction_set& mapModifiedTx)
+{
+    AssertLockHeld(mempool.cs);
+    for (const CTxMemPool::txiter& it : alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        for (const CTxMemPool::txiter& desc : descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+// Check the transactions of a package (sorted in block order) against the
+// block being assembled: finality, zerocoin serials, inputs and scripts.
+// The coins are spent in view only if the whole package is valid.
+static bool TestPackageTransactions(const std::vector<CTxMemPool::txiter>& package, CCoinsViewCache& view,
+                                    const int nHeight, const Consensus::Params& consensus,
+                                    std::vector<CBigNum>& vBlockSerials)
+{
+    const size_t nSerials = vBlockSerials.size();
+    CCoinsViewCache viewPackage(&view);
+    for (const CTxMemPool::txiter& it : package) {
+        const CTransaction& tx = it->GetTx();
+        bool fValid = IsFinalTx(tx, nHeight) &&
+                !(it->HasZerocoins() && sporkManager.IsSporkActive(SPORK_16_ZEROCOIN_MAINTENANCE_MODE)) &&
+                // zPIV check to not include duplicated serials in the same block.
+                CheckForDuplicatedSerials(tx, consensus, vBlockSerials);
+        if (fValid && !tx.HasZerocoinSpendInputs()) {
+            // Note that flags: we don't want to set mempool/IsStandard()
+            // policy here, but we still have to ensure that the block we
+            // create only contains transactions that are valid in new blocks.
+            CValidationState state;
+            PrecomputedTransactionData precomTxData(tx);
+            fValid = viewPackage.HaveInputs(tx) && viewPackage.HaveShieldedRequirements(tx) &&
+                    CheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, precomTxData);
+        }
+        if (!fValid) {
+            vBlockSerials.erase(vBlockSerials.begin() + nSerials, vBlockSerials.end());
+            return false;
+        }
+        UpdateCoins(tx, viewPackage, nHeight);
+    }
+    viewPackage.Flush();
+    return true;
+}
+
 bool CreateCoinbaseTx(CBlock* pblock, const CScript& scriptPubKeyIn, CBlockIndex* pindexPrev)
 {
     // Create coinbase tx
@@ -235,201 +260,227 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     unsigned int nBlockMaxSizeNetwork = MAX_BLOCK_SIZE_CURRENT;
     nBlockMaxSize = std::max((unsigned int)1000, std::min((nBlockMaxSizeNetwork - 1000), nBlockMaxSize));
 
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = gArgs.GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
     unsigned int nBlockMinSize = gArgs.GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    unsigned int nBlockPrioritySize = gArgs.GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
     // Collect memory pool transactions into the block
     CAmount nFees = 0;
 
     {
         LOCK2(cs_main, mempool.cs);
         CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
         bool fPrintPriority = gArgs.GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
 
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(sporkManager.IsSporkActive(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
+        uint64_t nBlockSize = 1000;
+        uint64_t nBlockTx = 0;
+        unsigned int nBlockSigOps = 100;
+        const unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+        std::vector<CBigNum> vBlockSerials;
 
-            if (tx.HasZerocoinSpendInputs()) {
-                nTotalIn = tx.GetZerocoinSpent();
-            } else {
-                for (const CTxIn& txin : tx.vin) {
-                    // Read prev transaction
-                    if (!view.HaveCoin(txin.prevout)) {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash)) {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
+        // Select transactions by ancestor package feerate, using the ancestor
+        // state tracked by the mempool: a low fee parent gets in along with its
+        // high fee children, and no coins are looked up for the transactions
+        // left out of the block.
+        // mapModifiedTx stores the packages whose ancestor state changed
+        // because some of their transactions are already in the block.
+        indexed_modified_transaction_set mapModifiedTx;
+        // Keep track of entries that failed inclusion, to avoid duplicate work
+        CTxMemPool::setEntries failedTx;
+        CTxMemPool::setEntries inBlock;
+
+        auto addToBlock = [&](const CTxMemPool::txiter& it) {
+            pblock->vtx.emplace_back(it->GetSharedTx());
+            pblocktemplate->vTxFees.push_back(it->GetFee());
+            pblocktemplate->vTxSigOps.push_back(it->GetSigOpCount());
+            nBlockSize += it->GetTxSize();
+            ++nBlockTx;
+            nBlockSigOps += it->GetSigOpCount();
+            nFees += it->GetFee();
+            inBlock.insert(it);
+            mapModifiedTx.erase(it);
 
-                        // Has to wait for dependencies
-                        if (!porphan) {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
+            if (fPrintPriority) {
+                LogPrintf("priority %.1f fee %s txid %s\n", it->GetPriority(nHeight),
+                    CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), it->GetTx().GetHash().ToString());
+            }
+        };
+
+        // First fill the priority area with the transactions allowed to be free
+        // (high coin age priority, or zerocoin spends), highest priority first.
+        // A transaction waits in mapWaitPriority until its in-mempool parents are
+        // in the block.
+        if (nBlockPrioritySize > 0) {
+            std::vector<TxCoinAgePriority> vecPriority;
+            TxCoinAgePriorityCompare pricomparer;
+            std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> mapWaitPriority;
+            // only the entries that may be free at this height are looked at
+            const auto& freeIndex = mempool.mapTx.get<free_height>();
+            for (auto mi = freeIndex.begin(); mi != freeIndex.end() && mi->GetFreeHeight() <= (unsigned int)nHeight; ++mi) {
+                const double dPriority = mi->GetModifiedPriority(nHeight);
+                if (AllowFree(dPriority) || mi->GetTx().HasZerocoinSpendInputs()) {
+                    vecPriority.emplace_back(dPriority, mempool.mapTx.project<0>(mi));
+                }
+            }
+            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+            while (!vecPriority.empty() && nBlockSize < nBlockPrioritySize) {
+                const CTxMemPool::txiter iter = vecPriority.front().second;
+                const double dPriority = vecPriority.front().first;
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                vecPriority.pop_back();
+
+                bool fDependent = false;
+                for (const CTxMemPool::txiter& parent : mempool.GetMemPoolParents(iter)) {
+                    if (!inBlock.count(parent)) {
+                        fDependent = true;
+                        break;
                     }
+                }
+                if (fDependent) {
+                    mapWaitPriority.emplace(iter, dPriority);
+                    continue;
+                }
 
-                    const Coin& coin = view.AccessCoin(txin.prevout);
-                    assert(!coin.IsSpent());
-
-                    CAmount nValueIn = coin.out.nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = nHeight - coin.nHeight;
-                    dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
+                if (nBlockSize + iter->GetTxSize() >= nBlockPrioritySize ||
+                        nBlockSigOps + iter->GetSigOpCount() >= nMaxBlockSigOps ||
+                        !TestPackageTransactions({iter}, view, nHeight, consensus, vBlockSerials)) {
+                    continue;
+                }
+                addToBlock(iter);
+                UpdatePackagesForAdded({iter}, mapModifiedTx);
+
+                // The children waiting for this transaction can be tried again
+                for (const CTxMemPool::txiter& child : mempool.GetMemPoolChildren(iter)) {
+                    auto it = mapWaitPriority.find(child);
+                    if (it != mapWaitPriority.end()) {
+                        vecPriority.emplace_back(it->second, child);
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                        mapWaitPriority.erase(it);
+                    }
                 }
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.emplace_back(dPriority, feeRate, &mi->GetTx());
         }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+        CTxMemPool::txiter iter;
 
-        std::vector<CBigNum> vBlockSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        // Limit the number of attempts to add transactions to the block when it is
+        // close to full; this is just a simple heuristic to finish quickly if the
+        // mempool has a lot of entries.
+        const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+        int64_t nConsecutiveFailed = 0;
 
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+            // First try to find a new transaction in mapTx to evaluate.
+            if (mi != mempool.mapTx.get<ancestor_score>().end() &&
+                    SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx, inBlock)) {
+                ++mi;
                 continue;
+            }
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.HasZerocoinSpendInputs() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+            // Now that mi is not stale, determine which transaction to evaluate:
+            // the next entry from mapTx, or the best from mapModifiedTx?
+            bool fUsingModified = false;
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+            if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+                // We're out of entries in mapTx; use the entry from mapModifiedTx
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Try to compare the mapTx entry to the mapModifiedTx entry
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                        CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                    // The best entry in mapModifiedTx has higher score
+                    // than the one from mapTx.
+                    // Switch which transaction (package) to consider
+                    iter = modit->iter;
+                    fUsingModified = true;
+                } else {
+                    // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                    // Increment mi for the next loop iteration.
+                    ++mi;
+                }
             }
 
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // zPIV check to not include duplicated serials in the same block.
-            if (!CheckForDuplicatedSerials(tx, consensus, vBlockSerials)) {
-                continue;
+            // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+            // contain anything that is inBlock.
+            assert(!inBlock.count(iter));
+
+            uint64_t packageSize = iter->GetSizeWithAncestors();
+            CAmount packageFees = iter->GetModFeesWithAncestors();
+            unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+            if (fUsingModified) {
+                packageSize = modit->nSizeWithAncestors;
+                packageFees = modit->nModFeesWithAncestors;
+                packageSigOps = modit->nSigOpCountWithAncestors;
             }
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+            // Skip free transactions if we're past the minimum block size
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize) {
+                // Everything else we might consider has a lower fee rate
+                break;
+            }
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+            // Size and legacy sigOps limits
+            if (nBlockSize + packageSize >= nBlockMaxSize || nBlockSigOps + packageSigOps >= nMaxBlockSigOps) {
+                if (fUsingModified) {
+                    // Since we always look at the best entry in mapModifiedTx,
+                    // we must erase failed entries so that we can consider the
+                    // next best entry on the next loop iteration
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
+                    failedTx.insert(iter);
+                }
+                ++nConsecutiveFailed;
+                if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize > nBlockMaxSize - 4000) {
+                    // Give up if we're close to full and haven't succeeded in a while
+                    break;
+                }
                 continue;
+            }
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-
-            CValidationState state;
-            PrecomputedTransactionData precomTxData(tx);
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, precomTxData))
+            CTxMemPool::setEntries ancestors;
+            const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            // Only the ancestors not already in the block are part of the package
+            for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end(); ) {
+                if (inBlock.count(*ait)) {
+                    ancestors.erase(ait++);
+                } else {
+                    ++ait;
+                }
+            }
+            ancestors.insert(iter);
+
+            // Sort the package entries in a valid order for the block, and test them
+            std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+            std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+            if (!TestPackageTransactions(sortedEntries, view, nHeight, consensus, vBlockSerials)) {
+                if (fUsingModified) {
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
+                }
+                failedTx.insert(iter);
                 continue;
+            }
 
-            UpdateCoins(tx, view, nHeight);
-
-            // Added
-            pblock->vtx.push_back(std::make_shared<const CTransaction>(tx));
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+            // This transaction will make it in; reset the failed counter.
+            nConsecutiveFailed = 0;
 
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+            for (const CTxMemPool::txiter& it : sortedEntries) {
+                addToBlock(it);
             }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.emplace_back(porphan->dPriority, porphan->feeRate, porphan->ptx);
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+            // Update transactions that depend on each of these
+            UpdatePackagesForAdded(ancestors, mapModifiedTx);
         }
 
         if (!fProofOfStake) {
@@ -616,6 +667,9 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
                 continue;
             }
 
+            // the wallet must have processed pindexPrev, before looking for the coins to stake
+            SyncWithValidationInterfaceTip(pindexPrev);
+
             // update fStakeableCoins (5 minute check time);
             CheckForCoins(pwallet, 5, &availableCoins);
 
@@ -31,6 +31,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -879,6 +884,8 @@ size_t CConnman::SocketSendData(CNode* pnode)
                 it++;
             } else {
                 // could not send full message; stop sending more
+                // (the socket buffer is full, wait for it to be writable again)
+                pnode->fCanSendData = false;
                 break;
             }
         } else {
@@ -888,6 +895,8 @@ size_t CConnman::SocketSendData(CNode* pnode)
                 if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
                     LogPrintf("socket send error %s\n", NetworkErrorString(nErr));
                     pnode->CloseSocketDisconnect();
+                } else {
+                    pnode->fCanSendData = false;
                 }
             }
             // couldn't send anything at all
@@ -1076,7 +1085,8 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    // epoll has no limit on the descriptors of the inbound connections
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
@@ -1110,276 +1120,514 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterEvents(pnode);
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
-                if (pnode->fDisconnect) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy) {
+            if (pnode->fDisconnect) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                UnregisterEvents(pnode);
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode* pnode : vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode* pnode : vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
-        {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged()
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+void CConnman::InactivityChecks()
+{
+    // Once per second is enough for timeouts counted in seconds
+    const int64_t nTime = GetTime();
+    if (nTime == nLastInactivityCheck)
+        return;
+    nLastInactivityCheck = nTime;
+
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        if (nTime - pnode->nTimeConnected > 60) {
+            if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+                LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+                pnode->fDisconnect = true;
+            } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+                LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+                pnode->fDisconnect = true;
+            } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+                LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+                pnode->fDisconnect = true;
+            } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+                LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+                pnode->fDisconnect = true;
+            }
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+bool CConnman::ReceiveFromNode(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0) {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
         }
+        // a full buffer means there can be more data waiting in the socket
+        return nBytes == (int)sizeof(pchBuf);
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint(BCLog::NET, "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+void CConnman::DrainWakeupPipe()
+{
+#ifndef WIN32
+    // Clear the flag first: the wakeups coming after it reach the pipe again
+    fSocketHandlerWakeup = false;
+    char buf[128];
+    while (read(wakeupPipe[0], buf, sizeof(buf)) > 0) {}
+#endif
+}
 
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+void CConnman::SocketHandlerSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+#ifndef WIN32
+    // New messages queued for sending interrupt the wait
+    if (wakeupPipe[0] != -1) {
+        FD_SET(wakeupPipe[0], &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, (SOCKET)wakeupPipe[0]);
+        have_fds = true;
+    }
+#endif
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
             have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            }
         }
+    }
 
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            return;
+    }
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+#ifndef WIN32
+    if (wakeupPipe[0] != -1 && FD_ISSET(wakeupPipe[0], &fdsetRecv))
+        DrainWakeupPipe();
+#endif
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+    //
+    // Accept new connections
+    //
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            AcceptConnection(hListenSocket);
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy) {
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
+        //
+        // Receive
+        //
+        bool recvSet = false;
+        bool sendSet = false;
+        bool errorSet = false;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
+            sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
+            errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+        }
+        if (recvSet || errorSet) {
+            ReceiveFromNode(pnode);
         }
 
         //
-        // Accept new connections
+        // Send
         //
+        if (sendSet) {
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes)
+                RecordBytesSent(nBytes);
+        }
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+void CConnman::SocketHandlerEpoll()
+{
+    // Don't wait when there is work left from the previous events: data still to
+    // receive (edge-triggered events are reported once) or to send on writable sockets
+    bool fWorkPending = false;
+    for (CNode* pnode : setRecvPendingNodes) {
+        if (!pnode->fPauseRecv) {
+            fWorkPending = true;
+            break;
+        }
+    }
+    if (!fWorkPending) {
+        LOCK(cs_sendPending);
+        for (CNode* pnode : setSendPendingNodes) {
+            if (pnode->fCanSendData) {
+                fWorkPending = true;
+                break;
+            }
+        }
+    }
+
+    epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, fWorkPending ? 0 : EPOLL_TIMEOUT_MILLISECONDS);
+    if (interruptNet)
+        return;
+
+    if (nEvents == -1) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(50)))
+                return;
+        }
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        const int fd = events[i].data.fd;
+        if (fd == wakeupPipe[0]) {
+            DrainWakeupPipe();
+            continue;
+        }
+
+        bool fListenSocket = false;
         for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            if (hListenSocket.socket == (SOCKET)fd) {
+                // level-triggered: the next wait reports the connections left to accept
                 AcceptConnection(hListenSocket);
+                fListenSocket = true;
+                break;
             }
         }
+        if (fListenSocket)
+            continue;
 
-        //
-        // Service each socket
-        //
-        std::vector<CNode*> vNodesCopy;
+        CNode* pnode = nullptr;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
+            auto it = mapSocketToNode.find((SOCKET)fd);
+            if (it != mapSocketToNode.end())
+                pnode = it->second;
         }
-        for (CNode* pnode : vNodesCopy) {
-            if (interruptNet)
-                return;
-
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet) {
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = 0;
-                        {
-                            LOCK(pnode->cs_hSocket);
-                            if (pnode->hSocket == INVALID_SOCKET)
-                                continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        }
-                        if (nBytes > 0) {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            RecordBytesRecv(nBytes);
-                            if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
-                                {
-                                    LOCK(pnode->cs_vProcessMsg);
-                                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                                    pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                                }
-                                WakeMessageHandler();
-                            }
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint(BCLog::NET, "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+        if (!pnode)
+            continue;
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            setRecvPendingNodes.insert(pnode);
+        if (events[i].events & EPOLLOUT) {
+            // under cs_vSend, not to race with a failing send on another thread
+            LOCK(pnode->cs_vSend);
+            pnode->fCanSendData = true;
+        }
+    }
 
-            //
-            // Send
-            //
-            if (sendSet) {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes)
-                    RecordBytesSent(nBytes);
-            }
+    //
+    // Receive, only from the nodes with data available
+    //
+    for (auto it = setRecvPendingNodes.begin(); it != setRecvPendingNodes.end();) {
+        if (interruptNet)
+            return;
+        CNode* pnode = *it;
+        if (pnode->fPauseRecv) {
+            // kept, to be resumed when the message handler catches up
+            ++it;
+            continue;
+        }
+        if (ReceiveFromNode(pnode))
+            ++it;
+        else
+            it = setRecvPendingNodes.erase(it);
+    }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+    //
+    // Send, only to the nodes with data queued and a writable socket
+    //
+    std::vector<CNode*> vSendNodes;
+    {
+        LOCK(cs_sendPending);
+        for (CNode* pnode : setSendPendingNodes) {
+            if (pnode->fCanSendData)
+                vSendNodes.push_back(pnode);
         }
+    }
+    for (CNode* pnode : vSendNodes) {
+        if (interruptNet)
+            return;
+        bool fSent;
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes)
+                RecordBytesSent(nBytes);
+            fSent = pnode->vSendMsg.empty();
+        }
+        if (fSent) {
+            LOCK(cs_sendPending);
+            setSendPendingNodes.erase(pnode);
         }
     }
 }
+#endif
+
+void CConnman::ThreadSocketHandler()
+{
+    int64_t nLastNodesScan = 0;
+    while (!interruptNet) {
+        // With epoll, the node list is scanned once per second rather than at each round of events
+        const int64_t nTime = GetTime();
+        if (socketEventsMode == SOCKETEVENTS_SELECT || nTime != nLastNodesScan) {
+            nLastNodesScan = nTime;
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
+        }
+#ifdef HAVE_SYS_EPOLL_H
+        if (socketEventsMode == SOCKETEVENTS_EPOLL)
+            SocketHandlerEpoll();
+        else
+#endif
+            SocketHandlerSelect();
+        InactivityChecks();
+    }
+}
+
+void CConnman::RegisterEvents(CNode* pnode)
+{
+    AssertLockHeld(cs_vNodes);
+#ifdef HAVE_SYS_EPOLL_H
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+
+    // Edge-triggered: the socket is reported once when it becomes readable or writable
+    epoll_event e;
+    e.events = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLET;
+    e.data.fd = pnode->hSocket;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &e) != 0) {
+        LogPrintf("Failed to add socket of peer=%d to epoll: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+        return;
+    }
+    mapSocketToNode[pnode->hSocket] = pnode;
+#endif
+}
+
+void CConnman::UnregisterEvents(CNode* pnode)
+{
+    AssertLockHeld(cs_vNodes);
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    // The socket leaves the epoll set when it's closed. Its descriptor may already
+    // be reused by another node, so the entries are looked up by node.
+    for (auto it = mapSocketToNode.begin(); it != mapSocketToNode.end();) {
+        if (it->second == pnode)
+            it = mapSocketToNode.erase(it);
+        else
+            ++it;
+    }
+    setRecvPendingNodes.erase(pnode);
+    LOCK(cs_sendPending);
+    setSendPendingNodes.erase(pnode);
+}
+
+void CConnman::WakeSocketHandler()
+{
+#ifndef WIN32
+    if (wakeupPipe[1] == -1)
+        return;
+    // One byte in the pipe is enough to interrupt the wait
+    if (fSocketHandlerWakeup.exchange(true))
+        return;
+    char buf = 0;
+    if (write(wakeupPipe[1], &buf, 1) != 1)
+        LogPrint(BCLog::NET, "write to socket handler wakeup pipe failed\n");
+#endif
+}
 
 void CConnman::WakeMessageHandler()
 {
@@ -1865,6 +2113,7 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterEvents(pnode);
     }
     GetNodeSignals().InitializeNode(pnode, *this);
 
@@ -2063,6 +2312,73 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    socketEventsMode = SOCKETEVENTS_SELECT;
+    nPrevNodeCount = 0;
+    nLastInactivityCheck = 0;
+    wakeupPipe[0] = wakeupPipe[1] = -1;
+    fSocketHandlerWakeup = false;
+    epollfd = -1;
+}
+
+bool CConnman::InitSocketEvents(std::string& strError)
+{
+#ifndef WIN32
+    // Self-pipe, to interrupt the wait for socket events
+    if (pipe(wakeupPipe) != 0) {
+        wakeupPipe[0] = wakeupPipe[1] = -1;
+        LogPrintf("Failed to create the socket handler wakeup pipe: %s\n", NetworkErrorString(errno));
+    } else {
+        for (int fd : wakeupPipe) {
+            int flags = fcntl(fd, F_GETFL, 0);
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(0);
+        if (epollfd == -1) {
+            strError = strprintf("Failed to create epoll file descriptor: %s", NetworkErrorString(errno));
+            return false;
+        }
+        // Level-triggered: the listen sockets and the pipe are reported until drained
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            epoll_event e;
+            e.events = EPOLLIN;
+            e.data.fd = hListenSocket.socket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &e) != 0) {
+                strError = strprintf("Failed to add listen socket to epoll: %s", NetworkErrorString(errno));
+                return false;
+            }
+        }
+        if (wakeupPipe[0] != -1) {
+            epoll_event e;
+            e.events = EPOLLIN;
+            e.data.fd = wakeupPipe[0];
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, wakeupPipe[0], &e) != 0) {
+                strError = strprintf("Failed to add wakeup pipe to epoll: %s", NetworkErrorString(errno));
+                return false;
+            }
+        }
+        LogPrintf("Using epoll for the socket events\n");
+    }
+#endif
+    return true;
+}
+
+void CConnman::CloseSocketEvents()
+{
+#ifndef WIN32
+    for (int& fd : wakeupPipe) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+    if (epollfd != -1)
+        close(epollfd);
+    epollfd = -1;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2083,6 +2399,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
+    socketEventsMode = connOptions.socketEventsMode;
 
     SetBestHeight(connOptions.nBestHeight);
 
@@ -2154,6 +2471,9 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         fMsgProcWake = false;
     }
 
+    if (!InitSocketEvents(strNodeError))
+        return false;
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2211,6 +2531,7 @@ void CConnman::Interrupt()
 
     interruptNet();
     InterruptSocks5(true);
+    WakeSocketHandler();
 
     if (semOutbound)
         for (int i=0; i<(nMaxOutbound + nMaxFeeler); i++)
@@ -2254,6 +2575,10 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+    mapSocketToNode.clear();
+    setRecvPendingNodes.clear();
+    WITH_LOCK(cs_sendPending, setSendPendingNodes.clear(); );
+    CloseSocketEvents();
     delete semOutbound;
     semOutbound = NULL;
     if(pnodeLocalHost)
@@ -2264,6 +2589,8 @@ void CConnman::Stop()
 void CConnman::DeleteNode(CNode* pnode)
 {
     assert(pnode);
+    // A message pushed while disconnecting could have queued the node again
+    WITH_LOCK(cs_sendPending, setSendPendingNodes.erase(pnode); );
     bool fUpdateConnectionTime = false;
     GetNodeSignals().FinalizeNode(pnode->GetId(), fUpdateConnectionTime);
     if(fUpdateConnectionTime)
@@ -2496,6 +2823,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     fPauseRecv = false;
     fPauseSend = false;
+    fCanSendData = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2566,6 +2894,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
     size_t nBytesSent = 0;
+    bool fSendPending = false;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
@@ -2583,9 +2912,19 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
             nBytesSent = SocketSendData(pnode);
+        fSendPending = optimisticSend && !pnode->vSendMsg.empty();
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
+
+    if (fSendPending) {
+        // Left for the socket handler, woken up not to wait for its next round
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            LOCK(cs_sendPending);
+            setSendPendingNodes.insert(pnode);
+        }
+        WakeSocketHandler();
+    }
 }
 
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
@@ -26,7 +26,9 @@
 #include <atomic>
 #include <deque>
 #include <stdint.h>
+#include <set>
 #include <thread>
+#include <unordered_map>
 #include <memory>
 #include <condition_variable>
 
@@ -90,6 +92,17 @@ static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
+/** Maximum number of socket events handled at each epoll_wait */
+static const int MAX_EPOLL_EVENTS = 64;
+/** Maximum wait for socket events with epoll (the queued sends wake the socket handler up) */
+static const int EPOLL_TIMEOUT_MILLISECONDS = 1000;
+
+/** How the socket handler waits for the sockets to be readable or writable (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT = 0,
+    SOCKETEVENTS_EPOLL = 1,
+};
+
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 
 typedef int NodeId;
@@ -149,6 +162,7 @@ public:
         CClientUIInterface* uiInterface = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -163,6 +177,9 @@ public:
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
 
+    /** Interrupt the wait for socket events (e.g. to receive again from a node no longer paused) */
+    void WakeSocketHandler();
+
     template<typename Callable>
     bool ForEachNodeContinueIf(Callable&& func)
     {
@@ -293,6 +310,20 @@ private:
     void ThreadOpenConnections();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityChecks();
+    /** Receive the available data of a node, returning whether more may be left in its socket */
+    bool ReceiveFromNode(CNode* pnode);
+    bool InitSocketEvents(std::string& strError);
+    void CloseSocketEvents();
+    void DrainWakeupPipe();
+    /** Add the socket of a new node to the epoll set (requires cs_vNodes) */
+    void RegisterEvents(CNode* pnode);
+    /** Forget a node being disconnected (requires cs_vNodes) */
+    void UnregisterEvents(CNode* pnode);
+    void SocketHandlerSelect();
+    void SocketHandlerEpoll();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -385,6 +416,24 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    SocketEventsMode socketEventsMode;
+    unsigned int nPrevNodeCount;
+    int64_t nLastInactivityCheck;
+
+    /** Self-pipe interrupting the wait for socket events (-1 when not available) */
+    int wakeupPipe[2];
+    /** Whether a wakeup is already in the pipe */
+    std::atomic<bool> fSocketHandlerWakeup;
+
+    int epollfd;
+    /** Nodes by socket, to find the node of an epoll event (guarded by cs_vNodes) */
+    std::unordered_map<SOCKET, CNode*> mapSocketToNode;
+    /** Nodes with data left to receive from previous (edge-triggered) events. Socket handler thread only. */
+    std::set<CNode*> setRecvPendingNodes;
+    /** Nodes with data queued for sending, serviced when their socket is writable */
+    std::set<CNode*> setSendPendingNodes;
+    RecursiveMutex cs_sendPending;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
@@ -509,12 +558,15 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    bool fSigPreVerified; // signature already sent to the batch verification (tier two messages)
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fSigPreVerified = false;
     }
 
     bool complete() const
@@ -596,6 +648,8 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Whether the socket was writable at the last send (epoll mode only). Requires cs_vSend.
+    std::atomic_bool fCanSendData;
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
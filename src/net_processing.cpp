@@ -6,6 +6,7 @@
 
 #include "net_processing.h"
 
+#include "blockencodings.h"
 #include "chain.h"
 #include "masternodeman.h"
 #include "masternode-payments.h"
@@ -23,6 +24,19 @@ int64_t nTimeBestReceived = 0;  // Used only to inform the wallet of when we las
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
+/** Minimum number of queued tier two messages to verify their signatures in a batch */
+static const size_t MIN_TIER_TWO_SIG_BATCH = 16;
+/** Maximum number of queued tier two messages of a peer to verify their signatures in a batch
+ *  (a new batch starts once the handlers processed the previous one) */
+static const size_t MAX_TIER_TWO_SIG_BATCH = 200;
+
+/** Maximum depth of the blocks served as compact blocks (older ones are sent in full) */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of the blocks whose transactions are served with blocktxn messages */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Time to wait (in seconds) for the blocktxn answer to a getblocktxn, before requesting the full block */
+static const int64_t BLOCKTXN_TIMEOUT = 10;
+
 struct COrphanTx {
     CTransactionRef tx;
     NodeId fromPeer;
@@ -202,14 +216,22 @@ struct CNodeState {
     uint256 hashLastUnknownBlock;
     //! The last full block we both have.
     CBlockIndex* pindexLastCommonBlock;
+    //! The last header received from this peer, kept until its headers sync moves on (its branch may have less work yet).
+    const CBlockIndex* pindexLastHeaders;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
+    //! Whether the headers of this peer were cut at MAX_HEADERS_AHEAD, to be requested again as the blocks are connected.
+    bool fHeadersCapped;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     std::list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! The compact block being reconstructed, waiting for the missing transactions from this peer.
+    std::unique_ptr<PartiallyDownloadedBlock> partialBlock;
+    //! When the missing transactions of partialBlock were requested (in microseconds).
+    int64_t nPartialBlockTime;
 
     CNodeBlocks nodeBlocks;
 
@@ -220,8 +242,11 @@ struct CNodeState {
         pindexBestKnownBlock = NULL;
         hashLastUnknownBlock.SetNull();
         pindexLastCommonBlock = NULL;
+        pindexLastHeaders = NULL;
         fSyncStarted = false;
+        fHeadersCapped = false;
         nStallingSince = 0;
+        nPartialBlockTime = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
     }
@@ -281,6 +306,57 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
         PushNodeVersion(pnode, connman, GetTime());
 }
 
+/** Forget the header-only chains no peer serves anymore, and the ones leading to an invalid block. Requires cs_main. */
+void PruneHeaderChains()
+{
+    std::vector<const CBlockIndex*> vKeep;
+    for (auto& it : mapNodeState) {
+        CNodeState& state = it.second;
+        if (state.pindexBestKnownBlock) {
+            const CBlockIndex* pindex = state.pindexBestKnownBlock;
+            while (pindex->pprev && !(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK)))
+                pindex = pindex->pprev;
+            if (pindex->nStatus & BLOCK_FAILED_MASK) {
+                // The best chain of this peer is invalid
+                state.pindexBestKnownBlock = nullptr;
+            } else {
+                vKeep.push_back(state.pindexBestKnownBlock);
+            }
+        }
+        if (state.pindexLastHeaders) {
+            if (state.pindexLastHeaders->nStatus & BLOCK_FAILED_MASK)
+                state.pindexLastHeaders = nullptr;
+            else
+                vKeep.push_back(state.pindexLastHeaders);
+        }
+        for (const QueuedBlock& entry : state.vBlocksInFlight) {
+            if (entry.pindex)
+                vKeep.push_back(entry.pindex);
+        }
+        if (state.partialBlock) {
+            BlockMap::iterator mi = mapBlockIndex.find(state.partialBlock->header.GetHash());
+            if (mi != mapBlockIndex.end())
+                vKeep.push_back(mi->second);
+        }
+    }
+    PruneHeaderOnlyBlocks(vKeep);
+}
+
+/** Penalize the peers announcing a chain through an invalid block, except its source (already penalized). Requires cs_main. */
+void MisbehavingBranch(const uint256& hash, NodeId nodeSource, int nDoS)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return;
+    const CBlockIndex* pindexInvalid = mi->second;
+    for (auto& it : mapNodeState) {
+        const CBlockIndex* pindexBest = it.second.pindexBestKnownBlock;
+        if (it.first != nodeSource && pindexBest && pindexBest->GetAncestor(pindexInvalid->nHeight) == pindexInvalid)
+            Misbehaving(it.first, nDoS);
+    }
+    PruneHeaderChains();
+}
+
 void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime)
 {
     fUpdateConnectionTime = false;
@@ -300,6 +376,8 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime)
     nPreferredDownload -= state->fPreferredDownload;
 
     mapNodeState.erase(nodeid);
+    // Forget the headers only this peer was serving
+    PruneHeaderChains();
 }
 
 // Requires cs_main.
@@ -367,6 +445,19 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256& hash)
     }
 }
 
+/** Whether the chain is synced with this peer requesting headers first (and downloading the blocks in parallel). */
+bool UseHeadersFirst(const CNode* pnode)
+{
+    return Params().HeadersFirstSyncingActive() && pnode->nVersion >= HEADERS_FIRST_VERSION;
+}
+
+/** Whether blocks are requested to this peer as compact blocks (reconstructed from the mempool). */
+static bool PreferCompactBlock(const CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    return (pnode->GetLocalServices() & NODE_COMPACT_BLOCKS) && (pnode->nServices & NODE_COMPACT_BLOCKS) &&
+           !IsInitialBlockDownload();
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
@@ -451,6 +542,11 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
+                if (IsBlockPending(pindex) ||
+                        (IsPendingBlocksFull() && pindex->pprev && !(pindex->pprev->nStatus & BLOCK_HAVE_DATA))) {
+                    // Already received and waiting for its parent, or it couldn't be kept until the parent arrives
+                    continue;
+                }
                 if (pindex->nHeight > nWindowEnd) {
                     // We reached the end of the window.
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
@@ -656,6 +752,8 @@ void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationSta
                 Misbehaving(it->second, nDoS);
             }
         }
+        if (nDoS > 0 && !state.CorruptionPossible())
+            MisbehavingBranch(hash, it != mapBlockSource.end() ? it->second : -1, nDoS);
     }
 
     if (it != mapBlockSource.end())
@@ -797,7 +895,7 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 return;
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -816,14 +914,29 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else // MSG_FILTERED_BLOCK)
+                    // Only blocks close to the tip are sent as compact blocks: the peer is unlikely to
+                    // have the transactions of older ones in its mempool, so it gets the full block instead.
+                    const bool fCompact = inv.type == MSG_CMPCT_BLOCK && (pfrom->GetLocalServices() & NODE_COMPACT_BLOCKS) &&
+                                          mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fCompact)) {
+                        // Send the block bytes as stored on disk (a block is serialized
+                        // the same way on disk and on the wire), without deserializing it
+                        CSerializedNetMsg msg;
+                        msg.command = NetMsgType::BLOCK;
+                        if (!ReadRawBlockFromDisk(msg.data, (*mi).second->GetBlockPos()))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, std::move(msg));
+                    } else if (fCompact) {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(block)));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         bool send = false;
                         CMerkleBlock merkleBlock;
                         {
@@ -963,7 +1076,7 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 }
             }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -1016,6 +1129,53 @@ static void CheckBlockSpam(CValidationState& state, CNode* pfrom, const uint256&
     }
 }
 
+/** Process a block received from a peer, as a block message or reconstructed from a compact block */
+static void ProcessReceivedBlock(CNode* pfrom, CConnman& connman, const std::shared_ptr<CBlock>& pblock, const std::string& strCommand)
+{
+    CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    const uint256& hashBlock = pblock->GetHash();
+    CInv inv(MSG_BLOCK, hashBlock);
+    pfrom->AddInventoryKnown(inv);
+    CValidationState state;
+    // With headers first, the block can already be indexed (from its header) without data
+    const bool fHaveData = WITH_LOCK(cs_main,
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            return mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA); );
+    if (!fHaveData) {
+        // Only the blocks we asked for are kept when they arrive before their parent
+        const bool fRequested = WITH_LOCK(cs_main,
+                auto it = mapBlocksInFlight.find(hashBlock);
+                bool fInFlight = it != mapBlocksInFlight.end() && it->second.first == pfrom->GetId();
+                MarkBlockAsReceived(hashBlock);
+                return fInFlight; );
+        bool fAccepted = true;
+        ProcessNewBlock(state, pfrom, pblock, nullptr, &fAccepted, fRequested);
+        if (!fAccepted) {
+            CheckBlockSpam(state, pfrom, hashBlock);
+        }
+        WITH_LOCK(cs_main, mapBlockSource.emplace(hashBlock, pfrom->GetId()); );
+        int nDoS;
+        if(state.IsInvalid(nDoS)) {
+            assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
+                state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+            if(nDoS > 0) {
+                TRY_LOCK(cs_main, lockMain);
+                if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
+            }
+            if (!state.CorruptionPossible()) {
+                // Drop the header chains through the invalid block, penalizing the other peers announcing them
+                LOCK(cs_main);
+                MisbehavingBranch(hashBlock, pfrom->GetId(), nDoS);
+            }
+        }
+        //disconnect this node if its old protocol version
+        pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), strCommand);
+    } else {
+        LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, pblock->GetHash().GetHex());
+    }
+}
+
 bool fRequestedSporksIDB = false;
 bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
@@ -1283,9 +1443,27 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    // Near the tip, the block is fetched as a compact block when the peer supports it
+                    const CInv invFetch(PreferCompactBlock(pfrom) ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash);
+                    if (UseHeadersFirst(pfrom)) {
+                        // First request the headers preceding the announced block (none, when it's a
+                        // direct successor of our best header), so the header chain is validated when
+                        // the block arrives. The block itself is requested directly only when we are
+                        // close to being synced, otherwise it's downloaded with the others in SendMessages.
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), inv.hash));
+                        CNodeState* nodestate = State(pfrom->GetId());
+                        if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().GetConsensus().nTargetSpacing * 20 &&
+                                nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                            vToFetch.push_back(invFetch);
+                            // Mark block as in flight already, even though the getdata is sent below
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        }
+                        LogPrint(BCLog::NET, "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(invFetch);
+                        LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -1316,7 +1494,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == NetMsgType::GETBLOCKS || strCommand == NetMsgType::GETHEADERS) {
+    else if (strCommand == NetMsgType::GETBLOCKS) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -1354,13 +1532,13 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == NetMsgType::HEADERS && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == NetMsgType::GETHEADERS) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         if (locator.vHave.size() > MAX_LOCATOR_SZ) {
-            LogPrint(BCLog::NET, "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
+            LogPrint(BCLog::NET, "getheaders locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
             pfrom->fDisconnect = true;
             return true;
         }
@@ -1387,7 +1565,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         std::vector<CBlock> vHeaders;
         int nLimit = MAX_HEADERS_RESULTS;
-        LogPrintf("getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
+        LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->id);
         for (; pindex; pindex = chainActive.Next(pindex)) {
             vHeaders.push_back(pindex->GetBlockHeader());
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
@@ -1544,36 +1722,40 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
-        CBlockIndex* pindexLast = NULL;
-        for (const CBlockHeader& header : headers) {
-            CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
+        }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
-                int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    if (nDoS > 0)
-                        Misbehaving(pfrom->GetId(), nDoS);
-                    std::string strError = "invalid header received " + header.GetHash().ToString();
-                    return error(strError.c_str());
-                }
+        CBlockIndex* pindexLast = NULL;
+        CValidationState state;
+        if (!ProcessNewBlockHeaders(headers, state, &pindexLast)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("invalid header received from peer=%d: %s", pfrom->id, FormatStateMessage(state));
             }
         }
 
-        if (pindexLast)
+        if (pindexLast) {
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
+            State(pfrom->GetId())->pindexLastHeaders = pindexLast;
+        }
+        // Drop the branches this peer moved away from
+        PruneHeaderChains();
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (!pindexLast || pindexLast->GetBlockHash() != headers.back().GetHash()) {
+            // Cut at MAX_HEADERS_AHEAD: the rest is requested in SendMessages, once the blocks are connected
+            LogPrint(BCLog::NET, "headers from peer=%d too far ahead of the active chain (%d)\n", pfrom->id, chainActive.Height());
+            State(pfrom->GetId())->fHeadersCapped = true;
+        } else if (nCount == MAX_HEADERS_RESULTS) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
-            LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+            LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), UINT256_ZERO));
         }
     }
@@ -1598,32 +1780,166 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
         } else {
-            pfrom->AddInventoryKnown(inv);
+            ProcessReceivedBlock(pfrom, connman, pblock, strCommand);
+        }
+    }
+
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256& hashBlock = cmpctblock.header.GetHash();
+        LogPrint(BCLog::CMPCTBLOCK, "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint(BCLog::CMPCTBLOCK, "%s : Already processed block %s, ignoring cmpctblock\n", __func__, hashBlock.GetHex());
+                return true;
+            }
+            CNodeState* nodestate = State(pfrom->GetId());
+            std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hashBlock);
+            const bool fRequested = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            const bool fAnnounced = nodestate->hashLastUnknownBlock == hashBlock ||
+                                    (nodestate->pindexBestKnownBlock && nodestate->pindexBestKnownBlock->GetBlockHash() == hashBlock);
+            if (!fRequested && !fAnnounced) {
+                // Compact blocks are only requested for announced blocks: an unsolicited one
+                // isn't worth the mempool scan (and the getblocktxn round trip)
+                LogPrint(BCLog::CMPCTBLOCK, "Peer %d sent us an unsolicited cmpctblock %s, ignoring\n", pfrom->id, hashBlock.ToString());
+                return true;
+            }
+            if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+                // Doesn't connect to our chain: let the full block go through the usual sync logic
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock))));
+                return true;
+            }
+
+            // Check the header before reconstructing the block
             CValidationState state;
-            if (!mapBlockIndex.count(hashBlock)) {
-                WITH_LOCK(cs_main, MarkBlockAsReceived(hashBlock); );
-                bool fAccepted = true;
-                ProcessNewBlock(state, pfrom, pblock, nullptr, &fAccepted);
-                if (!fAccepted) {
-                    CheckBlockSpam(state, pfrom, hashBlock);
-                }
-                WITH_LOCK(cs_main, mapBlockSource.emplace(hashBlock, pfrom->GetId()); );
+            CBlockIndex* pindex = nullptr;
+            if (!ProcessNewBlockHeaders({cmpctblock.header}, state, &pindex)) {
                 int nDoS;
-                if(state.IsInvalid(nDoS)) {
-                    assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
-                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
-                        state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-                    if(nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
+                if (state.IsInvalid(nDoS)) {
+                    MarkBlockAsReceived(hashBlock);
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    LogPrintf("Peer %d sent us a cmpctblock with an invalid header: %s\n", pfrom->id, FormatStateMessage(state));
                 }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), strCommand);
-            } else {
-                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, pblock->GetHash().GetHex());
+                return true;
+            }
+            if (!pindex) {
+                // Too far ahead of the active chain: it's requested again once we get there
+                MarkBlockAsReceived(hashBlock);
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+
+            nodestate->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            ReadStatus status = nodestate->partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                nodestate->partialBlock.reset();
+                MarkBlockAsReceived(hashBlock);
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Short id collision, request the full block
+                nodestate->partialBlock.reset();
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock))));
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < nodestate->partialBlock->GetTxCount(); i++) {
+                if (!nodestate->partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                // Wait for the transactions missing from our mempool
+                req.blockhash = hashBlock;
+                nodestate->nPartialBlockTime = GetTimeMicros();
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+                return true;
+            }
+
+            status = nodestate->partialBlock->FillBlock(*pblock, std::vector<CTransactionRef>());
+            nodestate->partialBlock.reset();
+            if (status != READ_STATUS_OK) {
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock))));
+                return true;
+            }
+        }
+        ProcessReceivedBlock(pfrom, connman, pblock, strCommand);
+    }
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint(BCLog::CMPCTBLOCK, "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = nodestate->partialBlock->FillBlock(*pblock, resp.txn);
+            nodestate->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash))));
+                return true;
             }
         }
+        ProcessReceivedBlock(pfrom, connman, pblock, strCommand);
+    }
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN) {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        if (!(pfrom->GetLocalServices() & NODE_COMPACT_BLOCKS)) {
+            LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn but we don't serve compact blocks\n", pfrom->id);
+            return true;
+        }
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Too deep to be served from a compact block: reply with the full block (as to a getdata),
+            // once the message processing loop goes around again
+            LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.emplace_back(MSG_BLOCK, req.blockhash);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            assert(!"cannot load block from disk");
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
     }
 
     // This asymmetric behavior for inbound and outbound connections was introduced
@@ -1850,6 +2166,127 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 }
 
 
+static bool IsTierTwoSignedMessage(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::MNBROADCAST ||
+           strCommand == NetMsgType::MNPING ||
+           strCommand == NetMsgType::MNWINNER ||
+           strCommand == NetMsgType::BUDGETVOTE ||
+           strCommand == NetMsgType::FINALBUDGETVOTE;
+}
+
+// Add the signature check of a message, unless the masternode is unknown (the handler rejects it anyway)
+template <typename T>
+static void AddSignatureCheck(const T& message, std::vector<CHashSigCheck>& vChecks)
+{
+    std::string strError;
+    const CPubKey& pubKey = message.GetPublicKey(strError);
+    if (pubKey.IsValid()) {
+        vChecks.emplace_back(message.GetSignatureCheck(pubKey));
+    }
+}
+
+/**
+ * During the tier two sync, peers send long runs of signed messages (masternode
+ * broadcasts and pings, payment winners, budget votes), each needing a public key
+ * recovery. Verify the signatures of the ones queued for pfrom in one parallel
+ * batch: the valid ones end up in the message signature cache, so that the
+ * (serial) processing of the messages does not verify them again.
+ */
+static void PreVerifyTierTwoSignatures(CNode* pfrom)
+{
+    // the messages of a peer about to be banned are not worth verifying in advance
+    if (pfrom->fDisconnect)
+        return;
+    {
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (state == nullptr || state->fShouldBan || state->nMisbehavior > 0)
+            return;
+    }
+
+    std::vector<CDataStream> vStreams;
+    std::vector<std::string> vCommands;
+    {
+        LOCK(pfrom->cs_vProcessMsg);
+        size_t nPending = 0;
+        for (const CNetMessage& msg : pfrom->vProcessMsg) {
+            if (!IsTierTwoSignedMessage(msg.hdr.GetCommand())) continue;
+            // wait for the handlers to process the previous batch
+            if (msg.fSigPreVerified) return;
+            nPending++;
+        }
+        if (nPending < MIN_TIER_TWO_SIG_BATCH) return;
+        for (CNetMessage& msg : pfrom->vProcessMsg) {
+            if (vStreams.size() >= MAX_TIER_TWO_SIG_BATCH) break;
+            if (msg.fSigPreVerified || !IsTierTwoSignedMessage(msg.hdr.GetCommand())) continue;
+            msg.fSigPreVerified = true;
+            vStreams.emplace_back(msg.vRecv);
+            vCommands.emplace_back(msg.hdr.GetCommand());
+        }
+    }
+
+    // Skip the messages the handlers reject without checking their signature: already seen,
+    // from unknown masternodes, or out of their time (or height) range
+    const int64_t nNow = GetAdjustedTime();
+    const int nHeight = mnodeman.GetBestHeight();
+    int nFirstWinnerHeight = 0;
+    bool fWinnerRangeSet = false;
+    std::vector<CHashSigCheck> vChecks;
+    for (size_t i = 0; i < vStreams.size(); i++) {
+        CDataStream& vRecv = vStreams[i];
+        vRecv.SetVersion(pfrom->GetRecvVersion());
+        try {
+            if (vCommands[i] == NetMsgType::MNBROADCAST) {
+                CMasternodeBroadcast mnb;
+                vRecv >> mnb;
+                if (mnb.sigTime > nNow + 60 * 60 || mnodeman.HaveSeenMasternodeBroadcast(mnb.GetHash()))
+                    continue;
+                vChecks.emplace_back(mnb.GetSignatureCheck());
+                if (!mnb.lastPing.IsNull()) {
+                    vChecks.emplace_back(mnb.lastPing.GetSignatureCheck(mnb.pubKeyMasternode));
+                }
+            } else if (vCommands[i] == NetMsgType::MNPING) {
+                CMasternodePing mnp;
+                vRecv >> mnp;
+                if (mnp.sigTime > nNow + 60 * 60 || mnp.sigTime <= nNow - 60 * 60 || mnodeman.HaveSeenMasternodePing(mnp.GetHash()))
+                    continue;
+                AddSignatureCheck(mnp, vChecks);
+            } else if (vCommands[i] == NetMsgType::MNWINNER) {
+                CMasternodePaymentWinner winner;
+                vRecv >> winner;
+                if (!fWinnerRangeSet) {
+                    nFirstWinnerHeight = nHeight - (mnodeman.CountEnabled() * 1.25);
+                    fWinnerRangeSet = true;
+                }
+                if (winner.nBlockHeight < nFirstWinnerHeight || winner.nBlockHeight > nHeight + 20 ||
+                        masternodePayments.HaveSeenPaymentWinner(winner.GetHash()))
+                    continue;
+                AddSignatureCheck(winner, vChecks);
+            } else if (vCommands[i] == NetMsgType::BUDGETVOTE) {
+                CBudgetVote vote;
+                vRecv >> vote;
+                if (budget.HaveSeenProposalVote(vote.GetHash()))
+                    continue;
+                AddSignatureCheck(vote, vChecks);
+            } else if (vCommands[i] == NetMsgType::FINALBUDGETVOTE) {
+                CFinalizedBudgetVote vote;
+                vRecv >> vote;
+                if (budget.HaveSeenFinalizedBudgetVote(vote.GetHash()))
+                    continue;
+                AddSignatureCheck(vote, vChecks);
+            }
+        } catch (const std::exception&) {
+            // malformed messages are reported when processed
+            continue;
+        }
+    }
+
+    const size_t nValid = CHashSigner::VerifyHashes(vChecks);
+    LogPrint(BCLog::MASTERNODE, "%s : %d/%d valid signatures in %d queued messages, peer=%d\n",
+            __func__, nValid, vChecks.size(), vStreams.size(), pfrom->GetId());
+}
+
 bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
     // Message format
@@ -1882,8 +2319,12 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        const bool fPausedRecv = pfrom->fPauseRecv;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
+        // Resume receiving without waiting for the next socket event
+        if (fPausedRecv && !pfrom->fPauseRecv)
+            connman.WakeSocketHandler();
     }
     CNetMessage& msg(msgs.front());
 
@@ -1903,6 +2344,10 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
     }
     std::string strCommand = hdr.GetCommand();
 
+    if (fMoreWork && IsTierTwoSignedMessage(strCommand)) {
+        PreVerifyTierTwoSignatures(pfrom);
+    }
+
     // Message size
     unsigned int nMessageSize = hdr.nMessageSize;
 
@@ -2053,10 +2498,24 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO);
-                connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
+                if (UseHeadersFirst(pto)) {
+                    // Headers first: the blocks are then requested in parallel from all the peers having them
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO));
+                } else {
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
+                }
+            }
+        }
+
+        // Resume the headers sync cut at MAX_HEADERS_AHEAD, once the active chain caught up
+        if (state.fHeadersCapped && !fImporting && !fReindex) {
+            const CBlockIndex* pindexStart = state.pindexBestKnownBlock ? state.pindexBestKnownBlock : chainActive.Tip();
+            if (pindexStart->nHeight - chainActive.Height() < MAX_HEADERS_AHEAD / 2) {
+                state.fHeadersCapped = false;
+                LogPrint(BCLog::NET, "resume getheaders (%d) to peer=%d\n", pindexStart->nHeight, pto->id);
+                connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO));
             }
         }
 
@@ -2134,6 +2593,13 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             pto->fDisconnect = true;
             return true;
         }
+        // The peer didn't answer our getblocktxn in time: give up the compact block and ask for the full block
+        if (state.partialBlock && state.nPartialBlockTime < nNow - 1000000 * BLOCKTXN_TIMEOUT) {
+            const uint256& hashBlock = state.partialBlock->header.GetHash();
+            LogPrint(BCLog::CMPCTBLOCK, "Timeout waiting for blocktxn of %s from peer=%d, requesting the full block\n", hashBlock.ToString(), pto->id);
+            connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock))));
+            state.partialBlock.reset();
+        }
 
         //
         // Message: getdata (blocks)
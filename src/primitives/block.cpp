@@ -14,6 +14,36 @@
 #include "util.h"
 
 uint256 CBlockHeader::GetHash() const
+{
+    if (cachedHash.fSet &&
+            cachedHash.nVersion == nVersion &&
+            cachedHash.hashPrevBlock == hashPrevBlock &&
+            cachedHash.hashMerkleRoot == hashMerkleRoot &&
+            cachedHash.nTime == nTime &&
+            cachedHash.nBits == nBits &&
+            cachedHash.nNonce == nNonce &&
+            cachedHash.nAccumulatorCheckpoint == nAccumulatorCheckpoint &&
+            cachedHash.hashFinalSaplingRoot == hashFinalSaplingRoot) {
+        return cachedHash.hash;
+    }
+    return ComputeHash();
+}
+
+void CBlockHeader::CacheHash()
+{
+    cachedHash.hash = ComputeHash();
+    cachedHash.nVersion = nVersion;
+    cachedHash.hashPrevBlock = hashPrevBlock;
+    cachedHash.hashMerkleRoot = hashMerkleRoot;
+    cachedHash.nTime = nTime;
+    cachedHash.nBits = nBits;
+    cachedHash.nNonce = nNonce;
+    cachedHash.nAccumulatorCheckpoint = nAccumulatorCheckpoint;
+    cachedHash.hashFinalSaplingRoot = hashFinalSaplingRoot;
+    cachedHash.fSet = true;
+}
+
+uint256 CBlockHeader::ComputeHash() const
 {
     if (nVersion < 4)  {
 #if defined(WORDS_BIGENDIAN)
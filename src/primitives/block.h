@@ -56,6 +56,10 @@ public:
         // Sapling active
         if (nVersion >= 8)
             READWRITE(hashFinalSaplingRoot);
+
+        // the fields of a deserialized header are hashed (at least) once anyway
+        if (ser_action.ForRead())
+            CacheHash();
     }
 
     void SetNull()
@@ -68,6 +72,7 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint.SetNull();
         hashFinalSaplingRoot.SetNull();
+        cachedHash.fSet = false;
     }
 
     bool IsNull() const
@@ -75,12 +80,35 @@ public:
         return (nBits == 0);
     }
 
+    /** Hash of the header (memoized when the header is deserialized, as long as it isn't modified) */
     uint256 GetHash() const;
 
+    /** Calculate the hash, ignoring the memoized one */
+    uint256 ComputeHash() const;
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+private:
+    // Memory only. The hash calculated at deserialization, along with the fields it was calculated
+    // on: it is not used anymore once any of them has been changed. Only ever written on a header
+    // owned by the caller, so that GetHash() can be called concurrently on shared blocks.
+    struct CachedHash {
+        bool fSet = false;
+        uint256 hash;
+        int32_t nVersion;
+        uint256 hashPrevBlock;
+        uint256 hashMerkleRoot;
+        uint32_t nTime;
+        uint32_t nBits;
+        uint32_t nNonce;
+        uint256 nAccumulatorCheckpoint;
+        uint256 hashFinalSaplingRoot;
+    } cachedHash;
+
+    void CacheHash();
 };
 
 
@@ -220,6 +220,23 @@ extern const char* REJECT;
  * @see https://bitcoin.org/en/developer-reference#sendheaders
  */
 extern const char* SENDHEADERS;
+/**
+ * Contains a CBlockHeaderAndShortTxIDs object - providing a header, the block
+ * signature and a list of "short txids" of the block transactions.
+ * Only available with service bit NODE_COMPACT_BLOCKS.
+ */
+extern const char* CMPCTBLOCK;
+/**
+ * Contains a BlockTransactionsRequest, used to request the transactions of a
+ * compact block that the node couldn't find in its mempool.
+ * Only available with service bit NODE_COMPACT_BLOCKS.
+ */
+extern const char* GETBLOCKTXN;
+/**
+ * Contains a BlockTransactions, sent in reply to a getblocktxn message.
+ * Only available with service bit NODE_COMPACT_BLOCKS.
+ */
+extern const char* BLOCKTXN;
 /**
  * The ix message transmits a single SwiftX transaction
  */
@@ -306,6 +323,10 @@ enum ServiceFlags : uint64_t {
     // that the node doesn't want to receive master nodes messages. (the 1<<3 was not picked as constant because on bitcoin 0.14 is witness and we want that update here )
     NODE_BLOOM_WITHOUT_MN = (1 << 4),
 
+    // NODE_COMPACT_BLOCKS means the node can serve blocks as compact blocks (cmpctblock,
+    // getblocktxn and blocktxn messages), and reconstruct the ones it receives from its mempool.
+    NODE_COMPACT_BLOCKS = (1 << 5),
+
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
     // bitcoin-development mailing list. Remember that service bits are just
@@ -399,7 +420,9 @@ enum {
     MSG_MASTERNODE_QUORUM,
     MSG_MASTERNODE_ANNOUNCE,
     MSG_MASTERNODE_PING,
-    MSG_DSTX
+    MSG_DSTX,
+    // Only used in getdata, to request a block as a cmpctblock message (never in invs).
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -159,7 +159,8 @@ UniValue generate(const JSONRPCRequest& request)
 
     while (nHeight < nHeightEnd && !ShutdownRequested()) {
 
-        // Get available coins
+        // Get available coins (once the wallet has processed the last block generated)
+        if (fPoS) SyncWithValidationInterfaceTip(GetChainTip());
         std::vector<CStakeableOutput> availableCoins;
         if (fPoS && !pwalletMain->StakeableCoins(&availableCoins)) {
             throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "No available coins to stake");
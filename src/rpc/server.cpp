@@ -317,6 +317,7 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true },
         {"blockchain", "invalidateblock", &invalidateblock, true },
         {"blockchain", "reconsiderblock", &reconsiderblock, true },
+        {"blockchain", "savemempool", &savemempool, true },
         {"blockchain", "verifychain", &verifychain, true },
 
         /* Mining */
@@ -358,6 +359,7 @@ static const CRPCCommand vRPCCommands[] =
         { "hidden",             "waitfornewblock",        &waitfornewblock,        true },
         { "hidden",             "waitforblock",           &waitforblock,           true },
         { "hidden",             "waitforblockheight",     &waitforblockheight,     true },
+        { "hidden",             "syncwithvalidationinterfacequeue", &syncwithvalidationinterfacequeue, true },
 
         /* PIVX features */
         {"allforonebusiness", "listmasternodes", &listmasternodes, true },
@@ -255,6 +255,7 @@ extern UniValue getsupplyinfo(const JSONRPCRequest& request);
 extern UniValue waitfornewblock(const JSONRPCRequest& request);
 extern UniValue waitforblock(const JSONRPCRequest& request);
 extern UniValue waitforblockheight(const JSONRPCRequest& request);
+extern UniValue syncwithvalidationinterfacequeue(const JSONRPCRequest& request);
 extern UniValue getdifficulty(const JSONRPCRequest& request);
 extern UniValue getmempoolinfo(const JSONRPCRequest& request);
 extern UniValue getrawmempool(const JSONRPCRequest& request);
@@ -267,6 +268,7 @@ extern UniValue gettxout(const JSONRPCRequest& request);
 extern UniValue verifychain(const JSONRPCRequest& request);
 extern UniValue getchaintips(const JSONRPCRequest& request);
 extern UniValue invalidateblock(const JSONRPCRequest& request);
+extern UniValue savemempool(const JSONRPCRequest& request);
 extern UniValue reconsiderblock(const JSONRPCRequest& request);
 extern UniValue getblockindexstats(const JSONRPCRequest& request);
 extern UniValue getserials(const JSONRPCRequest& request);
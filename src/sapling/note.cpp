@@ -2,14 +2,18 @@
 
 #include "sapling/prf.h"
 #include "sapling/sapling_util.h"
+#include "sapling/sapling_transaction.h"
 #include "crypto/sha256.h"
 
 #include "random.h"
 #include "version.h"
 #include "streams.h"
+#include "util.h"
 
 #include <librustzcash.h>
 
+#include <thread>
+
 using namespace libzcash;
 
 SproutNote::SproutNote() {
@@ -312,3 +316,60 @@ SaplingOutCiphertext SaplingOutgoingPlaintext::encrypt(
 
     return enc.encrypt_to_ourselves(ovk, cv, cm, pt);
 }
+
+/** Minimum number of trial decryptions to give a thread */
+static const size_t MIN_DECRYPTIONS_PER_THREAD = 16;
+
+std::vector<boost::optional<std::pair<size_t, SaplingNotePlaintext>>> libzcash::TrialDecryptSaplingOutputs(
+        const std::vector<const OutputDescription*>& vOutputs,
+        const std::vector<SaplingIncomingViewingKey>& vIvk)
+{
+    typedef std::pair<size_t, SaplingNotePlaintext> IvkMatch;
+    std::vector<boost::optional<IvkMatch>> vResults(vOutputs.size());
+    const size_t nIvk = vIvk.size();
+    const size_t nTrials = vOutputs.size() * nIvk;
+    if (nTrials == 0) {
+        return vResults;
+    }
+
+    // The pairs are numbered output-major: a thread tries the keys of an output in
+    // sequence (with the same epk and ciphertext) and moves on at the first match.
+    auto decrypt = [&](size_t nStart, size_t nEnd, std::vector<std::pair<size_t, IvkMatch>>& vFound) {
+        for (size_t k = nStart; k < nEnd; k++) {
+            const size_t nOut = k / nIvk;
+            if (!vFound.empty() && vFound.back().first == nOut) {
+                continue;
+            }
+            const OutputDescription& output = *vOutputs[nOut];
+            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, vIvk[k % nIvk], output.ephemeralKey, output.cmu);
+            if (result) {
+                vFound.emplace_back(nOut, IvkMatch(k % nIvk, result.get()));
+            }
+        }
+    };
+
+    // one key agreement (a Jubjub scalar multiplication) per pair: split the work across the cores
+    const size_t nThreads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), nTrials / MIN_DECRYPTIONS_PER_THREAD));
+    std::vector<std::vector<std::pair<size_t, IvkMatch>>> vThreadFound(nThreads);
+    if (nThreads == 1) {
+        decrypt(0, nTrials, vThreadFound[0]);
+    } else {
+        std::vector<std::thread> vThreads;
+        const size_t nChunk = (nTrials + nThreads - 1) / nThreads;
+        for (size_t n = 1; n * nChunk < nTrials; n++) {
+            vThreads.emplace_back(decrypt, n * nChunk, std::min((n + 1) * nChunk, nTrials), std::ref(vThreadFound[n]));
+        }
+        decrypt(0, nChunk, vThreadFound[0]);
+        for (std::thread& t : vThreads) t.join();
+    }
+
+    // chunks are in order, so the first match of an output is the one with the lowest key index
+    for (const auto& vFound : vThreadFound) {
+        for (const auto& found : vFound) {
+            if (!vResults[found.first]) {
+                vResults[found.first] = found.second;
+            }
+        }
+    }
+    return vResults;
+}
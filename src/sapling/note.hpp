@@ -9,6 +9,8 @@
 #include <array>
 #include <boost/optional.hpp>
 
+class OutputDescription;
+
 namespace libzcash {
 
 /**
@@ -203,6 +205,15 @@ public:
     ) const;
 };
 
+/**
+ * Trial decryption of a batch of Sapling outputs with a set of incoming viewing keys.
+ * The (output, ivk) pairs are split across the cores. Each output is matched with the
+ * first key of vIvk that decrypts it (as trying the keys in order would), returning
+ * the index of the key and the note plaintext.
+ */
+std::vector<boost::optional<std::pair<size_t, SaplingNotePlaintext>>> TrialDecryptSaplingOutputs(
+        const std::vector<const OutputDescription*>& vOutputs,
+        const std::vector<SaplingIncomingViewingKey>& vIvk);
 
 }
 
@@ -17,26 +17,46 @@ bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree
         return true;
     }
 
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending) {
+        CAnchorsSaplingMap::const_iterator it = pending->mapSaplingAnchors.find(rt);
+        if (it != pending->mapSaplingAnchors.end()) {
+            if (!it->second.entered)
+                return false;
+            tree = it->second.tree;
+            return true;
+        }
+    }
+
     bool read = db.Read(std::make_pair(DB_SAPLING_ANCHOR, rt), tree);
 
     return read;
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending) {
+        CNullifiersMap::const_iterator it = pending->mapSaplingNullifiers.find(nf);
+        if (it != pending->mapSaplingNullifiers.end())
+            return it->second.entered;
+    }
     bool spent = false;
     return db.Read(std::make_pair(DB_SAPLING_NULLIFIER, nf), spent);
 }
 
 uint256 CCoinsViewDB::GetBestAnchor() const {
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending && !pending->hashSaplingAnchor.IsNull())
+        return pending->hashSaplingAnchor;
     uint256 hashBestAnchor;
     if (!db.Read(DB_BEST_SAPLING_ANCHOR, hashBestAnchor))
         return SaplingMerkleTree::empty_root();
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, const char& dbChar)
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(std::make_pair(dbChar, it->first));
@@ -44,15 +64,13 @@ void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char&
                 batch.Write(std::make_pair(dbChar, it->first), true);
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, const char& dbChar)
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(std::make_pair(dbChar, it->first));
@@ -63,17 +81,15 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
             }
             // TODO: changed++?
         }
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
 bool CCoinsViewDB::BatchWriteSapling(const uint256& hashSaplingAnchor,
-                              CAnchorsSaplingMap& mapSaplingAnchors,
-                              CNullifiersMap& mapSaplingNullifiers,
+                              const CAnchorsSaplingMap& mapSaplingAnchors,
+                              const CNullifiersMap& mapSaplingNullifiers,
                               CDBBatch& batch) {
 
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
     ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
@@ -27,8 +27,8 @@ namespace SaplingValidation {
 *    nHeight can become valid at a later height), we make the bans conditional on not
 *    being in Initial Block Download mode.
 * 4. The isInitBlockDownload argument is a function parameter to assist with testing.
-*
-* todo: For now, this is NOT connected, only used in unit tests.
+* 5. ConnectBlock passes pvChecks, to verify the proofs of all the block transactions on the
+*    check queue threads.
 */
 bool ContextualCheckTransaction(
         const CTransaction& tx,
@@ -36,7 +36,8 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const bool isMined,
-        bool isInitBlockDownload)
+        bool isInitBlockDownload,
+        std::vector<CSaplingProofCheck>* pvChecks)
 {
     const int DOS_LEVEL_BLOCK = 100;
     // DoS level set to 10 to be more forgiving.
@@ -104,59 +105,72 @@ bool ContextualCheckTransaction(
                              REJECT_INVALID, "error-computing-signature-hash");
         }
 
-        // Sapling verification process
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.sapData->vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                    ctx,
-                    spend.cv.begin(),
-                    spend.anchor.begin(),
-                    spend.nullifier.begin(),
-                    spend.rk.begin(),
-                    spend.zkproof.begin(),
-                    spend.spendAuthSig.begin(),
-                    dataToBeSigned.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(
-                        dosLevelPotentiallyRelaxing,
-                        error("%s: Sapling spend description invalid", __func__ ),
-                        REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
+        CSaplingProofCheck check(tx, dataToBeSigned);
+        if (pvChecks) {
+            pvChecks->emplace_back();
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            // An invalid output description should be a non-contextual check, but we
+            // check it here as we need to pass over the outputs anyway in order to then
+            // call librustzcash_sapling_final_check().
+            const std::string& strReason = check.GetRejectReason();
+            return state.DoS(
+                    strReason == "bad-txns-sapling-output-description-invalid" ? 100 : dosLevelPotentiallyRelaxing,
+                    error("%s: %s", __func__, strReason),
+                    REJECT_INVALID, strReason);
         }
+    }
+    return true;
+}
 
-        for (const OutputDescription &output : tx.sapData->vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                    ctx,
-                    output.cv.begin(),
-                    output.cmu.begin(),
-                    output.ephemeralKey.begin(),
-                    output.zkproof.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                // This should be a non-contextual check, but we check it here
-                // as we need to pass over the outputs anyway in order to then
-                // call librustzcash_sapling_final_check().
-                return state.DoS(100, error("%s: Sapling output description invalid", __func__ ),
-                                 REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
+bool CSaplingProofCheck::operator()()
+{
+    const SaplingTxData& sapData = *ptx->sapData;
+    auto ctx = librustzcash_sapling_verification_ctx_init();
 
-        if (!librustzcash_sapling_final_check(
+    for (const SpendDescription &spend : sapData.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
                 ctx,
-                tx.sapData->valueBalance,
-                tx.sapData->bindingSig.begin(),
+                spend.cv.begin(),
+                spend.anchor.begin(),
+                spend.nullifier.begin(),
+                spend.rk.begin(),
+                spend.zkproof.begin(),
+                spend.spendAuthSig.begin(),
                 dataToBeSigned.begin())) {
             librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(
-                    dosLevelPotentiallyRelaxing,
-                    error("%s: Sapling binding signature invalid", __func__ ),
-                    REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+            strRejectReason = "bad-txns-sapling-spend-description-invalid";
+            return false;
         }
+    }
+
+    for (const OutputDescription &output : sapData.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+                ctx,
+                output.cv.begin(),
+                output.cmu.begin(),
+                output.ephemeralKey.begin(),
+                output.zkproof.begin())) {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strRejectReason = "bad-txns-sapling-output-description-invalid";
+            return false;
+        }
+    }
 
+    if (!librustzcash_sapling_final_check(
+            ctx,
+            sapData.valueBalance,
+            sapData.bindingSig.begin(),
+            dataToBeSigned.begin())) {
         librustzcash_sapling_verification_ctx_free(ctx);
+        strRejectReason = "bad-txns-sapling-binding-signature-invalid";
+        return false;
     }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
     return true;
 }
 
 
+
 } // End SaplingValidation namespace
\ No newline at end of file
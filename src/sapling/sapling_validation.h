@@ -7,16 +7,52 @@
 #define AllForOneBusiness_SAPLING_VALIDATION_H
 
 #include "chainparams.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
 
 class CTransaction;
 class CValidationState;
 
 namespace SaplingValidation {
 
-/** Check a transaction contextually against a set of consensus rules */
+/**
+ * Verification of the Sapling spend and output proofs, and of the binding signature, of a
+ * transaction. Can be deferred to the check queue, to verify the proofs of a block in parallel.
+ */
+class CSaplingProofCheck
+{
+private:
+    const CTransaction* ptx;
+    uint256 dataToBeSigned;
+    // reject reason of the failed check
+    std::string strRejectReason;
+
+public:
+    CSaplingProofCheck() : ptx(nullptr) {}
+    CSaplingProofCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn),
+        dataToBeSigned(dataToBeSignedIn) {}
+
+    bool operator()();
+
+    void swap(CSaplingProofCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        strRejectReason.swap(check.strRejectReason);
+    }
+
+    const std::string& GetRejectReason() const { return strRejectReason; }
+};
+
+/** Check a transaction contextually against a set of consensus rules.
+ *  If pvChecks is not null, the proofs verification is appended to it instead of being done here */
 bool ContextualCheckTransaction(const CTransaction &tx, CValidationState &state,
                                 const CChainParams &chainparams, int nHeight, bool isMined,
-                                bool sInitBlockDownload);
+                                bool sInitBlockDownload,
+                                std::vector<CSaplingProofCheck>* pvChecks = nullptr);
 
 }; // End SaplingValidation namespace
 
@@ -102,6 +102,32 @@ void SaplingScriptPubKeyMan::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
     }
 }
 
+void SaplingScriptPubKeyMan::AddToSaplingNoteTxes(const CWalletTx& wtx)
+{
+    LOCK(wallet->cs_wallet);
+    if (!wtx.mapSaplingNoteData.empty()) {
+        setSaplingNoteTxes.insert(wtx.GetHash());
+    }
+}
+
+std::vector<CWalletTx*> SaplingScriptPubKeyMan::GetSaplingNoteTxes()
+{
+    AssertLockHeld(wallet->cs_wallet);
+    std::vector<CWalletTx*> vNoteTxes;
+    vNoteTxes.reserve(setSaplingNoteTxes.size());
+    for (auto it = setSaplingNoteTxes.begin(); it != setSaplingNoteTxes.end();) {
+        auto mi = wallet->mapWallet.find(*it);
+        if (mi == wallet->mapWallet.end() || mi->second.mapSaplingNoteData.empty()) {
+            // erased from the wallet, or notes cleared
+            it = setSaplingNoteTxes.erase(it);
+            continue;
+        }
+        vNoteTxes.emplace_back(&mi->second);
+        ++it;
+    }
+    return vNoteTxes;
+}
+
 template<typename NoteDataMap>
 void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
 {
@@ -129,8 +155,14 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+/**
+ * Append the note commitments of the block to the witnesses being incremented.
+ * Notes created in the block (mapFirstCommitment) only get the commitments following their own.
+ */
+template<typename NoteDataMap, typename NoteData>
+void AppendNoteCommitments(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize,
+                           const std::vector<uint256>& vCommitments,
+                           const std::map<const NoteData*, size_t>& mapFirstCommitment)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
@@ -138,13 +170,17 @@ void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
             assert(nWitnessCacheSize >= (int64_t) nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+            auto it = mapFirstCommitment.find(nd);
+            size_t nFirst = (it != mapFirstCommitment.end() ? it->second : 0);
+            for (size_t i = nFirst; i < vCommitments.size(); i++) {
+                nd->witnesses.front().append(vCommitments[i]);
+            }
         }
     }
 }
 
 template<typename OutPoint, typename NoteData, typename Witness>
-void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
+bool WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
 {
     if (noteDataMap.count(key) && noteDataMap[key].witnessHeight < indexHeight) {
         auto* nd = &(noteDataMap[key]);
@@ -170,7 +206,9 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
         nd->witnessHeight = indexHeight - 1;
         // Check the validity of the cache
         assert(nWitnessCacheSize >= (int64_t) nd->witnesses.size());
+        return true;
     }
+    return false;
 }
 
 template<typename NoteDataMap>
@@ -193,8 +231,9 @@ void SaplingScriptPubKeyMan::IncrementNoteWitnesses(const CBlockIndex* pindex,
 {
     LOCK(wallet->cs_wallet);
     int chainHeight = pindex->nHeight;
-    for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-        ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, chainHeight, nWitnessCacheSize);
+    const std::vector<CWalletTx*>& vNoteTxes = GetSaplingNoteTxes();
+    for (CWalletTx* pwtx : vNoteTxes) {
+        ::CopyPreviousWitnesses(pwtx->mapSaplingNoteData, chainHeight, nWitnessCacheSize);
     }
 
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
@@ -209,34 +248,42 @@ void SaplingScriptPubKeyMan::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
+    // Append the block note commitments to the tree, witnessing our new notes on the way
+    std::vector<uint256> vCommitments;
+    std::map<const SaplingNoteData*, size_t> mapFirstCommitment;
     for (const auto& tx : pblock->vtx) {
         if (!tx->hasSaplingData()) continue;
 
         const uint256& hash = tx->GetHash();
-        bool txIsOurs = wallet->mapWallet.count(hash);
+        auto it = wallet->mapWallet.find(hash);
+        CWalletTx* pwtx = (it != wallet->mapWallet.end() ? &it->second : nullptr);
 
         // Sapling
         for (uint32_t i = 0; i < tx->sapData->vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx->sapData->vShieldedOutput[i].cmu;
             saplingTree.append(note_commitment);
-
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, chainHeight, nWitnessCacheSize, note_commitment);
-            }
+            vCommitments.emplace_back(note_commitment);
 
             // If this is our note, witness it
-            if (txIsOurs) {
+            if (pwtx) {
                 SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(wallet->mapWallet[hash].mapSaplingNoteData, chainHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+                if (::WitnessNoteIfMine(pwtx->mapSaplingNoteData, chainHeight, nWitnessCacheSize, outPoint, saplingTree.witness())) {
+                    mapFirstCommitment[&pwtx->mapSaplingNoteData.at(outPoint)] = vCommitments.size();
+                }
             }
         }
+    }
 
+    // Increment the witnesses of our notes (each one only once for the whole block)
+    if (!vCommitments.empty()) {
+        for (CWalletTx* pwtx : vNoteTxes) {
+            ::AppendNoteCommitments(pwtx->mapSaplingNoteData, chainHeight, nWitnessCacheSize, vCommitments, mapFirstCommitment);
+        }
     }
 
     // Update witness heights
-    for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, chainHeight, nWitnessCacheSize);
+    for (CWalletTx* pwtx : vNoteTxes) {
+        ::UpdateWitnessHeights(pwtx->mapSaplingNoteData, chainHeight, nWitnessCacheSize);
     }
 
     // For performance reasons, we write out the witness cache in
@@ -287,8 +334,8 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
 void SaplingScriptPubKeyMan::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(wallet->cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    for (CWalletTx* pwtx : GetSaplingNoteTxes()) {
+        ::DecrementNoteWitnesses(pwtx->mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
     }
     nWitnessCacheSize -= 1;
     nWitnessCacheNeedsUpdate = true;
@@ -316,39 +363,60 @@ std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> SaplingScriptPubKe
     if (!tx.isSapling() || !tx.hasSaplingData()) {
         return {};
     }
+    return FindMySaplingNotes(std::vector<const CTransaction*>{&tx})[0];
+}
 
-    LOCK(wallet->cs_KeyStore);
-    const uint256& hash = tx.GetHash();
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> SaplingScriptPubKeyMan::FindMySaplingNotes(const std::vector<const CTransaction*>& vtx) const
+{
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vRet(vtx.size());
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+    // Collect the outputs of the Sapling txes, with their (tx position, output index)
+    std::vector<const OutputDescription*> vOutputs;
+    std::vector<std::pair<size_t, uint32_t>> vOutputPos;
+    for (size_t n = 0; n < vtx.size(); n++) {
+        const CTransaction& tx = *vtx[n];
+        if (!tx.isSapling() || !tx.hasSaplingData()) {
+            continue;
+        }
+        for (uint32_t i = 0; i < tx.sapData->vShieldedOutput.size(); ++i) {
+            vOutputs.emplace_back(&tx.sapData->vShieldedOutput[i]);
+            vOutputPos.emplace_back(n, i);
+        }
+    }
+    if (vOutputs.empty()) {
+        return vRet;
+    }
+
+    LOCK(wallet->cs_KeyStore);
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvk;
+    vIvk.reserve(wallet->mapSaplingFullViewingKeys.size());
+    for (const auto& it : wallet->mapSaplingFullViewingKeys) {
+        vIvk.emplace_back(it.first);
+    }
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.sapData->vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.sapData->vShieldedOutput[i];
-        for (auto it = wallet->mapSaplingFullViewingKeys.begin(); it != wallet->mapSaplingFullViewingKeys.end(); ++it) {
-            libzcash::SaplingIncomingViewingKey ivk = it->first;
-            auto result = libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
-            if (!result) {
-                continue;
-            }
+    const auto& vResults = libzcash::TrialDecryptSaplingOutputs(vOutputs, vIvk);
+    for (size_t k = 0; k < vResults.size(); k++) {
+        if (!vResults[k]) {
+            continue;
+        }
+        const libzcash::SaplingIncomingViewingKey& ivk = vIvk[vResults[k]->first];
+        auto& ret = vRet[vOutputPos[k].first];
 
-            // Check if we already have it.
-            auto address = ivk.address(result.get().d);
-            if (address && wallet->mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                viewingKeysToAdd[address.get()] = ivk;
-            }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
+        // Check if we already have it.
+        auto address = ivk.address(vResults[k]->second.d);
+        if (address && wallet->mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
+            ret.second[address.get()] = ivk;
         }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {vtx[vOutputPos[k].first]->GetHash(), vOutputPos[k].second};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        ret.first.insert(std::make_pair(op, nd));
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    return vRet;
 }
 
 bool SaplingScriptPubKeyMan::IsSaplingNullifierFromMe(const uint256& nullifier) const
@@ -410,8 +478,8 @@ bool SaplingScriptPubKeyMan::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx&
 void SaplingScriptPubKeyMan::ClearNoteWitnessCache()
 {
     LOCK(wallet->cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+    for (CWalletTx* pwtx : GetSaplingNoteTxes()) {
+        for (mapSaplingNoteData_t::value_type& item : pwtx->mapSaplingNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
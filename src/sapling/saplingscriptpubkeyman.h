@@ -122,6 +122,12 @@ public:
      */
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
 
+    /**
+     * Keep track of the wallet transactions with Sapling notes, the only ones
+     * whose witnesses need to be updated when a block is (dis)connected.
+     */
+    void AddToSaplingNoteTxes(const CWalletTx& wtx);
+
     /**
      *  Update mapSaplingNullifiersToNotes, computing the nullifier
      *  from a cached witness if necessary.
@@ -202,6 +208,9 @@ public:
     //! Finds all output notes in the given tx that have been sent to a
     //! SaplingPaymentAddress in this wallet
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    //! Same for a batch of txes (e.g. the ones of a block), trial decrypting all
+    //! their outputs at once. Returns the results in the order of vtx.
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(const std::vector<const CTransaction*>& vtx) const;
 
     //! Whether the nullifier is from this wallet
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
@@ -293,6 +302,15 @@ private:
      */
     typedef std::multimap<uint256, uint256> TxNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
+
+    /**
+     * Hashes of the wallet transactions with Sapling notes (see AddToSaplingNoteTxes).
+     * Block connection and disconnection only walk these, instead of the full mapWallet.
+     */
+    std::set<uint256> setSaplingNoteTxes;
+
+    /** The wallet transactions in setSaplingNoteTxes (requires cs_wallet) */
+    std::vector<CWalletTx*> GetSaplingNoteTxes();
 };
 
 #endif //PIVX_SAPLINGSCRIPTPUBKEYMAN_H
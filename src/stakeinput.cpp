@@ -7,17 +7,42 @@
 
 #include "chain.h"
 #include "txdb.h"
+#include "validation.h"
 #include "zafo/deterministicmint.h"
 #include "wallet/wallet.h"
 
-CAfoStake* CAfoStake::NewAfoStake(const CTxIn& txin)
+CAfoStake* CAfoStake::NewAfoStake(const CTxIn& txin, const CBlockIndex* pindexPrev)
 {
     if (txin.IsZerocoinSpend()) {
         error("%s: unable to initialize CAfoStake from zerocoin spend", __func__);
         return nullptr;
     }
 
-    // Find the previous transaction in database
+    LOCK(cs_main);
+
+    // Common case: the input is unspent on the active chain, no need to read the previous tx from disk
+    Coin coin;
+    bool fHaveCoin = pcoinsTip->GetCoin(txin.prevout, coin) && !coin.IsSpent();
+
+    // Block on a fork: the input could have been spent on the active chain after the split,
+    // in which case the coin is in the undo data of the spending block.
+    const CBlockIndex* pindexFork = pindexPrev ? chainActive.FindFork(pindexPrev) : nullptr;
+    if (!fHaveCoin && pindexFork && pindexFork != chainActive.Tip() &&
+            chainActive.Height() - pindexFork->nHeight <= gArgs.GetArg("-maxreorg", DEFAULT_MAX_REORG_DEPTH)) {
+        // undo records of old versions may lack the height
+        fHaveCoin = GetCoinSpentAfterFork(txin.prevout, pindexFork, coin) && coin.nHeight > 0;
+    }
+
+    if (fHaveCoin) {
+        // The input must be in the chain of the block being staked
+        if (pindexFork && (int)coin.nHeight > pindexFork->nHeight) {
+            error("%s : stake input %s not in the chain of the block", __func__, txin.prevout.ToString());
+            return nullptr;
+        }
+        return new CAfoStake(coin.out, txin.prevout, chainActive[coin.nHeight]);
+    }
+
+    // Otherwise (e.g. kernel of an old block, whose input is spent) find the previous transaction in database
     uint256 hashBlock;
     CTransaction txPrev;
     if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true)) {
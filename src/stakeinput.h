@@ -43,7 +43,8 @@ public:
     CAfoStake(const CTxOut& _from, const COutPoint& _outPointFrom, const CBlockIndex* _pindexFrom) :
             CStakeInput(_pindexFrom), outputFrom(_from), outpointFrom(_outPointFrom) {}
 
-    static CAfoStake* NewAfoStake(const CTxIn& txin);
+    // Stake input of a coinstake in a block on top of pindexPrev (if known)
+    static CAfoStake* NewAfoStake(const CTxIn& txin, const CBlockIndex* pindexPrev = nullptr);
 
     bool InitFromTxIn(const CTxIn& txin) override { return pindexFrom; }
     const CBlockIndex* GetIndexFrom() const override;
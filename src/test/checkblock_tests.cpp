@@ -10,6 +10,7 @@
 
 #include "clientversion.h"
 #include "fs.h"
+#include "streams.h"
 #include "utiltime.h"
 #include "validation.h"
 
@@ -64,4 +65,40 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(header_hash_cache)
+{
+    // Quark (version < 4) and SHA256d headers
+    for (int32_t nVersion : {3, 8}) {
+        CBlock block;
+        block.nVersion = nVersion;
+        block.hashPrevBlock = InsecureRand256();
+        block.hashMerkleRoot = InsecureRand256();
+        block.nTime = 1600000000;
+        block.nBits = 0x1e0ffff0;
+        block.nNonce = 1;
+
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << block;
+        CBlock block2;
+        ss >> block2;
+        const uint256 hash = block.ComputeHash();
+        BOOST_CHECK(block2.GetHash() == hash);
+
+        // copies keep the memoized hash
+        CBlock block3(block2);
+        BOOST_CHECK(block3.GetHash() == hash);
+
+        // which is not used anymore once the header is modified
+        block2.nNonce++;
+        BOOST_CHECK(block2.GetHash() != hash);
+        BOOST_CHECK(block2.GetHash() == block2.ComputeHash());
+        block2.nNonce--;
+        BOOST_CHECK(block2.GetHash() == hash);
+        block3.hashFinalSaplingRoot = InsecureRand256();
+        BOOST_CHECK(block3.GetHash() == block3.ComputeHash());
+        block3.SetNull();
+        BOOST_CHECK(block3.GetHash() == block3.ComputeHash());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
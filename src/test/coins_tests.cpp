@@ -1320,4 +1320,58 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_take_changes)
+{
+    CCoinsViewTest base;
+    const COutPoint outBase(InsecureRand256(), 0), outSpent(InsecureRand256(), 0), outNew(InsecureRand256(), 0);
+    {
+        CCoinsViewCacheTest cache(&base);
+        Coin coin;
+        SetCoinsValue(VALUE1, coin);
+        cache.AddCoin(outBase, Coin(coin), false);
+        cache.AddCoin(outSpent, std::move(coin), false);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK(cache.HaveCoin(outBase));
+    cache.SpendCoin(outSpent);
+    Coin coin;
+    SetCoinsValue(VALUE2, coin);
+    cache.AddCoin(outNew, std::move(coin), false);
+    const uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+
+    // The modified coins are taken out, the cache keeps the unspent ones as clean entries
+    CCoinsCacheChanges changes;
+    cache.TakeChanges(changes);
+    cache.SelfTest();
+    BOOST_CHECK(changes.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(changes.mapCoins.size(), 2U);
+    BOOST_CHECK(changes.mapCoins.count(outNew) && changes.mapCoins.at(outNew).coin.out.nValue == VALUE2);
+    BOOST_CHECK(changes.mapCoins.count(outSpent) && changes.mapCoins.at(outSpent).coin.IsSpent());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+    BOOST_CHECK_EQUAL(cache.map().at(outNew).flags, 0);
+    BOOST_CHECK_EQUAL(cache.map().at(outBase).flags, 0);
+    BOOST_CHECK(!cache.HaveCoinInCache(outSpent));
+
+    // Both entries were used since the last pass: nothing is evicted
+    BOOST_CHECK_EQUAL(cache.EvictCold(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+
+    // Only the cold one goes
+    BOOST_CHECK(cache.HaveCoin(outNew));
+    BOOST_CHECK_EQUAL(cache.EvictCold(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(outNew));
+    BOOST_CHECK(!cache.HaveCoinInCache(outBase));
+
+    // The modified entries are kept, even if not used since the last pass
+    cache.SpendCoin(outNew);
+    BOOST_CHECK_EQUAL(cache.EvictCold(), 0U);
+    BOOST_CHECK_EQUAL(cache.EvictCold(), 0U);
+    BOOST_CHECK(cache.HaveCoinInCache(outNew));
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
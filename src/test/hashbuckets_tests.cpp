@@ -0,0 +1,58 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashbuckets.h"
+#include "streams.h"
+#include "test_allforonebusiness.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(hashbuckets_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(hashbuckets_differences)
+{
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 1000; i++) {
+        vHashes.emplace_back(InsecureRand256());
+    }
+    CHashBuckets buckets(vHashes);
+    BOOST_CHECK(buckets.IsValid());
+    BOOST_CHECK_EQUAL(buckets.size(), 1000 / HASH_BUCKET_ITEMS);
+
+    // same set, in a different order: no differences
+    std::vector<uint256> vOther(vHashes.rbegin(), vHashes.rend());
+    CHashBuckets other(vOther, buckets.size());
+    for (bool fDiff : other.GetDifferences(buckets)) {
+        BOOST_CHECK(!fDiff);
+    }
+
+    // a missing and an extra item: only their buckets differ
+    const uint256 missing = vOther.back();
+    vOther.pop_back();
+    const uint256 extra = InsecureRand256();
+    vOther.emplace_back(extra);
+    other = CHashBuckets(vOther, buckets.size());
+    const std::vector<bool>& vDiff = other.GetDifferences(buckets);
+    for (unsigned int i = 0; i < vDiff.size(); i++) {
+        BOOST_CHECK_EQUAL(vDiff[i], i == buckets.GetBucket(missing) || i == buckets.GetBucket(extra));
+    }
+
+    // different bucket counts: everything differs
+    for (bool fDiff : CHashBuckets(vHashes, buckets.size() + 1).GetDifferences(buckets)) {
+        BOOST_CHECK(fDiff);
+    }
+
+    // serialization roundtrip, and bounds
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << buckets;
+    CHashBuckets buckets2;
+    ss >> buckets2;
+    BOOST_CHECK(buckets2.vDigests == buckets.vDigests);
+    BOOST_CHECK(!CHashBuckets().IsValid());
+    BOOST_CHECK_EQUAL(CHashBuckets(std::vector<uint256>()).size(), 1);
+    BOOST_CHECK_EQUAL(CHashBuckets::GetBucketCount(100 * MAX_HASH_BUCKETS * HASH_BUCKET_ITEMS), MAX_HASH_BUCKETS);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
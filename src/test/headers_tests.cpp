@@ -0,0 +1,100 @@
+// Copyright (c) 2020 The AllForOneBusiness developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_allforonebusiness.h"
+
+#include "chain.h"
+#include "pow.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(headers_tests, TestingSetup)
+
+static CBlockHeader MakeHeader(const CBlockIndex* pindexPrev)
+{
+    CBlockHeader header;
+    header.nVersion = 7;
+    header.hashPrevBlock = pindexPrev->GetBlockHash();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = pindexPrev->nTime + 16;
+    header.nBits = pindexPrev->nBits;
+    return header;
+}
+
+static CBlockIndex* AcceptHeader(const CBlockHeader& header)
+{
+    CValidationState state;
+    CBlockIndex* pindex = nullptr;
+    BOOST_CHECK(AcceptBlockHeader(header, state, &pindex));
+    BOOST_CHECK(state.IsValid());
+    return pindex;
+}
+
+// block index entries are stored with the 'b' (DB_BLOCK_INDEX) prefix
+static bool IsIndexInDB(const uint256& hash)
+{
+    return pblocktree->Exists(std::make_pair('b', hash));
+}
+
+BOOST_AUTO_TEST_CASE(prune_header_only_blocks)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexGenesis = chainActive.Genesis();
+
+    // two header chains: A1 <- A2, and B1
+    CBlockIndex* pindexA1 = AcceptHeader(MakeHeader(pindexGenesis));
+    CBlockIndex* pindexA2 = AcceptHeader(MakeHeader(pindexA1));
+    const CBlockHeader headerB1 = MakeHeader(pindexGenesis);
+    CBlockIndex* pindexB1 = AcceptHeader(headerB1);
+    const uint256 hashA1 = pindexA1->GetBlockHash();
+    const uint256 hashA2 = pindexA2->GetBlockHash();
+    const uint256 hashB1 = pindexB1->GetBlockHash();
+    for (const CBlockIndex* pindex : {pindexA1, pindexA2, pindexB1}) {
+        BOOST_CHECK(!(pindex->nStatus & BLOCK_HAVE_DATA));
+    }
+    BOOST_CHECK(pindexBestHeader == pindexA2);
+    FlushStateToDisk();
+    BOOST_CHECK(IsIndexInDB(hashA1) && IsIndexInDB(hashA2) && IsIndexInDB(hashB1));
+
+    // keeping A2 keeps its ancestors
+    PruneHeaderOnlyBlocks({pindexA2});
+    BOOST_CHECK(mapBlockIndex.count(hashA1) && mapBlockIndex.count(hashA2));
+    BOOST_CHECK(!mapBlockIndex.count(hashB1));
+    BOOST_CHECK(pindexBestHeader == pindexA2);
+    // an entry pruned, then indexed again before the flush, stays in the database
+    PruneHeaderOnlyBlocks({});
+    BOOST_CHECK(!mapBlockIndex.count(hashA1) && !mapBlockIndex.count(hashA2));
+    BOOST_CHECK(pindexBestHeader == chainActive.Tip());
+    pindexB1 = AcceptHeader(headerB1);
+    BOOST_CHECK(pindexB1->GetBlockHash() == hashB1);
+    BOOST_CHECK(pindexBestHeader == pindexB1);
+    FlushStateToDisk();
+    BOOST_CHECK(!IsIndexInDB(hashA1) && !IsIndexInDB(hashA2));
+    BOOST_CHECK(IsIndexInDB(hashB1));
+
+    PruneHeaderOnlyBlocks({});
+    FlushStateToDisk();
+    BOOST_CHECK(!IsIndexInDB(hashB1));
+}
+
+BOOST_AUTO_TEST_CASE(checkwork_block_type)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+
+    // a proof of work block (no coinstake) with a difficulty close to, but not exactly, the required one
+    CBlock block(MakeHeader(pindexGenesis));
+    block.nBits = GetNextWorkRequired(pindexGenesis, &block) - 1;
+    BOOST_CHECK(block.IsProofOfWork());
+
+    // full blocks are checked by their own type, headers by the type given by the caller:
+    // only the proof of work blocks up to height 68589 get a tolerance
+    BOOST_CHECK(CheckWork(block, pindexGenesis));
+    BOOST_CHECK(CheckWork(block.GetBlockHeader(), pindexGenesis, true));
+    BOOST_CHECK(!CheckWork(block.GetBlockHeader(), pindexGenesis, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,7 @@
 #include "sapling/note.hpp"
 #include "sapling/noteencryption.hpp"
 #include "sapling/prf.h"
+#include "sapling/sapling_transaction.h"
 #include "sapling/uint252.h"
 #include "sapling/sapling_util.h"
 #include "crypto/sha256.h"
@@ -485,4 +486,46 @@ BOOST_AUTO_TEST_CASE(uint252_test)
     BOOST_CHECK_THROW(uint252(uint256S("f6da8716682d600f74fc16bd0187faad6a26b4aa4c24d5c055b216d94516847e")), std::domain_error);
 }
 
+BOOST_AUTO_TEST_CASE(trial_decrypt_sapling_outputs)
+{
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvk;
+    std::vector<libzcash::SaplingPaymentAddress> vAddr;
+    for (int i = 0; i < 5; i++) {
+        vIvk.emplace_back(libzcash::SaplingSpendingKey::random().full_viewing_key().in_viewing_key());
+        vAddr.emplace_back(*vIvk.back().address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}));
+    }
+    // the last address is not in vIvk
+    vIvk.pop_back();
+
+    // enough outputs to split the pairs across threads
+    std::vector<OutputDescription> vOutputs(40);
+    for (size_t i = 0; i < vOutputs.size(); i++) {
+        libzcash::SaplingNote note(vAddr[i % vAddr.size()], i);
+        auto res = libzcash::SaplingNotePlaintext(note, {}).encrypt(note.pk_d);
+        BOOST_CHECK(res);
+        vOutputs[i].cmu = *note.cmu();
+        vOutputs[i].ephemeralKey = res->second.get_epk();
+        vOutputs[i].encCiphertext = res->first;
+    }
+    // decryptable, but with a wrong commitment
+    vOutputs[0].cmu = vOutputs[1].cmu;
+
+    std::vector<const OutputDescription*> vOutputPtrs;
+    for (const OutputDescription& output : vOutputs) vOutputPtrs.emplace_back(&output);
+    const auto& vResults = libzcash::TrialDecryptSaplingOutputs(vOutputPtrs, vIvk);
+    BOOST_CHECK_EQUAL(vResults.size(), vOutputs.size());
+    for (size_t i = 0; i < vOutputs.size(); i++) {
+        const size_t nAddr = i % vAddr.size();
+        if (i == 0 || nAddr == vIvk.size()) {
+            BOOST_CHECK(!vResults[i]);
+        } else {
+            BOOST_CHECK(vResults[i] && vResults[i]->first == nAddr && vResults[i]->second.value() == i);
+        }
+    }
+
+    // no keys, no outputs
+    BOOST_CHECK(!libzcash::TrialDecryptSaplingOutputs(vOutputPtrs, {})[1]);
+    BOOST_CHECK(libzcash::TrialDecryptSaplingOutputs({}, vIvk).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
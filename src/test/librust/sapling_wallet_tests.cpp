@@ -857,6 +857,80 @@ BOOST_AUTO_TEST_CASE(CachedWitnessesCleanIndex) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(CachedWitnessesSeveralNotesInBlock) {
+    auto consensusParams = RegtestActivateSapling();
+
+    CWallet& wallet = *pwalletMain;
+    LOCK(wallet.cs_wallet);
+    setupWallet(wallet);
+
+    libzcash::SaplingExtendedSpendingKey sk = GetTestMasterSaplingSpendingKey();
+    BOOST_CHECK(wallet.AddSaplingZKey(sk));
+
+    // First block, with a note of the wallet
+    SaplingMerkleTree saplingTree;
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    std::vector<SaplingOutPoint> saplingNotes {CreateValidBlock(wallet, sk, index1, block1, saplingTree)};
+
+    // Second block: notes of the wallet mixed with a note of somebody else (not in the wallet)
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    std::vector<bool> vMine {true, false, true, true};
+    for (bool fMine : vMine) {
+        CWalletTx wtx = GetValidSaplingReceive(Params().GetConsensus(), wallet, sk, 10, true);
+        if (fMine) {
+            saplingNotes.emplace_back(SetSaplingNoteData(wtx)[0]);
+            wallet.LoadToWallet(wtx);
+        }
+        block2.vtx.emplace_back(MakeTransactionRef(wtx));
+    }
+
+    // The expected witnesses, appending the commitments one at a time
+    SaplingMerkleTree expectedTree {saplingTree};
+    std::vector<SaplingWitness> expectedWitnesses;
+    std::vector<Optional<SaplingWitness>> saplingWitnesses;
+    GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK((bool) saplingWitnesses[0]);
+    expectedWitnesses.emplace_back(*saplingWitnesses[0]);
+    for (size_t i = 0; i < block2.vtx.size(); i++) {
+        const uint256& cmu = block2.vtx[i]->sapData->vShieldedOutput[0].cmu;
+        expectedTree.append(cmu);
+        for (SaplingWitness& witness : expectedWitnesses) {
+            witness.append(cmu);
+        }
+        if (vMine[i]) {
+            expectedWitnesses.emplace_back(expectedTree.witness());
+        }
+    }
+
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, saplingTree);
+    BOOST_CHECK(saplingTree.root() == expectedTree.root());
+
+    uint256 anchor = GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK(anchor == expectedTree.root());
+    BOOST_CHECK_EQUAL(saplingWitnesses.size(), expectedWitnesses.size());
+    for (size_t i = 0; i < saplingWitnesses.size(); i++) {
+        BOOST_CHECK((bool) saplingWitnesses[i]);
+        BOOST_CHECK(*saplingWitnesses[i] == expectedWitnesses[i]);
+        BOOST_CHECK(saplingWitnesses[i]->root() == expectedTree.root());
+    }
+
+    // Disconnecting the block gives back the witness of the first note only
+    wallet.DecrementNoteWitnesses(&index2);
+    GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK((bool) saplingWitnesses[0]);
+    for (size_t i = 1; i < saplingWitnesses.size(); i++) {
+        BOOST_CHECK(!(bool) saplingWitnesses[i]);
+    }
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 BOOST_AUTO_TEST_CASE(ClearNoteWitnessCache) {
     auto consensusParams = RegtestActivateSapling();
 
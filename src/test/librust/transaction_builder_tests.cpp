@@ -49,6 +49,13 @@ BOOST_AUTO_TEST_CASE(TransparentToSapling)
     BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false));
     BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
 
+    // Deferred proofs verification, as done by ConnectBlock on the check queue
+    std::vector<SaplingValidation::CSaplingProofCheck> vChecks;
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(vChecks[0]());
+    BOOST_CHECK_EQUAL(vChecks[0].GetRejectReason(), "");
+
     // Revert to default
     RegtestDeactivateSapling();
 }
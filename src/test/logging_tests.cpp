@@ -0,0 +1,74 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logging.h"
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(logging_tests)
+
+BOOST_AUTO_TEST_CASE(message_ring_fifo)
+{
+    BCLog::MessageRing ring(4);
+    std::string msg;
+    BOOST_CHECK(!ring.TryPop(msg));
+
+    // fill it, over a few laps
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++) {
+            msg = strprintf("msg %d-%d\n", lap, i);
+            BOOST_CHECK(ring.TryPush(msg));
+        }
+        // full: the message is left to the caller
+        msg = "dropped\n";
+        BOOST_CHECK(!ring.TryPush(msg));
+        BOOST_CHECK_EQUAL(msg, "dropped\n");
+
+        for (int i = 0; i < 4; i++) {
+            BOOST_CHECK(ring.TryPop(msg));
+            BOOST_CHECK_EQUAL(msg, strprintf("msg %d-%d\n", lap, i));
+        }
+        BOOST_CHECK(!ring.TryPop(msg));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(message_ring_producers)
+{
+    static const int PRODUCERS = 4;
+    static const int MESSAGES = 10000;
+    BCLog::MessageRing ring(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&ring, p] {
+            for (int i = 0; i < MESSAGES; i++) {
+                std::string msg = strprintf("%d %d", p, i);
+                while (!ring.TryPush(msg)) std::this_thread::yield();
+            }
+        });
+    }
+
+    // every message is received once, in order for each producer
+    std::vector<int> vNext(PRODUCERS, 0);
+    int nReceived = 0;
+    std::string msg;
+    while (nReceived < PRODUCERS * MESSAGES) {
+        if (!ring.TryPop(msg)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p, i;
+        BOOST_REQUIRE(sscanf(msg.c_str(), "%d %d", &p, &i) == 2);
+        BOOST_REQUIRE(p >= 0 && p < PRODUCERS);
+        BOOST_CHECK_EQUAL(i, vNext[p]);
+        vNext[p] = i + 1;
+        nReceived++;
+    }
+    for (std::thread& t : producers) t.join();
+    BOOST_CHECK(!ring.TryPop(msg));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "masternodeman.h"
+#include "streams.h"
+#include "test_allforonebusiness.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, TestingSetup)
+
+static CMasternode GetRandomMasternode()
+{
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(InsecureRand256(), 0));
+    CKey key;
+    key.MakeNewKey(true);
+    mn.pubKeyCollateralAddress = key.GetPubKey();
+    key.MakeNewKey(true);
+    mn.pubKeyMasternode = key.GetPubKey();
+    mn.activeState = CMasternode::MASTERNODE_ENABLED;
+    mn.unitTest = true;
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_find)
+{
+    CMasternodeMan man;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 10; i++) {
+        vMasternodes.push_back(GetRandomMasternode());
+        BOOST_CHECK(man.Add(vMasternodes.back()));
+    }
+    BOOST_CHECK(!man.Add(vMasternodes[0]));
+    BOOST_CHECK_EQUAL(man.size(), 10);
+
+    // pointers stay valid while the list grows
+    CMasternode* pmn = man.Find(vMasternodes[3].vin);
+    BOOST_CHECK(pmn != nullptr);
+    for (int i = 0; i < 100; i++) {
+        CMasternode mn = GetRandomMasternode();
+        man.Add(mn);
+    }
+    BOOST_CHECK(man.Find(vMasternodes[3].vin) == pmn);
+
+    for (const CMasternode& mn : vMasternodes) {
+        CMasternode* p = man.Find(mn.vin);
+        BOOST_CHECK(p != nullptr && p->vin == mn.vin);
+        BOOST_CHECK(man.Find(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID())) == p);
+        BOOST_CHECK(man.Find(mn.pubKeyMasternode) == p);
+    }
+
+    // removed entries are not found anymore
+    man.Remove(vMasternodes[5].vin);
+    BOOST_CHECK(man.Find(vMasternodes[5].vin) == nullptr);
+    BOOST_CHECK(man.Find(GetScriptForDestination(vMasternodes[5].pubKeyCollateralAddress.GetID())) == nullptr);
+    BOOST_CHECK(man.Find(vMasternodes[5].pubKeyMasternode) == nullptr);
+    BOOST_CHECK_EQUAL(man.size(), 109);
+
+    // indexes are rebuilt on deserialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << man;
+    CMasternodeMan man2;
+    ss >> man2;
+    BOOST_CHECK_EQUAL(man2.size(), 109);
+    CMasternode* p2 = man2.Find(vMasternodes[3].pubKeyMasternode);
+    BOOST_CHECK(p2 != nullptr && p2->vin == vMasternodes[3].vin);
+    BOOST_CHECK(man2.Find(vMasternodes[5].vin) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_rank)
+{
+    CMasternodeMan man;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 50; i++) {
+        vMasternodes.push_back(GetRandomMasternode());
+        vMasternodes.back().sigTime = 0;
+        man.Add(vMasternodes.back());
+    }
+
+    // fake chain tip
+    uint256 blockHash = InsecureRand256();
+    CBlockIndex index;
+    index.nHeight = 1000;
+    index.phashBlock = &blockHash;
+    man.SetBestHeight(index.nHeight);
+    man.CacheBlockHash(&index);
+
+    // expected ranks, sorting by score
+    std::vector<std::pair<uint256, COutPoint>> vScores;
+    for (const CMasternode& mn : vMasternodes) {
+        vScores.emplace_back(mn.CalculateScore(blockHash), mn.vin.prevout);
+    }
+    std::sort(vScores.rbegin(), vScores.rend());
+
+    for (int i = 0; i < (int) vScores.size(); i++) {
+        BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(vScores[i].second), index.nHeight + 1, 0, false), i + 1);
+    }
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(COutPoint(InsecureRand256(), 0)), index.nHeight + 1, 0, false), -1);
+
+    // cached scores are updated when the list changes
+    man.Remove(CTxIn(vScores[0].second));
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(vScores[0].second), index.nHeight + 1, 0, false), -1);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(vScores[1].second), index.nHeight + 1, 0, false), 1);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRanks(index.nHeight + 1).size(), vScores.size() - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -315,6 +315,141 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     CheckSort<mining_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).FromTx(tx2));
+    uint64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).FromTx(tx3));
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.push_back(tx2.GetHash().ToString()); // 20000
+    sortedOrder.push_back(tx1.GetHash().ToString()); // 10000
+    sortedOrder.push_back(tx3.GetHash().ToString()); // 0
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = ::GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(0LL).SigOps(2).FromTx(tx6));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    // tx6 is sorted low, with the same ancestor feerate of tx3: ties are resolved by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1, tx6.GetHash().ToString());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = ::GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).SigOps(3).FromTx(tx7));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // the ancestor state of tx7 includes tx6
+    CTxMemPool::txiter it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx6Size + tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+    BOOST_CHECK_EQUAL(it7->GetSigOpCountWithAncestors(), 5);
+
+    // tx7 is sorted right after tx2 (and its parent stays low)
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    // prioritising the parent updates the ancestor fees of the child:
+    // now tx7 has a higher ancestor feerate than tx2
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0, 10 * COIN);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee + 10 * COIN);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx6.GetHash())->GetModFeesWithAncestors(), 10 * COIN);
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx6.GetHash());
+
+    // removing the parent for a block (not recursively) updates the ancestor state of the child
+    std::list<CTransactionRef> removed;
+    pool.remove(tx6, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+    BOOST_CHECK_EQUAL(it7->GetSigOpCountWithAncestors(), 3);
+    pool.ClearPrioritisation(tx6.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFreeHeightTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // free at entry
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Priority(AllowFreeThreshold() + 1).Height(100).HadNoDependencies(true).FromTx(tx1));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetFreeHeight(), 0U);
+
+    // free once its in-chain inputs have aged enough
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    tx2.vout[0].nValue = 1 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Priority(0).FromTx(tx2));
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    const unsigned int nFreeHeight = it2->GetFreeHeight();
+    BOOST_CHECK(nFreeHeight > 100);
+    BOOST_CHECK(!AllowFree(it2->GetModifiedPriority(nFreeHeight - 1)));
+    BOOST_CHECK(AllowFree(it2->GetModifiedPriority(nFreeHeight + 1)));
+
+    // without in-chain inputs the priority doesn't age
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_13 << OP_EQUAL;
+    tx3.vout[0].nValue = 1 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.HadNoDependencies(false).FromTx(tx3));
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetFreeHeight(), std::numeric_limits<unsigned int>::max());
+    BOOST_CHECK(pool.mapTx.get<free_height>().rbegin()->GetTx().GetHash() == tx3.GetHash());
+
+    // unless it's prioritised
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), AllowFreeThreshold() + 1, 0);
+    BOOST_CHECK_EQUAL(it3->GetFreeHeight(), 0U);
+    BOOST_CHECK(AllowFree(it3->GetModifiedPriority(100)));
+    BOOST_CHECK(pool.mapTx.get<free_height>().rbegin()->GetTx().GetHash() == tx2.GetHash());
+    pool.ClearPrioritisation(tx3.GetHash());
+}
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -0,0 +1,72 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "messagesigner.h"
+#include "test_allforonebusiness.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(messagesigner_tests, BasicTestingSetup)
+
+static CHashSigCheck GetSignedHash()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CHashSigCheck check;
+    check.hash = InsecureRand256();
+    check.keyID = key.GetPubKey().GetID();
+    BOOST_CHECK(CHashSigner::SignHash(check.hash, key, check.vchSig));
+    return check;
+}
+
+static void CheckVerifyHashes()
+{
+    std::vector<CHashSigCheck> vChecks;
+    for (int i = 0; i < 200; i++) {
+        vChecks.emplace_back(GetSignedHash());
+    }
+    // duplicates are counted once per entry
+    vChecks.emplace_back(vChecks[0]);
+    vChecks.emplace_back(vChecks[1]);
+    BOOST_CHECK_EQUAL(CHashSigner::VerifyHashes(vChecks), vChecks.size());
+    // all cached now
+    BOOST_CHECK_EQUAL(CHashSigner::VerifyHashes(vChecks), vChecks.size());
+
+    // signature of another hash, and by another key (an invalid duplicate is counted as invalid)
+    vChecks[10].hash = InsecureRand256();
+    vChecks[20].keyID = vChecks[21].keyID;
+    vChecks.emplace_back(vChecks[10]);
+    BOOST_CHECK_EQUAL(CHashSigner::VerifyHashes(vChecks), vChecks.size() - 3);
+
+    std::string strError;
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        const bool fValid = i != 10 && i != 20 && i != vChecks.size() - 1;
+        BOOST_CHECK_EQUAL(CHashSigner::VerifyHash(vChecks[i].hash, vChecks[i].keyID, vChecks[i].vchSig, strError), fValid);
+    }
+
+    // invalid signatures are not cached
+    std::vector<unsigned char> vchSig = vChecks[30].vchSig;
+    vchSig[10] ^= 0x01;
+    BOOST_CHECK(!CHashSigner::VerifyHash(vChecks[30].hash, vChecks[30].keyID, vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(vChecks[30].hash, vChecks[30].keyID, vchSig, strError));
+    BOOST_CHECK_EQUAL(CHashSigner::VerifyHashes(std::vector<CHashSigCheck>()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(verify_hashes_batch)
+{
+    // verified by the caller
+    CheckVerifyHashes();
+
+    // verified by the worker threads
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(&ThreadHashSigCheck);
+    CheckVerifyHashes();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
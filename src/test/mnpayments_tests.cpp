@@ -0,0 +1,78 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "masternode-payments.h"
+#include "test_allforonebusiness.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mnpayments_tests, TestingSetup)
+
+static CScript GetRandomPayee()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return GetScriptForDestination(key.GetPubKey().GetID());
+}
+
+static void AddVote(CMasternodePayments& payments, const CScript& payee, int nBlockHeight)
+{
+    CMasternodePaymentWinner winner(CTxIn(COutPoint(InsecureRand256(), 0)));
+    winner.nBlockHeight = nBlockHeight;
+    winner.AddPayee(payee);
+    BOOST_CHECK(payments.AddWinningMasternode(winner));
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_index)
+{
+    // fake chain: block at height h has time 1000 + h * 60
+    std::vector<CBlockIndex> vChain(20);
+    for (int i = 0; i < (int) vChain.size(); i++) {
+        vChain[i].nHeight = i;
+        vChain[i].nTime = 1000 + i * 60;
+        vChain[i].pprev = i > 0 ? &vChain[i - 1] : nullptr;
+    }
+
+    CMasternodePayments payments;
+    payments.LoadLastPaidIndex(&vChain[10]);
+
+    const CScript payeeA = GetRandomPayee();
+    const CScript payeeB = GetRandomPayee();
+    int64_t nTime = 0;
+
+    // payee with 2 votes on a connected block is paid
+    AddVote(payments, payeeA, 5);
+    BOOST_CHECK(!payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    AddVote(payments, payeeA, 5);
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    BOOST_CHECK_EQUAL(nTime, vChain[5].GetBlockTime());
+    BOOST_CHECK(!payments.GetLastPaidBlockTime(payeeB, 100, nTime));
+
+    // votes for future blocks count only once the block is connected
+    AddVote(payments, payeeA, 12);
+    AddVote(payments, payeeA, 12);
+    payments.BlockConnected(&vChain[11]);
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    BOOST_CHECK_EQUAL(nTime, vChain[5].GetBlockTime());
+    payments.BlockConnected(&vChain[12]);
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    BOOST_CHECK_EQUAL(nTime, vChain[12].GetBlockTime());
+
+    // disconnecting the block goes back to the previous payment
+    payments.BlockDisconnected(&vChain[12]);
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    BOOST_CHECK_EQUAL(nTime, vChain[5].GetBlockTime());
+
+    // payments older than the max depth are ignored
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 7, nTime));
+    BOOST_CHECK(!payments.GetLastPaidBlockTime(payeeA, 6, nTime));
+
+    // the index can be rebuilt from the stored votes
+    payments.LoadLastPaidIndex(&vChain[12]);
+    BOOST_CHECK(payments.GetLastPaidBlockTime(payeeA, 100, nTime));
+    BOOST_CHECK_EQUAL(nTime, vChain[12].GetBlockTime());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
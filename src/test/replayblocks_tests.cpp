@@ -0,0 +1,129 @@
+// Copyright (c) 2020 The AllForOneBusiness developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_allforonebusiness.h"
+
+#include "chain.h"
+#include "consensus/merkle.h"
+#include "txdb.h"
+#include "undo.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock);
+
+namespace
+{
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    // What the first batch of an interrupted write, from hashOld to hashNew, leaves behind:
+    // the best block ('B') replaced by the head blocks ('H')
+    void WriteHeadBlocks(const uint256& hashNew, const uint256& hashOld)
+    {
+        CDBBatch batch;
+        batch.Erase('B');
+        batch.Write('H', std::vector<uint256>{hashNew, hashOld});
+        BOOST_CHECK(db.WriteBatch(batch));
+    }
+};
+
+CBlock MakeBlock(const CBlockIndex* pindexPrev, int nBranch)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << (pindexPrev->nHeight + 1) << nBranch;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 1 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CBlock block;
+    block.nVersion = 7;
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = pindexPrev->nTime + 16;
+    block.nBits = pindexPrev->nBits;
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+// Index the block, and write it (and its undo data, if requested) to its own block file
+CBlockIndex* StoreBlock(const CBlock& block, int nFile, bool fUndo)
+{
+    CValidationState state;
+    CBlockIndex* pindex = nullptr;
+    BOOST_CHECK(AcceptBlockHeader(block, state, &pindex));
+    CDiskBlockPos pos(nFile, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    pindex->nFile = nFile;
+    pindex->nDataPos = pos.nPos;
+    pindex->nStatus |= BLOCK_HAVE_DATA;
+    if (fUndo) {
+        CDiskBlockPos posUndo(nFile, 0);
+        BOOST_CHECK(UndoWriteToDisk(CBlockUndo(), posUndo, pindex->pprev->GetBlockHash()));
+        pindex->nUndoPos = posUndo.nPos;
+        pindex->nStatus |= BLOCK_HAVE_UNDO;
+    }
+    return pindex;
+}
+
+void WriteCoins(CCoinsViewDB& view, const CBlock& block, int nHeight, const uint256& hashBlock)
+{
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry entry(Coin(block.vtx[0]->vout[0], nHeight, true, false));
+    entry.flags = CCoinsCacheEntry::DIRTY;
+    mapCoins.emplace(COutPoint(block.vtx[0]->GetHash(), 0), std::move(entry));
+    CAnchorsSaplingMap mapSaplingAnchors;
+    CNullifiersMap mapSaplingNullifiers;
+    BOOST_CHECK(view.BatchWrite(mapCoins, hashBlock, UINT256_ZERO, mapSaplingAnchors, mapSaplingNullifiers));
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(replayblocks_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(replay_partial_flush)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexGenesis = chainActive.Genesis();
+
+    // the old tip A1, and the new one B2, on another branch: B1 <- B2
+    const CBlock blockA1 = MakeBlock(pindexGenesis, 1);
+    const CBlockIndex* pindexA1 = StoreBlock(blockA1, 1, true);
+    const CBlock blockB1 = MakeBlock(pindexGenesis, 2);
+    const CBlockIndex* pindexB1 = StoreBlock(blockB1, 2, false);
+    const CBlock blockB2 = MakeBlock(pindexB1, 2);
+    const CBlockIndex* pindexB2 = StoreBlock(blockB2, 3, false);
+    const COutPoint outA1(blockA1.vtx[0]->GetHash(), 0);
+    const COutPoint outB1(blockB1.vtx[0]->GetHash(), 0);
+    const COutPoint outB2(blockB2.vtx[0]->GetHash(), 0);
+
+    // a consistent database is left as is
+    CCoinsViewDBTest view;
+    WriteCoins(view, blockA1, 1, pindexA1->GetBlockHash());
+    BOOST_CHECK(view.GetHeadBlocks().empty());
+    BOOST_CHECK(ReplayBlocks(&view));
+    BOOST_CHECK(view.GetBestBlock() == pindexA1->GetBlockHash());
+    BOOST_CHECK(view.HaveCoin(outA1));
+
+    // the write of the move to B2 was interrupted after its first batch, holding the coin of B1 only
+    view.WriteHeadBlocks(pindexB2->GetBlockHash(), pindexA1->GetBlockHash());
+    WriteCoins(view, blockB1, 1, UINT256_ZERO);
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+    BOOST_CHECK_EQUAL(view.GetHeadBlocks().size(), 2U);
+
+    // A1 is rolled back, B1 and B2 rolled forward
+    BOOST_CHECK(ReplayBlocks(&view));
+    BOOST_CHECK(view.GetHeadBlocks().empty());
+    BOOST_CHECK(view.GetBestBlock() == pindexB2->GetBlockHash());
+    BOOST_CHECK(!view.HaveCoin(outA1));
+    Coin coin;
+    BOOST_CHECK(view.GetCoin(outB1, coin) && coin.nHeight == 1 && coin.fCoinBase);
+    BOOST_CHECK(view.GetCoin(outB2, coin) && coin.nHeight == 2 && coin.fCoinBase);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
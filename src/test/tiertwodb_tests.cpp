@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_allforonebusiness.h"
+#include "tiertwodb.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(tiertwodb_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(tiertwodb_incremental_write)
+{
+    CTierTwoDB db("tiertwo_test", 1 << 20, true);
+    LOCK(db.cs_db);
+
+    std::map<uint256, int64_t> mapEntries;
+    for (int i = 0; i < 100; i++) {
+        mapEntries.emplace(InsecureRand256(), i);
+    }
+    for (const auto& it : mapEntries) db.StageEntry('x', it.first, it.second);
+    db.StageEntry('y', UINT256_ZERO, std::string("single"));
+    BOOST_CHECK(db.CommitEntries());
+
+    // change one entry, remove another one
+    auto itChanged = mapEntries.begin();
+    itChanged->second = 1000;
+    const uint256 removed = std::next(itChanged)->first;
+    mapEntries.erase(removed);
+    for (const auto& it : mapEntries) db.StageEntry('x', it.first, it.second);
+    db.StageEntry('y', UINT256_ZERO, std::string("single"));
+    BOOST_CHECK(db.CommitEntries());
+    BOOST_CHECK(!db.Exists(std::make_pair('x', removed)));
+
+    std::vector<std::pair<uint256, int64_t>> vEntries;
+    db.ReadEntries('x', vEntries);
+    const std::map<uint256, int64_t> mapRead(vEntries.begin(), vEntries.end());
+    BOOST_CHECK(mapRead == mapEntries);
+    std::string str;
+    db.ReadEntry('y', str);
+    BOOST_CHECK_EQUAL(str, "single");
+
+    // entries not staged are erased
+    BOOST_CHECK(db.CommitEntries());
+    vEntries.clear();
+    db.ReadEntries('x', vEntries);
+    BOOST_CHECK(vEntries.empty());
+    BOOST_CHECK(!db.Exists(std::make_pair('y', UINT256_ZERO)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -285,4 +285,42 @@ BOOST_AUTO_TEST_CASE(zerocoin_public_spend_test)
 
 }
 
+BOOST_AUTO_TEST_CASE(zerocoin_spends_db_upgrade_test)
+{
+    CZerocoinDB db(1 << 20, true);
+    int nVersion = 0;
+    BOOST_CHECK(!db.ReadCoinSpendsVersion(nVersion));
+
+    // spends recorded by older versions: [serial hash, txid]
+    const uint256 hashSerial1 = InsecureRand256(), txid1 = InsecureRand256();
+    const uint256 hashSerial2 = InsecureRand256(), txid2 = InsecureRand256();
+    BOOST_CHECK(db.Write(std::make_pair('s', hashSerial1), txid1));
+    BOOST_CHECK(db.Write(std::make_pair('s', hashSerial2), txid2));
+
+    std::vector<std::pair<uint256, uint256> > vLegacySpends;
+    BOOST_CHECK(db.ReadLegacyCoinSpends(vLegacySpends));
+    BOOST_CHECK_EQUAL(vLegacySpends.size(), 2U);
+
+    // the first spend is found in a block, the second one isn't
+    const uint256 hashBlock = InsecureRand256();
+    std::vector<std::pair<uint256, CZerocoinSpendPos> > vPositions;
+    vPositions.emplace_back(hashSerial1, CZerocoinSpendPos(txid1, hashBlock, 1234));
+    BOOST_CHECK(db.UpgradeCoinSpends(vPositions, std::vector<uint256>(1, hashSerial2)));
+
+    BOOST_CHECK(db.ReadCoinSpendsVersion(nVersion));
+    BOOST_CHECK_EQUAL(nVersion, ZC_SPENDS_DB_VERSION);
+    CZerocoinSpendPos spendPos;
+    BOOST_CHECK(db.ReadCoinSpend(hashSerial1, spendPos));
+    BOOST_CHECK(spendPos.txid == txid1);
+    BOOST_CHECK(spendPos.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(spendPos.nHeight, 1234);
+    uint256 txid;
+    BOOST_CHECK(db.ReadCoinSpend(hashSerial1, txid));
+    BOOST_CHECK(txid == txid1);
+    BOOST_CHECK(!db.ReadCoinSpend(hashSerial2, spendPos));
+
+    BOOST_CHECK(db.WipeCoins("spends"));
+    BOOST_CHECK(!db.ReadCoinSpend(hashSerial1, spendPos));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
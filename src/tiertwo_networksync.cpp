@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php.
 
 #include "masternode-sync.h"
+#include "masternode-budget.h"  // for budget
 
 #include "spork.h"  // for sporkManager
 #include "masternodeman.h" // for mnodeman
@@ -142,12 +143,12 @@ void CMasternodeSync::SyncRegtest(CNode* pnode)
     if (RequestedMasternodeAssets == MASTERNODE_SYNC_SPORKS) {
         RequestDataTo(pnode, NetMsgType::GETSPORKS, false);
     } else if (RequestedMasternodeAssets == MASTERNODE_SYNC_LIST) {
-        RequestDataTo(pnode, NetMsgType::GETMNLIST, false, CTxIn());
+        RequestDataTo(pnode, NetMsgType::GETMNLIST, false, CTxIn(), mnodeman.GetSyncBuckets());
     } else if (RequestedMasternodeAssets == MASTERNODE_SYNC_MNW) {
         RequestDataTo(pnode, NetMsgType::GETMNWINNERS, false, mnodeman.CountEnabled());
     } else if (RequestedMasternodeAssets == MASTERNODE_SYNC_BUDGET) {
         // sync masternode votes
-        RequestDataTo(pnode, NetMsgType::BUDGETVOTESYNC, false, uint256());
+        RequestDataTo(pnode, NetMsgType::BUDGETVOTESYNC, false, uint256(), budget.GetSyncBuckets());
     } else if (RequestedMasternodeAssets == MASTERNODE_SYNC_FINISHED) {
         LogPrintf("REGTEST SYNC FINISHED!\n");
     }
@@ -0,0 +1,38 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "tiertwodb.h"
+
+CTierTwoDB::CTierTwoDB(const std::string& strNameIn, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / strNameIn, nCacheSize, fMemory, fWipe),
+    strName(strNameIn),
+    nChanged(0)
+{}
+
+bool CTierTwoDB::CommitEntries()
+{
+    AssertLockHeld(cs_db);
+    int64_t nStart = GetTimeMillis();
+    unsigned int nErased = 0;
+    for (auto it = mapEntryHashes.begin(); it != mapEntryHashes.end(); ) {
+        if (setStaged.count(it->first)) {
+            ++it;
+            continue;
+        }
+        batch.Erase(it->first);
+        it = mapEntryHashes.erase(it);
+        nErased++;
+    }
+    setStaged.clear();
+
+    bool ret = true;
+    if (nChanged > 0 || nErased > 0) {
+        ret = WriteBatch(batch, true);
+    }
+    LogPrint(BCLog::MASTERNODE, "%s : %s - %d entries written, %d erased, %d total  %dms\n",
+            __func__, strName, nChanged, nErased, mapEntryHashes.size(), GetTimeMillis() - nStart);
+    batch.Clear();
+    nChanged = 0;
+    return ret;
+}
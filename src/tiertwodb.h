@@ -0,0 +1,145 @@
+// Copyright (c) 2020 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef AllForOneBusiness_TIERTWODB_H
+#define AllForOneBusiness_TIERTWODB_H
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "dbwrapper.h"
+#include "fs.h"
+#include "hash.h"
+#include "streams.h"
+#include "sync.h"
+#include "util.h"
+
+#include <map>
+#include <set>
+
+/** Cache size of each tier two database */
+static const size_t TIERTWO_DB_CACHE_SIZE = 1 << 20;
+
+/**
+ * LevelDB store of the state of a tier two manager (masternode list, payment
+ * votes, budgets), with one key per entry: (entry type prefix, entry id).
+ * The hash of each stored entry is kept in memory, so that a flush writes only
+ * the entries that changed since the previous one (and erases the removed ones),
+ * in a single batch.
+ */
+class CTierTwoDB : public CDBWrapper
+{
+private:
+    std::string strName;
+    // hash of the serialization of each entry in the database
+    std::map<std::pair<char, uint256>, uint256> mapEntryHashes;
+    // entries staged since the last commit, and the changes to write
+    std::set<std::pair<char, uint256>> setStaged;
+    CDBBatch batch;
+    unsigned int nChanged;
+
+    template <typename T>
+    static uint256 GetEntryHash(const T& entry)
+    {
+        CHashWriter ss(SER_DISK, CLIENT_VERSION);
+        ss << entry;
+        return ss.GetHash();
+    }
+
+public:
+    // held by the managers for the whole flush (or load) of their entries
+    RecursiveMutex cs_db;
+
+    CTierTwoDB(const std::string& strNameIn, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    // Stage an entry of the manager: it's written on commit only if new or changed
+    template <typename T>
+    void StageEntry(char chPrefix, const uint256& id, const T& entry)
+    {
+        AssertLockHeld(cs_db);
+        const std::pair<char, uint256> key(chPrefix, id);
+        const uint256& hash = GetEntryHash(entry);
+        setStaged.insert(key);
+        auto it = mapEntryHashes.find(key);
+        if (it != mapEntryHashes.end() && it->second == hash) return;
+        mapEntryHashes[key] = hash;
+        batch.Write(key, entry);
+        nChanged++;
+    }
+
+    // Erase the entries not staged since the previous commit, and write the changes
+    bool CommitEntries();
+
+    // Read all the entries with the given prefix, with their id.
+    // Unreadable entries (e.g. of an older format) are erased on the next commit.
+    template <typename T>
+    void ReadEntries(char chPrefix, std::vector<std::pair<uint256, T>>& vEntries)
+    {
+        AssertLockHeld(cs_db);
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(std::make_pair(chPrefix, UINT256_ZERO));
+        for (; pcursor->Valid(); pcursor->Next()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != chPrefix) break;
+            T entry;
+            if (!pcursor->GetValue(entry)) {
+                LogPrintf("%s : %s - unable to read entry %s\n", __func__, strName, key.second.ToString());
+                mapEntryHashes.emplace(key, UINT256_ZERO);
+                continue;
+            }
+            mapEntryHashes[key] = GetEntryHash(entry);
+            vEntries.emplace_back(key.second, std::move(entry));
+        }
+    }
+
+    // Read the single entry with the given prefix (id zero), if any
+    template <typename T>
+    void ReadEntry(char chPrefix, T& entry)
+    {
+        std::vector<std::pair<uint256, T>> vEntries;
+        ReadEntries(chPrefix, vEntries);
+        if (!vEntries.empty()) entry = vEntries.front().second;
+    }
+
+    // Import the flat file cache of older versions (magic message, network magic,
+    // object, checksum) into obj, and remove it. Returns false if there is none,
+    // or if the database already holds entries (read into obj before this call).
+    template <typename T>
+    bool ImportFlatFile(const std::string& strFile, const std::string& strMagicMessage, T& obj)
+    {
+        const fs::path path = GetDataDir() / strFile;
+        if (!fs::exists(path)) return false;
+        if (WITH_LOCK(cs_db, return !mapEntryHashes.empty(); )) {
+            LogPrintf("%s : %s not empty, ignoring %s\n", __func__, strName, strFile);
+            fs::remove(path);
+            return false;
+        }
+        try {
+            CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+            const int dataSize = std::max<int>(0, fs::file_size(path) - sizeof(uint256));
+            std::vector<unsigned char> vchData(dataSize);
+            uint256 hashIn;
+            filein.read((char*)vchData.data(), dataSize);
+            filein >> hashIn;
+            filein.fclose();
+
+            CDataStream ss(vchData, SER_DISK, CLIENT_VERSION);
+            if (hashIn != Hash(ss.begin(), ss.end()))
+                throw std::runtime_error("checksum mismatch");
+            std::string strMagicMessageTmp;
+            unsigned char pchMsgTmp[4];
+            ss >> strMagicMessageTmp >> FLATDATA(pchMsgTmp);
+            if (strMagicMessageTmp != strMagicMessage || memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+                throw std::runtime_error("invalid magic");
+            ss >> obj;
+            LogPrintf("Imported %s\n", strFile);
+        } catch (const std::exception& e) {
+            obj.Clear();
+            LogPrintf("%s : unable to import %s (%s)\n", __func__, strFile, e.what());
+        }
+        fs::remove(path);
+        return true;
+    }
+};
+
+#endif // AllForOneBusiness_TIERTWODB_H
@@ -9,6 +9,7 @@
 
 #include "pow.h"
 #include "uint256.h"
+#include "util.h"
 #include "zafo/zerocoin.h"
 
 #include <stdint.h>
@@ -22,6 +23,7 @@ static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -53,38 +55,111 @@ struct CoinEntry
 }
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+        db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe),
+        fPendingWriteFailed(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    WaitForPendingWrite();
+    if (threadWrite.joinable())
+        threadWrite.join();
+}
+
+std::shared_ptr<const CCoinsCacheChanges> CCoinsViewDB::GetPendingChanges() const
+{
+    std::lock_guard<std::mutex> lock(mutexPending);
+    return pendingChanges;
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->mapCoins.find(outpoint);
+        if (it != pending->mapCoins.end()) {
+            if (it->second.coin.IsSpent())
+                return false;
+            coin = it->second.coin;
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->mapCoins.find(outpoint);
+        if (it != pending->mapCoins.end())
+            return !it->second.coin.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    std::shared_ptr<const CCoinsCacheChanges> pending = GetPendingChanges();
+    if (pending && !pending->hashBlock.IsNull())
+        return pending->hashBlock;
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return UINT256_ZERO;
     return hashBestChain;
 }
 
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const
+{
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
+        return std::vector<uint256>();
+    }
+    return vhashHeadBlocks;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins,
                               const uint256& hashBlock,
                               const uint256& hashSaplingAnchor,
                               CAnchorsSaplingMap& mapSaplingAnchors,
                               CNullifiersMap& mapSaplingNullifiers)
+{
+    // The changes written in the background are older
+    if (!WaitForPendingWrite())
+        return error("%s: the previous write failed", __func__);
+    return WriteChanges(mapCoins, hashBlock, hashSaplingAnchor, mapSaplingAnchors, mapSaplingNullifiers);
+}
+
+bool CCoinsViewDB::WriteChanges(const CCoinsMap& mapCoins,
+                                const uint256& hashBlock,
+                                const uint256& hashSaplingAnchor,
+                                const CAnchorsSaplingMap& mapSaplingAnchors,
+                                const CNullifiersMap& mapSaplingNullifiers)
 {
     CDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    const size_t batch_size = (size_t) gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+
+    if (!hashBlock.IsNull()) {
+        // In the first batch, mark the database as being in the middle of a
+        // transition from old_tip to hashBlock.
+        uint256 old_tip;
+        if (!db.Read(DB_BEST_BLOCK, old_tip)) {
+            // We may be in the middle of replaying.
+            std::vector<uint256> old_heads = GetHeadBlocks();
+            if (old_heads.size() == 2) {
+                assert(old_heads[0] == hashBlock);
+                old_tip = old_heads[1];
+            }
+        }
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
+    }
+
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -94,21 +169,79 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins,
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (batch.SizeEstimate() > batch_size) {
+            LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
     }
 
     // Write Sapling
     BatchWriteSapling(hashSaplingAnchor, mapSaplingAnchors, mapSaplingNullifiers, batch);
 
-    if (!hashBlock.IsNull())
+    // In the last batch, mark the database as consistent with hashBlock again.
+    if (!hashBlock.IsNull()) {
+        batch.Erase(DB_HEAD_BLOCKS);
         batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
 
+    LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
 
+bool CCoinsViewDB::BatchWriteAsync(std::unique_ptr<CCoinsCacheChanges> changes, std::function<void()> fnWritten)
+{
+    if (!WaitForPendingWrite())
+        return error("%s: the previous write failed", __func__);
+    if (threadWrite.joinable())
+        threadWrite.join();
+
+    std::shared_ptr<const CCoinsCacheChanges> pending(std::move(changes));
+    {
+        std::lock_guard<std::mutex> lock(mutexPending);
+        pendingChanges = pending;
+    }
+    threadWrite = std::thread(&TraceThread<std::function<void()> >, "coinsdb",
+                              std::function<void()>(std::bind(&CCoinsViewDB::ThreadWrite, this, pending, fnWritten)));
+    return true;
+}
+
+void CCoinsViewDB::ThreadWrite(std::shared_ptr<const CCoinsCacheChanges> changes, std::function<void()> fnWritten)
+{
+    const int64_t nStart = GetTimeMillis();
+    bool fWritten = false;
+    try {
+        fWritten = WriteChanges(changes->mapCoins,
+                                changes->hashBlock,
+                                changes->hashSaplingAnchor,
+                                changes->mapSaplingAnchors,
+                                changes->mapSaplingNullifiers);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    LogPrint(BCLog::COINDB, "%s: %s in %dms\n", __func__, fWritten ? "written" : "failed", GetTimeMillis() - nStart);
+
+    {
+        std::lock_guard<std::mutex> lock(mutexPending);
+        pendingChanges.reset();
+        if (!fWritten)
+            fPendingWriteFailed = true;
+    }
+    condPending.notify_all();
+
+    if (fWritten && fnWritten)
+        fnWritten();
+}
+
+bool CCoinsViewDB::WaitForPendingWrite() const
+{
+    std::unique_lock<std::mutex> lock(mutexPending);
+    condPending.wait(lock, [this]{ return !pendingChanges; });
+    return !fPendingWriteFailed;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -149,6 +282,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Iterate over a consistent state
+    WaitForPendingWrite();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -202,8 +337,13 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo,
+                                  const std::vector<uint256>& vErasedBlocks) {
     CDBBatch batch;
+    // erased first: an entry indexed again since it was pruned is written below
+    for (const uint256& hash : vErasedBlocks) {
+        batch.Erase(std::make_pair(DB_BLOCK_INDEX, hash));
+    }
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
@@ -312,6 +452,8 @@ bool CBlockTreeDB::ReadLegacyBlockIndex(const uint256& blockHash, CLegacyBlockIn
     return Read(std::make_pair(DB_BLOCK_INDEX, blockHash), biRet);
 }
 
+static const char LZC_SPENDS_VERSION = 'V';
+
 CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
 {
 }
@@ -347,7 +489,7 @@ bool CZerocoinDB::EraseCoinMint(const CBigNum& bnPubcoin)
     return Erase(std::make_pair('m', hash));
 }
 
-bool CZerocoinDB::WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& spendInfo)
+bool CZerocoinDB::WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& spendInfo, const uint256& hashBlock, int nHeight)
 {
     CDBBatch batch;
     size_t count = 0;
@@ -356,7 +498,7 @@ bool CZerocoinDB::WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::C
         CDataStream ss(SER_GETHASH, 0);
         ss << bnSerial;
         uint256 hash = Hash(ss.begin(), ss.end());
-        batch.Write(std::make_pair('s', hash), it->second);
+        batch.Write(std::make_pair('s', hash), CZerocoinSpendPos(it->second, hashBlock, nHeight));
         ++count;
     }
 
@@ -370,12 +512,71 @@ bool CZerocoinDB::ReadCoinSpend(const CBigNum& bnSerial, uint256& txHash)
     ss << bnSerial;
     uint256 hash = Hash(ss.begin(), ss.end());
 
-    return Read(std::make_pair('s', hash), txHash);
+    return ReadCoinSpend(hash, txHash);
 }
 
 bool CZerocoinDB::ReadCoinSpend(const uint256& hashSerial, uint256 &txHash)
 {
-    return Read(std::make_pair('s', hashSerial), txHash);
+    CZerocoinSpendPos spendPos;
+    if (!ReadCoinSpend(hashSerial, spendPos))
+        return false;
+    txHash = spendPos.txid;
+    return true;
+}
+
+bool CZerocoinDB::ReadCoinSpend(const CBigNum& bnSerial, CZerocoinSpendPos& spendPos)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnSerial;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return ReadCoinSpend(hash, spendPos);
+}
+
+bool CZerocoinDB::ReadCoinSpend(const uint256& hashSerial, CZerocoinSpendPos& spendPos)
+{
+    return Read(std::make_pair('s', hashSerial), spendPos);
+}
+
+bool CZerocoinDB::ReadLegacyCoinSpends(std::vector<std::pair<uint256, uint256> >& vSpends)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair('s', UINT256_ZERO));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != 's')
+            break;
+        uint256 txid;
+        if (!pcursor->GetValue(txid))
+            return error("%s : failed to read value", __func__);
+        vSpends.emplace_back(key.second, txid);
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CZerocoinDB::UpgradeCoinSpends(const std::vector<std::pair<uint256, CZerocoinSpendPos> >& vPositions, const std::vector<uint256>& vErase)
+{
+    CDBBatch batch;
+    for (const auto& it : vPositions)
+        batch.Write(std::make_pair('s', it.first), it.second);
+    for (const uint256& hashSerial : vErase)
+        batch.Erase(std::make_pair('s', hashSerial));
+    batch.Write(LZC_SPENDS_VERSION, ZC_SPENDS_DB_VERSION);
+
+    LogPrint(BCLog::COINDB, "Upgrading %u coin spends in db (%u erased).\n", vPositions.size(), vErase.size());
+    return WriteBatch(batch, true);
+}
+
+bool CZerocoinDB::ReadCoinSpendsVersion(int& nVersion)
+{
+    return Read(LZC_SPENDS_VERSION, nVersion);
+}
+
+bool CZerocoinDB::WriteCoinSpendsVersion(int nVersion)
+{
+    return Write(LZC_SPENDS_VERSION, nVersion);
 }
 
 bool CZerocoinDB::EraseCoinSpend(const CBigNum& bnSerial)
@@ -402,13 +603,9 @@ bool CZerocoinDB::WipeCoins(std::string strType)
         boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
         if (pcursor->GetKey(key) && key.first == type) {
-            uint256 hash;
-            if (pcursor->GetValue(hash)) {
-                setDelete.insert(hash);
-                pcursor->Next();
-            } else {
-                return error("%s : failed to read value", __func__);
-            }
+            // erase by key (the values are txids, or spend positions)
+            setDelete.insert(key.second);
+            pcursor->Next();
         } else {
             break;
         }
@@ -13,8 +13,13 @@
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
 
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -34,6 +39,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -64,18 +71,64 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/** Where a zerocoin serial was spent: the spending transaction and its block */
+struct CZerocoinSpendPos
+{
+    uint256 txid;
+    uint256 hashBlock;
+    int nHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(txid);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+
+    CZerocoinSpendPos() : nHeight(0) {}
+    CZerocoinSpendPos(const uint256& txidIn, const uint256& hashBlockIn, int nHeightIn) :
+        txid(txidIn), hashBlock(hashBlockIn), nHeight(nHeightIn) {}
+};
+
+/** CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * The changes are written in batches of -dbbatchsize bytes at most: until the last one,
+ * the database records the old and the new best block (see GetHeadBlocks), so that the
+ * blocks in between can be replayed on startup if the write is interrupted.
+ * They can also be written from a background thread (BatchWriteAsync), in which case
+ * they are served from memory until written.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
 
+    // Changes being written in the background, and whether a background write failed
+    mutable std::mutex mutexPending;
+    mutable std::condition_variable condPending;
+    std::shared_ptr<const CCoinsCacheChanges> pendingChanges;
+    bool fPendingWriteFailed;
+    std::thread threadWrite;
+
+    std::shared_ptr<const CCoinsCacheChanges> GetPendingChanges() const;
+    bool WriteChanges(const CCoinsMap& mapCoins,
+                      const uint256& hashBlock,
+                      const uint256& hashSaplingAnchor,
+                      const CAnchorsSaplingMap& mapSaplingAnchors,
+                      const CNullifiersMap& mapSaplingNullifiers);
+    void ThreadWrite(std::shared_ptr<const CCoinsCacheChanges> changes, std::function<void()> fnWritten);
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
     bool HaveCoin(const COutPoint& outpoint) const override;
     uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
     CCoinsViewCursor* Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
@@ -88,13 +141,20 @@ public:
                     CAnchorsSaplingMap& mapSaplingAnchors,
                     CNullifiersMap& mapSaplingNullifiers) override;
 
+    //! Write the changes from a background thread, calling fnWritten (from that thread) once
+    //! they are on disk. Returns false if the previous background write failed.
+    bool BatchWriteAsync(std::unique_ptr<CCoinsCacheChanges> changes, std::function<void()> fnWritten = nullptr);
+
+    //! Wait for the background write, if any. Returns false if a background write failed.
+    bool WaitForPendingWrite() const;
+
     // Sapling, the implementation of the following functions can be found in sapling_txdb.cpp.
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const override;
     bool GetNullifier(const uint256 &nf) const override;
     uint256 GetBestAnchor() const override;
     bool BatchWriteSapling(const uint256& hashSaplingAnchor,
-                           CAnchorsSaplingMap& mapSaplingAnchors,
-                           CNullifiersMap& mapSaplingNullifiers,
+                           const CAnchorsSaplingMap& mapSaplingAnchors,
+                           const CNullifiersMap& mapSaplingNullifiers,
                            CDBBatch& batch);
 };
 
@@ -132,7 +192,8 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo,
+                        const std::vector<uint256>& vErasedBlocks);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
     bool WriteReindexing(bool fReindex);
@@ -148,6 +209,11 @@ public:
 };
 
 /** Zerocoin database (zerocoin/) */
+/** Version of the spent serials entries of the zerocoinDB:
+ *  0 - spending txid only
+ *  1 - spending txid, block hash and height (CZerocoinSpendPos) */
+static const int ZC_SPENDS_DB_VERSION = 1;
+
 class CZerocoinDB : public CDBWrapper
 {
 public:
@@ -162,10 +228,18 @@ public:
     bool WriteCoinMintBatch(const std::vector<std::pair<libzerocoin::PublicCoin, uint256> >& mintInfo);
     bool ReadCoinMint(const CBigNum& bnPubcoin, uint256& txHash);
     bool ReadCoinMint(const uint256& hashPubcoin, uint256& hashTx);
-    /** Write zPIV spends to the zerocoinDB in a batch */
-    bool WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& spendInfo);
+    /** Write zPIV spends (with the block they are in) to the zerocoinDB in a batch */
+    bool WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& spendInfo, const uint256& hashBlock, int nHeight);
     bool ReadCoinSpend(const CBigNum& bnSerial, uint256& txHash);
     bool ReadCoinSpend(const uint256& hashSerial, uint256 &txHash);
+    bool ReadCoinSpend(const CBigNum& bnSerial, CZerocoinSpendPos& spendPos);
+    bool ReadCoinSpend(const uint256& hashSerial, CZerocoinSpendPos& spendPos);
+    /** Upgrade of the spends from version 0: read the [serial hash, txid] entries, then
+     *  replace them with their positions (erasing the ones not in a block) */
+    bool ReadLegacyCoinSpends(std::vector<std::pair<uint256, uint256> >& vSpends);
+    bool UpgradeCoinSpends(const std::vector<std::pair<uint256, CZerocoinSpendPos> >& vPositions, const std::vector<uint256>& vErase);
+    bool ReadCoinSpendsVersion(int& nVersion);
+    bool WriteCoinSpendsVersion(int nVersion);
     bool EraseCoinMint(const CBigNum& bnPubcoin);
     bool EraseCoinSpend(const CBigNum& bnSerial);
     bool WipeCoins(std::string strType);
@@ -39,6 +39,7 @@
 #include "policy/policy.h"
 #include "pow.h"
 #include "reverse_iterate.h"
+#include "sapling/sapling_validation.h"
 #include "script/sigcache.h"
 #include "spork.h"
 #include "sporkdb.h"
@@ -90,6 +91,7 @@ uint256 g_best_block;
 
 int nScriptCheckThreads = 0;
 std::atomic<bool> fImporting{false};
+std::atomic<bool> g_is_mempool_loaded{false};
 std::atomic<bool> fReindex{false};
 bool fTxIndex = true;
 bool fCheckBlockIndex = false;
@@ -153,6 +155,37 @@ std::set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexCandidates;
 /** All pairs A->B, where A (or one if its ancestors) misses transactions, but B has transactions. */
 std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
+/** Blocks downloaded before their parent, by hash of the parent (their proof of stake needs the parent's stake modifier). */
+std::multimap<uint256, std::shared_ptr<const CBlock>> mapPendingBlocks;
+size_t nPendingBlocksSize = 0;
+
+/** Block index entries known only by their header (not authenticated yet for PoS blocks). */
+std::set<CBlockIndex*> setHeaderOnlyBlockIndex;
+/** Header-only entries pruned since the last flush, to erase from the block tree database. */
+std::set<uint256> setErasedBlockIndex;
+
+/** Outpoints and zerocoin serials spent in a block, to check the double spends of the blocks on forks */
+struct CBlockSpends
+{
+    std::unordered_set<COutPoint, SaltedOutpointHasher> setOutpoints;
+    std::unordered_set<uint256, SaltedIdHasher> setSerialHashes;
+
+    explicit CBlockSpends(const CBlock& block)
+    {
+        for (const auto& tx : block.vtx) {
+            for (const CTxIn& in : tx->vin) {
+                if (in.IsZerocoinSpend())
+                    setSerialHashes.insert(GetSerialHash(TxInToZerocoinSpend(in).getCoinSerialNumber()));
+                else
+                    setOutpoints.insert(in.prevout);
+            }
+        }
+    }
+};
+
+/** Spends of the blocks received within the max reorg depth, by height and block index. */
+std::map<std::pair<int, const CBlockIndex*>, CBlockSpends> mapBlockSpends;
+
 RecursiveMutex cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
@@ -198,6 +231,7 @@ CBlockIndex* GetChainTip()
     return mapBlockIndex.at(p->GetBlockHash());
 }
 
+CCoinsViewDB* pcoinsdbview = NULL;
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
@@ -305,7 +339,7 @@ std::string FormatStateMessage(const CValidationState &state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransactionRef& _tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool ignoreFees,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool ignoreFees,
                               std::vector<COutPoint>& coins_to_uncache)
 {
     AssertLockHeld(cs_main);
@@ -471,7 +505,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        CTxMemPoolEntry entry(_tx, nFees, GetTime(), dPriority, chainHeight, pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
+        CTxMemPoolEntry entry(_tx, nFees, nAcceptTime, dPriority, chainHeight, pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -563,6 +597,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                     __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // Verify the Sapling proofs and signatures (the same check ConnectBlock dispatches to the check queue)
+        if (tx.isSapling() && tx.hasSaplingData()) {
+            if (!SaplingValidation::ContextualCheckTransaction(tx, state, Params(), chainHeight + 1, false, IsInitialBlockDownload()))
+                return error("%s: Sapling checks on %s failed with %s", __func__, hash.ToString(), FormatStateMessage(state));
+        }
+
         // Store transaction in memory
         pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
 
@@ -578,16 +618,16 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
-    GetMainSignals().SyncTransaction(tx, nullptr, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    GetMainSignals().SyncTransaction(_tx, nullptr, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
 
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef& tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fIgnoreFees)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef& tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fIgnoreFees)
 {
     std::vector<COutPoint> coins_to_uncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, fIgnoreFees, coins_to_uncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, fRejectAbsurdFee, fIgnoreFees, coins_to_uncache);
     if (!res) {
         for (const COutPoint& outpoint: coins_to_uncache)
             pcoinsTip->Uncache(outpoint);
@@ -598,6 +638,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef& tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fIgnoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, fRejectAbsurdFee, fIgnoreFees);
+}
+
 bool GetOutput(const uint256& hash, unsigned int index, CValidationState& state, CTxOut& out)
 {
     CTransaction txPrev;
@@ -697,7 +743,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPoW)
 {
     block.SetNull();
 
@@ -714,7 +760,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     }
 
     // Check the header
-    if (block.IsProofOfWork()) {
+    if (fCheckPoW && block.IsProofOfWork()) {
         if (!CheckProofOfWork(block.GetHash(), block.nBits))
             return error("ReadBlockFromDisk : Errors in block header");
     }
@@ -722,9 +768,44 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    return ReadBlockFromDisk(block, pos, true);
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos)
+{
+    // Open history file at the index header (message start and size) preceding the block
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : invalid block position %d:%u", __func__, pos.nFile, pos.nPos);
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int nSize;
+        filein >> FLATDATA(blk_start) >> nSize;
+
+        if (memcmp(blk_start, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("%s : block %d:%u has an invalid message start", __func__, pos.nFile, pos.nPos);
+        if (nSize > MAX_SIZE)
+            return error("%s : block %d:%u is larger than the max size (%u)", __func__, pos.nFile, pos.nPos, nSize);
+
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    } catch (const std::exception& e) {
+        return error("%s : Read from block file failed - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // The header was checked when it was added to the index: matching its hash is enough
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), false))
         return false;
     if (block.GetHash() != pindex->GetBlockHash()) {
         LogPrintf("%s : block=%s index=%s\n", __func__, block.GetHash().GetHex(), pindex->GetBlockHash().GetHex());
@@ -1144,6 +1225,7 @@ static bool AbortNode(const std::string& strMessage, const std::string& userMess
 {
     strMiscWarning = strMessage;
     LogPrintf("*** %s\n", strMessage);
+    g_logger->FlushBuffered();
     uiInterface.ThreadSafeMessageBox(
         userMessage.empty() ? _("Error: A fatal internal error occured, see debug.log for details") : userMessage,
         "", CClientUIInterface::MSG_ERROR);
@@ -1213,6 +1295,37 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
 
 } // anon namespace
 
+bool GetCoinSpentAfterFork(const COutPoint& outpoint, const CBlockIndex* pindexFork, Coin& coinRet)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexFork && chainActive.Contains(pindexFork));
+
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex != pindexFork; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("%s : failed to read block %s", __func__, pindex->GetBlockHash().GetHex());
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            // zerocoin spends have no undo data
+            if (tx.HasZerocoinSpendInputs())
+                continue;
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                if (tx.vin[j].prevout != outpoint)
+                    continue;
+                CBlockUndo blockUndo;
+                const CDiskBlockPos pos = pindex->GetUndoPos();
+                if (pos.IsNull() || !UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+                    return error("%s : failed to read undo data of block %s", __func__, pindex->GetBlockHash().GetHex());
+                if (blockUndo.vtxundo.size() != block.vtx.size() - 1 || blockUndo.vtxundo[i - 1].vprevout.size() != tx.vin.size())
+                    return error("%s : block and undo data inconsistent", __func__);
+                coinRet = blockUndo.vtxundo[i - 1].vprevout[j];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 enum DisconnectResult
 {
     DISCONNECT_OK,      // All good.
@@ -1246,7 +1359,8 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
             return DISCONNECT_FAILED; // adding output for transaction without known metadata
         }
     }
-    view.AddCoin(out, std::move(undo), false);
+    // The coin is overwritten if the view has it already (e.g. when replaying blocks)
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -1381,6 +1495,24 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+// Sapling proofs take milliseconds each: hand them out to the workers one by one
+static CCheckQueue<SaplingValidation::CSaplingProofCheck> saplingcheckqueue(1);
+
+void ThreadSaplingProofCheck()
+{
+    util::ThreadRename("allforonebusiness-saplingch");
+    saplingcheckqueue.Thread();
+}
+
+// Zerocoin spend signatures: a few per block, verified in small batches
+static CCheckQueue<CZerocoinSpendCheck> zerocoincheckqueue(8);
+
+void ThreadZerocoinSpendCheck()
+{
+    util::ThreadRename("allforonebusiness-zcspendch");
+    zerocoincheckqueue.Thread();
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1451,6 +1583,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<SaplingValidation::CSaplingProofCheck> saplingControl(fScriptChecks && nScriptCheckThreads ? &saplingcheckqueue : nullptr);
+    CCheckQueueControl<CZerocoinSpendCheck> zerocoinControl(nScriptCheckThreads ? &zerocoincheckqueue : nullptr);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -1498,19 +1632,28 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
 
         if (tx.HasZerocoinSpendInputs()) {
-            int nHeightTx = 0;
             uint256 txid = tx.GetHash();
             vSpendsInBlock.emplace_back(txid);
-            if (IsTransactionInChain(txid, nHeightTx)) {
-                //when verifying blocks on init, the blocks are scanned without being disconnected - prevent that from causing an error
-                if (!fVerifyingBlocks || (fVerifyingBlocks && pindex->nHeight > nHeightTx))
+
+            // Double spends: the spent serials are recorded with their block, so this is a point read
+            // of the zerocoinDB. A tx already in the chain is found by its own serials.
+            auto checkSerialNotInChain = [&](const libzerocoin::CoinSpend& spend) {
+                int nHeightTx = 0;
+                uint256 txidSpend;
+                if (!IsSerialInBlockchain(GetSerialHash(spend.getCoinSerialNumber()), nHeightTx, txidSpend))
+                    return true;
+                if (txidSpend == txid)
                     return state.DoS(100, error("%s : txid %s already exists in block %d , trying to include it again in block %d", __func__,
-                                                tx.GetHash().GetHex(), nHeightTx, pindex->nHeight),
+                                                txid.GetHex(), nHeightTx, pindex->nHeight),
                                      REJECT_INVALID, "bad-txns-inputs-missingorspent");
-            }
-
-            //Check for double spending of serial #'s
-            std::set<CBigNum> setSerials;
+                return state.DoS(100, error("%s : zAFO spend with serial %s is already in block %d", __func__,
+                                            spend.getCoinSerialNumber().GetHex(), nHeightTx),
+                                 REJECT_INVALID, "bad-txns-inputs-missingorspent");
+            };
+
+            // The spends are parsed (and their serials checked against the chain) here, under cs_main,
+            // while the signatures are verified on the check queue
+            std::vector<CZerocoinSpendCheck> vZerocoinChecks;
             for (const CTxIn& txIn : tx.vin) {
                 bool isPublicSpend = txIn.IsZerocoinPublicSpend();
                 bool isPrivZerocoinSpend = txIn.IsZerocoinSpend();
@@ -1531,17 +1674,32 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     nValueIn += publicSpend.getDenomination() * COIN;
                     //queue for db write after the 'justcheck' section has concluded
                     vSpends.emplace_back(publicSpend, tx.GetHash());
-                    if (!ContextualCheckZerocoinSpend(tx, &publicSpend, pindex->nHeight, hashBlock))
+                    if (!checkSerialNotInChain(publicSpend))
+                        return false;
+                    CZerocoinSpendCheck check(tx, std::make_shared<const PublicCoinSpend>(publicSpend), pindex->nHeight, hashBlock);
+                    if (!nScriptCheckThreads && !check())
                         return state.DoS(100, error("%s: failed to add block %s with invalid public zc spend", __func__, tx.GetHash().GetHex()), REJECT_INVALID);
+                    if (nScriptCheckThreads) {
+                        vZerocoinChecks.emplace_back();
+                        check.swap(vZerocoinChecks.back());
+                    }
                 } else {
                     libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
                     nValueIn += spend.getDenomination() * COIN;
                     //queue for db write after the 'justcheck' section has concluded
                     vSpends.emplace_back(spend, tx.GetHash());
-                    if (!ContextualCheckZerocoinSpend(tx, &spend, pindex->nHeight, hashBlock))
+                    if (!checkSerialNotInChain(spend))
+                        return false;
+                    CZerocoinSpendCheck check(tx, std::make_shared<const libzerocoin::CoinSpend>(spend), pindex->nHeight, hashBlock);
+                    if (!nScriptCheckThreads && !check())
                         return state.DoS(100, error("%s: failed to add block %s with invalid zerocoinspend", __func__, tx.GetHash().GetHex()), REJECT_INVALID);
+                    if (nScriptCheckThreads) {
+                        vZerocoinChecks.emplace_back();
+                        check.swap(vZerocoinChecks.back());
+                    }
                 }
             }
+            zerocoinControl.Add(vZerocoinChecks);
 
         } else if (!tx.IsCoinBase()) {
             if (!view.HaveInputs(tx))
@@ -1583,6 +1741,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return error("%s: Check inputs on %s failed with %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
         }
+
+        // Sapling proofs and signatures of the block are verified in parallel on the check queue
+        if (tx.isSapling() && tx.hasSaplingData()) {
+            std::vector<SaplingValidation::CSaplingProofCheck> vSaplingChecks;
+            if (!SaplingValidation::ContextualCheckTransaction(tx, state, Params(), pindex->nHeight, true, IsInitialBlockDownload(),
+                                                               fScriptChecks && nScriptCheckThreads ? &vSaplingChecks : nullptr))
+                return error("%s: Sapling checks on %s failed with %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+            saplingControl.Add(vSaplingChecks);
+        }
         nValueOut += tx.GetValueOut();
 
         CTxUndo undoDummy;
@@ -1616,6 +1783,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
+    if (!saplingControl.Wait())
+        return state.DoS(100, error("%s: Sapling CheckQueue failed", __func__), REJECT_INVALID, "bad-txns-sapling-proofs-invalid");
+    if (!zerocoinControl.Wait())
+        return state.DoS(100, error("%s: zerocoin spend CheckQueue failed", __func__), REJECT_INVALID, "bad-txns-invalid-zafo");
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
@@ -1674,7 +1845,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     // Flush spend/mint info to disk
-    if (!vSpends.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpends))
+    if (!vSpends.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpends, pindex->GetBlockHash(), pindex->nHeight))
         return AbortNode(state, "Failed to record coin serials to database");
 
     if (!vMints.empty() && !zerocoinDB->WriteCoinMintBatch(vMints))
@@ -1785,7 +1956,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                     vBlocks.push_back(*it);
                     setDirtyBlockIndex.erase(it++);
                 }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                std::vector<uint256> vErased(setErasedBlockIndex.begin(), setErasedBlockIndex.end());
+                setErasedBlockIndex.clear();
+                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vErased)) {
                     return AbortNode(state, "Files to write to block index database");
                 }
                 // Flush zerocoin supply
@@ -1806,13 +1979,39 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
-                return AbortNode(state, "Failed to write to coin database");
-            nLastFlush = nNow;
-            // Update money supply on memory, reading data from disk
-            if (!ShutdownRequested() && !IsInitialBlockDownload()) {
-                MoneySupply.Update(pcoinsTip->GetTotalAmount(), chainActive.Height());
+            // The modified coins stay in the cache, as clean entries, and are written from
+            // a background thread, unless the state has to be on disk on return.
+            std::unique_ptr<CCoinsCacheChanges> changes(new CCoinsCacheChanges());
+            pcoinsTip->TakeChanges(*changes);
+            const bool fUpdateSupply = !ShutdownRequested() && !IsInitialBlockDownload();
+            if (mode == FLUSH_STATE_ALWAYS) {
+                if (!pcoinsdbview->BatchWrite(changes->mapCoins,
+                                              changes->hashBlock,
+                                              changes->hashSaplingAnchor,
+                                              changes->mapSaplingAnchors,
+                                              changes->mapSaplingNullifiers))
+                    return AbortNode(state, "Failed to write to coin database");
+                // Update money supply on memory, reading data from disk
+                if (fUpdateSupply) {
+                    MoneySupply.Update(pcoinsTip->GetTotalAmount(), chainActive.Height());
+                }
+            } else {
+                // Update money supply on memory once the data is on disk
+                std::function<void()> fnWritten;
+                if (fUpdateSupply) {
+                    CCoinsViewDB* pcoinsdb = pcoinsdbview;
+                    const int nHeight = chainActive.Height();
+                    fnWritten = [pcoinsdb, nHeight]() {
+                        MoneySupply.Update(CCoinsViewCache(pcoinsdb).GetTotalAmount(), nHeight);
+                    };
+                }
+                if (!pcoinsdbview->BatchWriteAsync(std::move(changes), fnWritten))
+                    return AbortNode(state, "Failed to write to coin database");
             }
+            nLastFlush = nNow;
+            // Keep the coins used since the previous flush. If they still fill the cache,
+            // the next flush only keeps the ones used in between.
+            pcoinsTip->EvictCold();
         }
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
             // Update best block in wallet (so we can detect restored wallets).
@@ -1883,7 +2082,8 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     CBlockIndex* pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     // Read block from disk.
-    CBlock block;
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    CBlock& block = *pblock;
     if (!ReadBlockFromDisk(block, pindexDelete))
         return AbortNode(state, "Failed to read block");
     // Apply the block atomically to the chain state.
@@ -1924,17 +2124,19 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     } else {
         mnodeman.UncacheBlockHash(pindexDelete);
     }
+    // Update MN payments last paid index
+    masternodePayments.BlockDisconnected(pindexDelete);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     for (const auto& tx : block.vtx) {
-        GetMainSignals().SyncTransaction(*tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+        GetMainSignals().SyncTransaction(tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
     }
 
     if (chainparams.GetConsensus().NetworkUpgradeActive(pindexDelete->nHeight, Consensus::UPGRADE_V5_DUMMY)) {
         // Update Sapling cached incremental witnesses
-        GetMainSignals().ChainTip(pindexDelete, &block, nullopt);
+        GetMainSignals().ChainTip(pindexDelete, pblock, nullopt);
     }
 
     return true;
@@ -2021,6 +2223,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const st
     UpdateTip(pindexNew);
     // Update MN manager cache
     mnodeman.CacheBlockHash(pindexNew);
+    // Update MN payments last paid index
+    masternodePayments.BlockConnected(pindexNew);
 
     int64_t nTime6 = GetTimeMicros();
     nTimePostConnect += nTime6 - nTime5;
@@ -2246,6 +2450,12 @@ bool ActivateBestChain(CValidationState& state, std::shared_ptr<const CBlock> pb
     do {
         boost::this_thread::interruption_point();
 
+        // Let the background listeners catch up, when validation (e.g. during
+        // the initial download or a reindex) runs too far ahead of them
+        if (GetMainSignals().CallbacksPending() > MAX_VALIDATION_CALLBACKS_PENDING) {
+            SyncWithValidationInterfaceQueue();
+        }
+
         const CBlockIndex *pindexFork;
         ConnectTrace connectTrace;
         bool fInitialDownload;
@@ -2273,14 +2483,14 @@ bool ActivateBestChain(CValidationState& state, std::shared_ptr<const CBlock> pb
 
             // throw all transactions though the signal-interface
             for (const auto &tx : connectTrace.txConflicted) {
-                GetMainSignals().SyncTransaction(*tx, pindexNewTip, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+                GetMainSignals().SyncTransaction(tx, pindexNewTip, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
             }
             // ... and about transactions that got confirmed:
             for (const auto& pair : connectTrace.blocksConnected) {
                 assert(pair.second);
                 const CBlock& block = *(pair.second);
                 for (unsigned int i = 0; i < block.vtx.size(); i++) {
-                    GetMainSignals().SyncTransaction(*block.vtx[i], pair.first, i);
+                    GetMainSignals().SyncTransaction(block.vtx[i], pair.first, i);
                 }
 
                 // Sapling: notify wallet about the connected blocks ordered
@@ -2297,15 +2507,17 @@ bool ActivateBestChain(CValidationState& state, std::shared_ptr<const CBlock> pb
                 }
 
                 // Sapling: Update cached incremental witnesses
-                GetMainSignals().ChainTip(pair.first, &block, oldSaplingTree);
+                GetMainSignals().ChainTip(pair.first, pair.second, oldSaplingTree);
             }
 
+            // Notify external listeners about the new tip.
+            // Enqueue while holding cs_main to ensure that UpdatedBlockTip is called
+            // in the order in which blocks are connected
+            GetMainSignals().UpdatedBlockTip(pindexNewTip, pindexFork, fInitialDownload);
+
             break;
         }
 
-        // Notify external listeners about the new tip.
-        GetMainSignals().UpdatedBlockTip(pindexNewTip, pindexFork, fInitialDownload);
-
         // Always notify the UI if a new block tip was connected
         if (pindexFork != pindexNewTip) {
 
@@ -2405,7 +2617,7 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlock& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 {
     // Check for duplicate
     uint256 hash = block.GetHash();
@@ -2428,16 +2640,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
-
-        const Consensus::Params& consensus = Params().GetConsensus();
-        if (!consensus.NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_V3_4)) {
-            // compute and set new V1 stake modifier (entropy bits)
-            pindexNew->SetNewStakeModifier();
-
-        } else {
-            // compute and set new V2 stake modifier (hash of prevout and prevModifier)
-            pindexNew->SetNewStakeModifier(block.vtx[1]->vin[0].prevout.hash);
-        }
+        // The stake modifier is set in AcceptBlock, as it needs the coinstake of the full block
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -2445,6 +2648,8 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         pindexBestHeader = pindexNew;
 
     setDirtyBlockIndex.insert(pindexNew);
+    setHeaderOnlyBlockIndex.insert(pindexNew);
+    setErasedBlockIndex.erase(hash);
 
     return pindexNew;
 }
@@ -2477,6 +2682,7 @@ bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBl
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
+    setHeaderOnlyBlockIndex.erase(pindexNew);
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
@@ -2842,14 +3048,19 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
+bool CheckWork(const CBlock& block, CBlockIndex* const pindexPrev)
+{
+    return CheckWork(block, pindexPrev, block.IsProofOfWork());
+}
+
+bool CheckWork(const CBlockHeader& block, CBlockIndex* const pindexPrev, bool fProofOfWork)
 {
     if (pindexPrev == NULL)
         return error("%s : null pindexPrev for block %s", __func__, block.GetHash().GetHex());
 
     unsigned int nBitsRequired = GetNextWorkRequired(pindexPrev, &block);
 
-    if (!Params().IsRegTestNet() && block.IsProofOfWork() && (pindexPrev->nHeight + 1 <= 68589)) {
+    if (!Params().IsRegTestNet() && fProofOfWork && (pindexPrev->nHeight + 1 <= 68589)) {
         double n1 = ConvertBitsToDouble(block.nBits);
         double n2 = ConvertBitsToDouble(nBitsRequired);
 
@@ -2994,7 +3205,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 }
 
 // Get the index of previous block of given CBlock
-bool GetPrevIndex(const CBlock& block, CBlockIndex** pindexPrevRet, CValidationState& state)
+bool GetPrevIndex(const CBlockHeader& block, CBlockIndex** pindexPrevRet, CValidationState& state)
 {
     CBlockIndex*& pindexPrev = *pindexPrevRet;
     pindexPrev = nullptr;
@@ -3009,8 +3220,9 @@ bool GetPrevIndex(const CBlock& block, CBlockIndex** pindexPrevRet, CValidationS
                 LogPrintf("%s : Reconsidering block %s height %d\n", __func__, block.hashPrevBlock.ToString(), pindexPrev->nHeight);
                 CValidationState statePrev;
                 ReconsiderBlock(statePrev, pindexPrev);
+                // cs_main is held here: the chain is activated by ProcessNewBlock, once it's released
+                // (ActivateBestChain can wait for the validation interface queue)
                 if (statePrev.IsValid()) {
-                    ActivateBestChain(statePrev);
                     return true;
                 }
             }
@@ -3021,7 +3233,7 @@ bool GetPrevIndex(const CBlock& block, CBlockIndex** pindexPrevRet, CValidationS
     return true;
 }
 
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, CBlockIndex* pindexPrev)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CBlockIndex* pindexPrev)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3063,6 +3275,71 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
     return true;
 }
 
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, CBlockIndex** ppindex)
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& consensus = Params().GetConsensus();
+
+    CBlockIndex* pindexLast = nullptr;
+    for (const CBlockHeader& header : headers) {
+        CBlockIndex* pindexPrev = nullptr;
+        if (!GetPrevIndex(header, &pindexPrev, state))
+            return false;
+
+        if (pindexPrev && !mapBlockIndex.count(header.GetHash())) {
+            const int nHeight = pindexPrev->nHeight + 1;
+            // The headers can't be authenticated without their blocks: don't let the header chains
+            // run ahead of the active chain by more than MAX_HEADERS_AHEAD (the rest is requested
+            // again as the blocks are connected)
+            if (nHeight > chainActive.Height() + MAX_HEADERS_AHEAD)
+                break;
+
+            // Everything that can be checked without the transactions: the PoW hash (before
+            // the PoS upgrade) and the required difficulty. The kernel and the block signature
+            // are checked in AcceptBlock, once the block is downloaded.
+            const bool fProofOfWork = !consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_POS);
+            if (!CheckBlockHeader(header, state, fProofOfWork))
+                return error("%s: CheckBlockHeader failed for block %s: %s", __func__, header.GetHash().ToString(), FormatStateMessage(state));
+            if (!CheckWork(header, pindexPrev, fProofOfWork))
+                return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, strprintf("incorrect difficulty at %d", nHeight));
+        }
+
+        if (!AcceptBlockHeader(header, state, &pindexLast, pindexPrev))
+            return false;
+    }
+
+    if (ppindex)
+        *ppindex = pindexLast;
+
+    return true;
+}
+
+// Cache the spends of a block received within the max reorg depth, forgetting the
+// ones of the blocks that can't be part of a fork anymore (requires cs_main)
+static const CBlockSpends* CacheBlockSpends(const CBlockIndex* pindex, const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    const int nMinHeight = chainActive.Height() - gArgs.GetArg("-maxreorg", DEFAULT_MAX_REORG_DEPTH);
+    mapBlockSpends.erase(mapBlockSpends.begin(), mapBlockSpends.lower_bound(std::make_pair(nMinHeight, (const CBlockIndex*)nullptr)));
+    if (pindex->nHeight < nMinHeight)
+        return nullptr;
+    return &mapBlockSpends.emplace(std::piecewise_construct, std::forward_as_tuple(pindex->nHeight, pindex), std::forward_as_tuple(block)).first->second;
+}
+
+// Get the spends of a block from the cache (requires cs_main). Only the blocks
+// received before a restart are read from disk again.
+static const CBlockSpends* GetBlockSpends(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    auto it = mapBlockSpends.find(std::make_pair(pindex->nHeight, pindex));
+    if (it != mapBlockSpends.end())
+        return &it->second;
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return nullptr;
+    return CacheBlockSpends(pindex, block);
+}
+
 bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, bool fAlreadyCheckedBlock)
 {
     AssertLockHeld(cs_main);
@@ -3096,6 +3373,19 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
         return true;
     }
 
+    // The stake modifier needs the coinstake, so it's set when the block is received, at the
+    // place it was set (by AddToBlockIndex) before the block index could come from the header
+    if (pindex->pprev) {
+        if (!consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_V3_4)) {
+            // compute and set new V1 stake modifier (entropy bits)
+            pindex->SetNewStakeModifier();
+
+        } else {
+            // compute and set new V2 stake modifier (hash of prevout and prevModifier)
+            pindex->SetNewStakeModifier(block.vtx[1]->vin[0].prevout.hash);
+        }
+    }
+
     if ((!fAlreadyCheckedBlock && !CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3187,11 +3477,6 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
             // Start at the block we're adding on to
             CBlockIndex *prev = pindexPrev;
 
-            CBlock bl;
-            if (!ReadBlockFromDisk(bl, prev))
-                return error("%s: previous block %s not on disk", __func__, prev->GetBlockHash().GetHex());
-
-            std::vector<CBigNum> vBlockSerials;
             int readBlock = 0;
             // Go backwards on the forked chain up to the split
             while (!chainActive.Contains(prev)) {
@@ -3204,32 +3489,25 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
                     return error("%s: forked chain longer than maximum reorg limit", __func__);
                 }
 
-                // Loop through every tx of this block
-                for (const auto& txIn : bl.vtx) {
-                    const CTransaction& t = *txIn;
-                    // Loop through every input of this tx
-                    for (const CTxIn& in: t.vin) {
-                        // If this input is a zerocoin spend, and the coinstake has zerocoin inputs
-                        // then store the serials for later check
-                        if(hasZAFOInputs && in.IsZerocoinSpend())
-                            vBlockSerials.push_back(TxInToZerocoinSpend(in).getCoinSerialNumber());
-
-                        // Loop through every input of the staking tx
-                        if (hasAFOInputs) {
-                            for (const CTxIn& stakeIn : afoInputs)
-                                // check if the tx input is double spending any coinstake input
-                                if (stakeIn.prevout == in.prevout)
-                                    return state.DoS(100, error("%s: input already spent on a previous block", __func__));
-                        }
-                    }
+                const CBlockSpends* pspends = GetBlockSpends(prev);
+                if (!pspends)
+                    // Previous block not on disk, or below the max reorg depth
+                    return error("%s: spends of previous block %s not available", __func__, prev->GetBlockHash().GetHex());
+
+                // check if any coinstake input is spent in this block
+                for (const CTxIn& stakeIn : afoInputs) {
+                    if (pspends->setOutpoints.count(stakeIn.prevout))
+                        return state.DoS(100, error("%s: input already spent on a previous block", __func__));
+                }
+
+                // check if any coinstake serial is spent in this block
+                for (const CTxIn& zAfoInput : zAFOInputs) {
+                    if (pspends->setSerialHashes.count(GetSerialHash(TxInToZerocoinSpend(zAfoInput).getCoinSerialNumber())))
+                        return state.DoS(100, error("%s: serial double spent on fork", __func__));
                 }
 
                 // Prev block
                 prev = prev->pprev;
-                if (!ReadBlockFromDisk(bl, prev))
-                    // Previous block not on disk
-                    return error("%s: previous block %s not on disk", __func__, prev->GetBlockHash().GetHex());
-
             }
 
             // Split height
@@ -3240,15 +3518,7 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
                 for (const CTxIn& zAfoInput : zAFOInputs) {
                     libzerocoin::CoinSpend spend = TxInToZerocoinSpend(zAfoInput);
 
-                    // First check if the serials were not already spent on the forked blocks.
-                    CBigNum coinSerial = spend.getCoinSerialNumber();
-                    for(const CBigNum& serial : vBlockSerials){
-                        if(serial == coinSerial){
-                            return state.DoS(100, error("%s: serial double spent on fork", __func__));
-                        }
-                    }
-
-                    // Now check if the serial exists before the chain split.
+                    // Check if the serial exists before the chain split.
                     int nHeightTx = 0;
                     if (IsSerialInBlockchain(spend.getCoinSerialNumber(), nHeightTx)) {
                         // if the height is nHeightTx > chainSplit means that the spent occurred after the chain split
@@ -3306,6 +3576,10 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
         return AbortNode(state, std::string("System error: ") + e.what());
     }
 
+    // Keep the spends of the block in memory, for the double spend checks of the blocks on forks
+    if (isPoS)
+        CacheBlockSpends(pindex, block);
+
     return true;
 }
 
@@ -3357,7 +3631,140 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_ptr<const CBlock> pblock, CDiskBlockPos* dbp, bool* fAccepted)
+bool IsBlockPending(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (!pindex->pprev)
+        return false;
+    auto range = mapPendingBlocks.equal_range(pindex->pprev->GetBlockHash());
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->GetHash() == pindex->GetBlockHash())
+            return true;
+    }
+    return false;
+}
+
+bool IsPendingBlocksFull()
+{
+    AssertLockHeld(cs_main);
+    return nPendingBlocksSize + MAX_BLOCK_SIZE_CURRENT > MAX_PENDING_BLOCKS_SIZE;
+}
+
+// Keep a block whose parent was not received yet (requires cs_main)
+static void AddPendingBlock(const std::shared_ptr<const CBlock>& pblock)
+{
+    AssertLockHeld(cs_main);
+    const uint256& hash = pblock->GetHash();
+    auto range = mapPendingBlocks.equal_range(pblock->hashPrevBlock);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->GetHash() == hash)
+            return;
+    }
+    const size_t nSize = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+    if (nPendingBlocksSize + nSize > MAX_PENDING_BLOCKS_SIZE) {
+        // The children of blocks still missing are not requested while the buffer is full
+        // (see IsPendingBlocksFull), so this is requested again once the parent is received
+        LogPrint(BCLog::NET, "%s : pending blocks limit reached, dropping block %s\n", __func__, hash.ToString());
+        return;
+    }
+    mapPendingBlocks.emplace(pblock->hashPrevBlock, pblock);
+    nPendingBlocksSize += nSize;
+    LogPrint(BCLog::NET, "%s : block %s received before its parent %s\n", __func__, hash.ToString(), pblock->hashPrevBlock.ToString());
+}
+
+// Remove and return the pending children of a block, if it has been stored (requires cs_main)
+static std::vector<std::shared_ptr<const CBlock>> PopPendingBlocks(const uint256& hashParent)
+{
+    AssertLockHeld(cs_main);
+    std::vector<std::shared_ptr<const CBlock>> vBlocks;
+    BlockMap::iterator mi = mapBlockIndex.find(hashParent);
+    if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+        return vBlocks;
+    auto range = mapPendingBlocks.equal_range(hashParent);
+    for (auto it = range.first; it != range.second; ++it) {
+        nPendingBlocksSize -= ::GetSerializeSize(*it->second, SER_NETWORK, PROTOCOL_VERSION);
+        vBlocks.emplace_back(it->second);
+    }
+    mapPendingBlocks.erase(range.first, range.second);
+    return vBlocks;
+}
+
+// Drop the pending descendants of a block that turned out invalid, or was forgotten (requires cs_main)
+static void ErasePendingBlocks(const uint256& hashParent)
+{
+    AssertLockHeld(cs_main);
+    std::deque<uint256> queue;
+    queue.push_back(hashParent);
+    while (!queue.empty()) {
+        auto range = mapPendingBlocks.equal_range(queue.front());
+        queue.pop_front();
+        for (auto it = range.first; it != range.second; ++it) {
+            LogPrint(BCLog::NET, "%s : dropping pending block %s\n", __func__, it->second->GetHash().ToString());
+            nPendingBlocksSize -= ::GetSerializeSize(*it->second, SER_NETWORK, PROTOCOL_VERSION);
+            queue.push_back(it->second->GetHash());
+        }
+        mapPendingBlocks.erase(range.first, range.second);
+    }
+}
+
+void PruneHeaderOnlyBlocks(const std::vector<const CBlockIndex*>& vKeep)
+{
+    AssertLockHeld(cs_main);
+
+    // Keep the given blocks and their ancestors, and the parents of the blocks with data
+    // (mapBlocksUnlinked), up to the first ancestor with data
+    std::set<const CBlockIndex*> setKeep;
+    auto keepBranch = [&setKeep](const CBlockIndex* pindex) {
+        for (; pindex && !(pindex->nStatus & BLOCK_HAVE_DATA) && setKeep.insert(pindex).second; pindex = pindex->pprev) {}
+    };
+    for (const CBlockIndex* pindex : vKeep)
+        keepBranch(pindex);
+    for (const auto& it : mapBlocksUnlinked)
+        keepBranch(it.first);
+
+    // The ancestors of a kept entry are kept too, so no remaining entry points to an erased one
+    std::vector<CBlockIndex*> vErase;
+    for (CBlockIndex* pindex : setHeaderOnlyBlockIndex) {
+        if (!setKeep.count(pindex))
+            vErase.push_back(pindex);
+    }
+    if (vErase.empty())
+        return;
+
+    bool fBestHeaderErased = false;
+    for (CBlockIndex* pindex : vErase) {
+        assert(!(pindex->nStatus & BLOCK_HAVE_DATA));
+        const uint256 hash = pindex->GetBlockHash();
+        fBestHeaderErased |= (pindex == pindexBestHeader);
+        if (pindex == pindexBestInvalid)
+            pindexBestInvalid = nullptr;
+        if (pindex == pindexBestForkTip || pindex == pindexBestForkBase)
+            pindexBestForkTip = pindexBestForkBase = nullptr;
+        ErasePendingBlocks(hash);
+        setHeaderOnlyBlockIndex.erase(pindex);
+        setDirtyBlockIndex.erase(pindex);
+        setErasedBlockIndex.insert(hash);
+        mapBlockIndex.erase(hash);
+        delete pindex;
+    }
+
+    if (fBestHeaderErased) {
+        // The best header is now the best block with data, or the best remaining header
+        pindexBestHeader = chainActive.Tip();
+        for (CBlockIndex* pindex : setBlockIndexCandidates) {
+            if (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex))
+                pindexBestHeader = pindex;
+        }
+        for (CBlockIndex* pindex : setHeaderOnlyBlockIndex) {
+            if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+                pindexBestHeader = pindex;
+        }
+    }
+    LogPrint(BCLog::NET, "%s : dropped %u headers not served by any peer, best header %d\n", __func__, vErase.size(),
+             pindexBestHeader ? pindexBestHeader->nHeight : -1);
+}
+
+static bool ProcessNewBlockInternal(CValidationState& state, CNode* pfrom, const std::shared_ptr<const CBlock> pblock, CDiskBlockPos* dbp, bool* fAccepted, bool fRequested)
 {
     AssertLockNotHeld(cs_main);
 
@@ -3391,6 +3798,26 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_pt
             return error ("%s : CheckBlock FAILED for block %s, %s", __func__, pblock->GetHash().GetHex(), FormatStateMessage(state));
         }
 
+        // With parallel download, a block can arrive before its parent (which is needed
+        // to check the proof of stake): keep it until the parent is accepted, if we asked for it.
+        if (dbp == nullptr && pblock->GetHash() != consensus.hashGenesisBlock) {
+            BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
+            if (mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                if (mi->second->nStatus & BLOCK_FAILED_MASK)
+                    return state.DoS(100, error("%s : prev block %s is invalid, unable to add block %s", __func__,
+                                                pblock->hashPrevBlock.GetHex(), pblock->GetHash().GetHex()),
+                                     REJECT_INVALID, "bad-prevblk");
+                if (!fRequested) {
+                    LogPrint(BCLog::NET, "%s : ignoring unrequested block %s received before its parent\n", __func__, pblock->GetHash().ToString());
+                    if (fAccepted) *fAccepted = false;
+                    return true;
+                }
+                AddPendingBlock(pblock);
+                if (fAccepted) *fAccepted = true;
+                return true;
+            }
+        }
+
         // Store to disk
         CBlockIndex* pindex = nullptr;
         bool ret = AcceptBlock(*pblock, state, &pindex, dbp, checked);
@@ -3430,6 +3857,39 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_pt
     return true;
 }
 
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_ptr<const CBlock> pblock, CDiskBlockPos* dbp, bool* fAccepted, bool fRequested)
+{
+    if (!ProcessNewBlockInternal(state, pfrom, pblock, dbp, fAccepted, fRequested)) {
+        // The blocks waiting for an invalid one can't be valid either
+        if (state.IsInvalid() && !state.CorruptionPossible())
+            WITH_LOCK(cs_main, ErasePendingBlocks(pblock->GetHash()); );
+        return false;
+    }
+
+    // Process the blocks that were waiting for this one, in order
+    std::deque<uint256> queue;
+    queue.push_back(pblock->GetHash());
+    while (!queue.empty()) {
+        std::vector<std::shared_ptr<const CBlock>> vChildren = WITH_LOCK(cs_main, return PopPendingBlocks(queue.front()); );
+        queue.pop_front();
+        for (const std::shared_ptr<const CBlock>& pchild : vChildren) {
+            CValidationState stateChild;
+            if (!ProcessNewBlockInternal(stateChild, nullptr, pchild, nullptr, nullptr, true)) {
+                LogPrintf("%s : pending block %s not accepted: %s\n", __func__, pchild->GetHash().ToString(), FormatStateMessage(stateChild));
+                if (stateChild.IsInvalid() && !stateChild.CorruptionPossible()) {
+                    WITH_LOCK(cs_main, ErasePendingBlocks(pchild->GetHash()); );
+                    // Let the peers serving this branch be penalized
+                    GetMainSignals().BlockChecked(*pchild, stateChild);
+                }
+                continue;
+            }
+            queue.push_back(pchild->GetHash());
+        }
+    }
+
+    return true;
+}
+
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3528,6 +3988,125 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/** Undo the coins changes of a block, on a view where they may have been written only in part.
+ *  Unlike DisconnectBlock, the zerocoin state is left untouched (see ReplayBlocks). */
+static bool RollbackBlock(const CBlockIndex* pindex, CCoinsViewCache& view)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: ReadBlockFromDisk failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    CBlockUndo blockUndo;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || !UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+        return error("%s: failure reading undo data at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: block and undo data inconsistent", __func__);
+
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& hash = tx.GetHash();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            view.SpendCoin(COutPoint(hash, o));
+        }
+        if (tx.IsCoinBase() || tx.HasZerocoinSpendInputs())
+            continue;
+        CTxUndo& txundo = blockUndo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size())
+            return error("%s: transaction and undo data inconsistent", __func__);
+        for (unsigned int j = tx.vin.size(); j-- > 0;) {
+            // Writing a coin is idempotent: an unclean result is expected here
+            if (ApplyTxInUndo(std::move(txundo.vprevout[j]), view, tx.vin[j].prevout) == DISCONNECT_FAILED)
+                return error("%s: failure restoring the inputs of %s", __func__, hash.ToString());
+        }
+    }
+    view.SetBestBlock(pindex->pprev->GetBlockHash());
+    return true;
+}
+
+/** Apply the coins changes of a block, on a view where they may have been written in part. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& view)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: ReadBlockFromDisk failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+
+    for (const CTransactionRef& tx : block.vtx) {
+        if (!tx->IsCoinBase() && !tx->HasZerocoinSpendInputs()) {
+            for (const CTxIn& txin : tx->vin) {
+                view.SpendCoin(txin.prevout);
+            }
+        }
+        // Every addition may be an overwrite
+        AddCoins(view, *tx, pindex->nHeight, true);
+    }
+    view.SetBestBlock(pindex->GetBlockHash());
+    return true;
+}
+
+/** Bring the coins database back to a consistent state, if the last write of the
+ *  chainstate was interrupted: the blocks of the old tip are rolled back to the fork
+ *  point, and the ones of the new tip rolled forward. */
+bool ReplayBlocks(CCoinsView* view)
+{
+    LOCK(cs_main);
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty()) return true; // We're already in a consistent state.
+    if (hashHeads.size() != 2) return error("%s: unknown inconsistent state", __func__);
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    const CBlockIndex* pindexOld = nullptr;  // Old tip during the interrupted flush.
+    const CBlockIndex* pindexNew;            // New tip during the interrupted flush.
+    const CBlockIndex* pindexFork = nullptr; // Latest block common to both the old and the new tip.
+
+    BlockMap::const_iterator it = mapBlockIndex.find(hashHeads[0]);
+    if (it == mapBlockIndex.end())
+        return error("%s: reorganization to unknown block requested", __func__);
+    pindexNew = it->second;
+
+    if (!hashHeads[1].IsNull()) { // The old tip is allowed to be 0, indicating it's the first flush.
+        it = mapBlockIndex.find(hashHeads[1]);
+        if (it == mapBlockIndex.end())
+            return error("%s: reorganization from unknown block requested", __func__);
+        pindexOld = it->second;
+        const int nHeight = std::min(pindexOld->nHeight, pindexNew->nHeight);
+        pindexFork = pindexOld->GetAncestor(nHeight);
+        const CBlockIndex* pindexWalk = pindexNew->GetAncestor(nHeight);
+        while (pindexFork != pindexWalk) {
+            pindexFork = pindexFork->pprev;
+            pindexWalk = pindexWalk->pprev;
+        }
+        assert(pindexFork != nullptr);
+    }
+
+    CCoinsViewCache cache(view);
+
+    // Rollback along the old branch.
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) { // Never disconnect the genesis block.
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            if (!RollbackBlock(pindexOld, cache)) return false;
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the forking point to the new tip.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardBlock(pindex, cache)) return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    if (!cache.Flush())
+        return error("%s: failed to write the coins database", __func__);
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
 bool static LoadBlockIndexDB(std::string& strError)
 {
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
@@ -3578,8 +4157,13 @@ bool static LoadBlockIndexDB(std::string& strError)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            setHeaderOnlyBlockIndex.insert(pindex);
     }
 
+    // The headers stored without their block are not served by any peer yet
+    PruneHeaderOnlyBlocks(std::vector<const CBlockIndex*>());
+
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
@@ -3630,6 +4214,12 @@ bool static LoadBlockIndexDB(std::string& strError)
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
+    // Complete the last write of the chainstate, if it was interrupted
+    if (!ReplayBlocks(pcoinsdbview)) {
+        strError = "Unable to replay blocks. You will need to rebuild the database using -reindex.";
+        return false;
+    }
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -3754,6 +4344,11 @@ void UnloadBlockIndex()
     pindexBestHeader = NULL;
     mempool.clear();
     mapBlocksUnlinked.clear();
+    mapPendingBlocks.clear();
+    nPendingBlocksSize = 0;
+    setHeaderOnlyBlockIndex.clear();
+    setErasedBlockIndex.clear();
+    mapBlockSpends.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
     nBlockSequenceId = 1;
@@ -4112,6 +4707,127 @@ std::string CBlockFileInfo::ToString() const
     return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s)", nBlocks, nSize, nHeightFirst, nHeightLast, DateTimeStrFormat("%Y-%m-%d", nTimeFirst), DateTimeStrFormat("%Y-%m-%d", nTimeLast));
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool(CTxMemPool& pool)
+{
+    const int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    const int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransactionRef tx;
+            int64_t nTime;
+            double dPriorityDelta;
+            int64_t nFeeDelta;
+            file >> tx;
+            file >> nTime;
+            file >> dPriorityDelta;
+            file >> nFeeDelta;
+
+            if (dPriorityDelta || nFeeDelta) {
+                pool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), dPriorityDelta, nFeeDelta);
+            }
+            if (nTime + nExpiryTimeout > nNow) {
+                // Revalidate against the current tip, one transaction at a time
+                // (so that cs_main is not held for the whole import)
+                CValidationState state;
+                LOCK(cs_main);
+                if (AcceptToMemoryPoolWithTime(pool, state, tx, true, nullptr, nTime)) {
+                    ++count;
+                } else {
+                    ++failed;
+                }
+            } else {
+                ++skipped;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+        // Deltas of the transactions not in the mempool at dump time
+        std::map<uint256, std::pair<double, CAmount>> mapDeltas;
+        file >> mapDeltas;
+        for (const auto& i : mapDeltas) {
+            pool.PrioritiseTransaction(i.first, i.first.ToString(), i.second.first, i.second.second);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    return true;
+}
+
+bool DumpMempool(const CTxMemPool& pool)
+{
+    int64_t start = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount>> mapDeltas;
+    std::vector<std::pair<CTransactionRef, int64_t>> vTxs;
+    {
+        LOCK(pool.cs);
+        mapDeltas = pool.mapDeltas;
+        vTxs.reserve(pool.mapTx.size());
+        for (const CTxMemPoolEntry& entry : pool.mapTx) {
+            vTxs.emplace_back(entry.GetSharedTx(), entry.GetTime());
+        }
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        // Each transaction is followed by its entry time and its priority and fee
+        // deltas, so that it keeps its place for expiration and mining on load
+        file << (uint64_t)vTxs.size();
+        for (const auto& i : vTxs) {
+            const uint256& hash = i.first->GetHash();
+            auto it = mapDeltas.find(hash);
+            file << *(i.first);
+            file << i.second;
+            file << (it != mapDeltas.end() ? it->second.first : 0.0);
+            file << (int64_t)(it != mapDeltas.end() ? it->second.second : 0);
+            if (it != mapDeltas.end()) mapDeltas.erase(it);
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid - start) * 0.000001, (last - mid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
 
 class CMainCleanup
 {
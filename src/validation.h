@@ -39,6 +39,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBudgetManager;
 class CZerocoinDB;
 class CSporkDB;
@@ -63,6 +64,8 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** Default for -txindex */
 static const bool DEFAULT_TXINDEX = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
@@ -99,6 +102,14 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum size (in bytes) of the blocks received before their parent, kept in memory until they can be validated. */
+static const unsigned int MAX_PENDING_BLOCKS_SIZE = 64 * 1000 * 1000;
+/** Maximum number of blocks the chains known only by their headers can run ahead of the active chain
+ *  (PoS headers can't be authenticated without their blocks, as the kernel needs the coinstake). */
+static const int MAX_HEADERS_AHEAD = 2 * BLOCK_DOWNLOAD_WINDOW;
+/** Maximum number of validation notifications waiting for the background listeners
+ *  before ActivateBestChain waits for them to catch up. */
+static const size_t MAX_VALIDATION_CALLBACKS_PENDING = 2000;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -140,6 +151,8 @@ extern uint256 g_best_block;
 
 extern std::atomic<bool> fImporting;
 extern std::atomic<bool> fReindex;
+/** Whether the mempool of the last run was loaded (or didn't need to be): set once at startup */
+extern std::atomic<bool> g_is_mempool_loaded;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fCheckBlockIndex;
@@ -171,9 +184,20 @@ static const uint64_t nMinDiskSpace = 52428800;
  * @param[in]   pblock     The block we want to process.
  * @param[out]  dbp        If pblock is stored to disk (or already there), this will be set to its location.
  * @param[out]  fAccepted  Whether the block is accepted or not
+ * @param[in]   fRequested Whether the block was requested to pfrom: only requested blocks are kept when received before their parent
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_ptr<const CBlock> pblock, CDiskBlockPos* dbp, bool* fAccepted = nullptr);
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const std::shared_ptr<const CBlock> pblock, CDiskBlockPos* dbp, bool* fAccepted = nullptr, bool fRequested = false);
+/** Whether the block was received before its parent, and is waiting for it (requires cs_main) */
+bool IsBlockPending(const CBlockIndex* pindex);
+/** Whether no more blocks can be kept until their parent is received (requires cs_main) */
+bool IsPendingBlocksFull();
+/** Forget the blocks known only by their header, except the given ones and their ancestors: PoS headers can't
+ *  be authenticated without their blocks, so the header chains no peer serves anymore are dropped (requires cs_main).
+ *  The pruned entries are freed: vKeep must hold every header-only entry referenced outside of validation
+ *  (the peers' best known blocks, last headers, blocks in flight and blocks being reconstructed).
+ *  They are erased from the block tree database on the next flush. */
+void PruneHeaderOnlyBlocks(const std::vector<const CBlockIndex*>& vKeep);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -188,12 +212,18 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex(std::string& strError);
+/** Complete the last write of the chainstate to view, if it was interrupted (see CCoinsViewDB) */
+bool ReplayBlocks(CCoinsView* view);
 /** Unload database information */
 void UnloadBlockIndex();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Sapling proofs checking thread */
+void ThreadSaplingProofCheck();
+/** Run an instance of the zerocoin spends checking thread */
+void ThreadZerocoinSpendCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -220,6 +250,9 @@ void FlushStateToDisk();
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransactionRef& tx, bool fLimitFree, bool* pfMissingInputs, bool fOverrideMempoolLimit = false, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransactionRef& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit = false, bool fRejectInsaneFee = false, bool ignoreFees = false);
+
 int GetIXConfirmations(uint256 nTXHash);
 
 /** Convert CValidationState to a human-readable message for logging */
@@ -312,7 +345,13 @@ public:
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+/** Read an indexed block (trusting its header, once it matches the hash of the index) */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized block at pos as stored on disk (e.g. to relay it), without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos);
+
+/** Find, in the undo data of the active chain blocks above pindexFork, the coin spent by outpoint (requires cs_main) */
+bool GetCoinSpentAfterFork(const COutPoint& outpoint, const CBlockIndex* pindexFork, Coin& coinRet);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -333,7 +372,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
+bool CheckWork(const CBlock& block, CBlockIndex* const pindexPrev);
+/** Required work of a header, whose proof of work or stake type is given (only known from the transactions of the block) */
+bool CheckWork(const CBlockHeader& block, CBlockIndex* const pindexPrev, bool fProofOfWork);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev);
@@ -344,7 +385,10 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = nullptr, CBlockIndex* pindexPrev = nullptr);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = nullptr, CBlockIndex* pindexPrev = nullptr);
+
+/** Process incoming block headers (header-only validation: the proof of stake is checked once the block is received) */
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, CBlockIndex** ppindex = nullptr);
 
 
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
@@ -368,6 +412,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** Global variable that points to the coins database (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
@@ -404,4 +451,10 @@ static const unsigned int REJECT_ALREADY_KNOWN = 0x101;
 /** Transaction conflicts with a transaction already known */
 static const unsigned int REJECT_CONFLICT = 0x102;
 
+/** Load the mempool from disk (mempool.dat), revalidating each transaction */
+bool LoadMempool(CTxMemPool& pool);
+
+/** Dump the mempool to disk (mempool.dat), with entry times and priority and fee deltas */
+bool DumpMempool(const CTxMemPool& pool);
+
 #endif // BITCOIN_MAIN_H
@@ -5,10 +5,78 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "validationinterface.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "scheduler.h"
+#include "validation.h"
+
+#include <atomic>
+#include <future>
+
 #include <boost/bind.hpp>
+#include <boost/signals2/signal.hpp>
+
+struct MainSignalsInstance {
+    boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
+    boost::signals2::signal<void (const CTransaction &, const CBlockIndex *pindex, int posInBlock)> SyncTransaction;
+    boost::signals2::signal<void (const CTransaction &)> NotifyTransactionLock;
+    boost::signals2::signal<bool (const uint256 &)> UpdatedTransaction;
+    boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
+    boost::signals2::signal<void (CConnman* connman)> Broadcast;
+    boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    boost::signals2::signal<void (const uint256 &)> BlockFound;
+    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, Optional<SaplingMerkleTree>)> ChainTip;
+
+    // We are not allowed to assume the scheduler only runs in one thread,
+    // but must ensure all callbacks happen in-order, so we end up creating
+    // our own queue here :(
+    std::unique_ptr<SingleThreadedSchedulerClient> m_schedulerClient;
+
+    // Last tip the listeners have been notified of (by UpdatedBlockTip)
+    std::atomic<const CBlockIndex*> m_pindexNotified{nullptr};
+
+    // Queue func, or call it right away when there is no background scheduler
+    // (e.g. during the unit tests, or after shutdown unregistered it)
+    void Enqueue(std::function<void ()> func)
+    {
+        if (m_schedulerClient) {
+            m_schedulerClient->AddToProcessQueue(std::move(func));
+        } else {
+            func();
+        }
+    }
+};
 
 static CMainSignals g_signals;
 
+CMainSignals::CMainSignals() : m_internals(new MainSignalsInstance()) {}
+
+CMainSignals::~CMainSignals() {}
+
+void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler& scheduler)
+{
+    assert(!m_internals->m_schedulerClient);
+    m_internals->m_schedulerClient.reset(new SingleThreadedSchedulerClient(&scheduler));
+}
+
+void CMainSignals::UnregisterBackgroundSignalScheduler()
+{
+    m_internals->m_schedulerClient.reset();
+}
+
+void CMainSignals::FlushBackgroundCallbacks()
+{
+    if (m_internals->m_schedulerClient) {
+        m_internals->m_schedulerClient->EmptyQueue();
+    }
+}
+
+size_t CMainSignals::CallbacksPending()
+{
+    return m_internals->m_schedulerClient ? m_internals->m_schedulerClient->CallbacksPending() : 0;
+}
+
 CMainSignals& GetMainSignals()
 {
     return g_signals;
@@ -16,39 +84,116 @@ CMainSignals& GetMainSignals()
 
 void RegisterValidationInterface(CValidationInterface* pwalletIn)
 {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
-    g_signals.NotifyTransactionLock.connect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
-    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
+    g_signals.m_internals->UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->NotifyTransactionLock.connect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
+    g_signals.m_internals->UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.m_internals->SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+    g_signals.m_internals->Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
+    g_signals.m_internals->BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_signals.m_internals->BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn)
 {
-    g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
-    g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
-    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.NotifyTransactionLock.disconnect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
-    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
+    g_signals.m_internals->BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_signals.m_internals->Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
+    g_signals.m_internals->SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
+    g_signals.m_internals->UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.m_internals->NotifyTransactionLock.disconnect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
+    g_signals.m_internals->SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
+    g_signals.m_internals->UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
 }
 
 void UnregisterAllValidationInterfaces()
 {
-    g_signals.BlockFound.disconnect_all_slots();
-    g_signals.BlockChecked.disconnect_all_slots();
-    g_signals.Broadcast.disconnect_all_slots();
-    g_signals.SetBestChain.disconnect_all_slots();
-    g_signals.UpdatedTransaction.disconnect_all_slots();
-    g_signals.NotifyTransactionLock.disconnect_all_slots();
-    g_signals.SyncTransaction.disconnect_all_slots();
-    g_signals.ChainTip.disconnect_all_slots();
-    g_signals.UpdatedBlockTip.disconnect_all_slots();
+    g_signals.m_internals->BlockFound.disconnect_all_slots();
+    g_signals.m_internals->BlockChecked.disconnect_all_slots();
+    g_signals.m_internals->Broadcast.disconnect_all_slots();
+    g_signals.m_internals->SetBestChain.disconnect_all_slots();
+    g_signals.m_internals->UpdatedTransaction.disconnect_all_slots();
+    g_signals.m_internals->NotifyTransactionLock.disconnect_all_slots();
+    g_signals.m_internals->SyncTransaction.disconnect_all_slots();
+    g_signals.m_internals->ChainTip.disconnect_all_slots();
+    g_signals.m_internals->UpdatedBlockTip.disconnect_all_slots();
+}
+
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func)
+{
+    g_signals.m_internals->Enqueue(std::move(func));
+}
+
+void SyncWithValidationInterfaceQueue()
+{
+    AssertLockNotHeld(cs_main);
+    // Block until the validation queue drains
+    std::promise<void> promise;
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+    promise.get_future().wait();
+}
+
+void SyncWithValidationInterfaceTip(const CBlockIndex* pindex)
+{
+    if (pindex && g_signals.m_internals->m_pindexNotified == pindex)
+        return;
+    SyncWithValidationInterfaceQueue();
+}
+
+void CMainSignals::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    m_internals->Enqueue([this, pindexNew, pindexFork, fInitialDownload] {
+        m_internals->UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
+        m_internals->m_pindexNotified = pindexNew;
+    });
+}
+
+void CMainSignals::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex* pindex, int posInBlock)
+{
+    m_internals->Enqueue([this, ptx, pindex, posInBlock] {
+        m_internals->SyncTransaction(*ptx, pindex, posInBlock);
+    });
+}
+
+void CMainSignals::ChainTip(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock, Optional<SaplingMerkleTree> added)
+{
+    m_internals->Enqueue([this, pindex, pblock, added] {
+        m_internals->ChainTip(pindex, pblock.get(), added);
+    });
+}
+
+void CMainSignals::SetBestChain(const CBlockLocator& locator)
+{
+    m_internals->Enqueue([this, locator] {
+        m_internals->SetBestChain(locator);
+    });
+}
+
+void CMainSignals::NotifyTransactionLock(const CTransaction& tx)
+{
+    m_internals->NotifyTransactionLock(tx);
+}
+
+void CMainSignals::UpdatedTransaction(const uint256& hash)
+{
+    m_internals->UpdatedTransaction(hash);
+}
+
+void CMainSignals::Broadcast(CConnman* connman)
+{
+    m_internals->Broadcast(connman);
+}
+
+void CMainSignals::BlockChecked(const CBlock& block, const CValidationState& state)
+{
+    m_internals->BlockChecked(block, state);
+}
+
+void CMainSignals::BlockFound(const uint256& hash)
+{
+    m_internals->BlockFound(hash);
 }
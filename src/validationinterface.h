@@ -10,18 +10,20 @@
 #include "optional.h"
 #include "sapling/incrementalmerkletree.hpp"
 
-#include <boost/signals2/signal.hpp>
-#include <boost/shared_ptr.hpp>
+#include <functional>
+#include <memory>
 
 class CBlock;
 struct CBlockLocator;
 class CBlockIndex;
 class CConnman;
 class CReserveScript;
+class CScheduler;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
 
 // These functions dispatch to one or all registered wallets
 
@@ -31,6 +33,32 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/**
+ * Pushes a function to callback onto the notification queue, guaranteeing any
+ * callbacks generated prior to now are finished when the function is called.
+ *
+ * Be very careful blocking on func to be called if any locks are held -
+ * validation interface clients may not be able to make progress as they often
+ * wait for things like cs_main, so blocking until func is called with cs_main
+ * will result in a deadlock (that DEBUG_LOCKORDER will miss).
+ */
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
+/**
+ * This is a synonym for the following, which asserts certain locks are not
+ * held:
+ *     std::promise<void> promise;
+ *     CallFunctionInValidationInterfaceQueue([&promise] {
+ *         promise.set_value();
+ *     });
+ *     promise.get_future().wait();
+ */
+void SyncWithValidationInterfaceQueue();
+/**
+ * Wait until the listeners have caught up with pindex as the tip: returns at once
+ * if pindex is the last tip they have been notified of, drains the queue otherwise.
+ * pindex is normally a chainActive.Tip() read just before, with cs_main released.
+ */
+void SyncWithValidationInterfaceTip(const CBlockIndex* pindex);
 
 class CValidationInterface {
 protected:
@@ -48,29 +76,60 @@ protected:
     friend void ::UnregisterAllValidationInterfaces();
 };
 
-struct CMainSignals {
-// XX42    boost::signals2::signal<void(const uint256&)> EraseTransaction;
-    /** Notifies listeners of updated block chain tip */
-    boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
+struct MainSignalsInstance;
+
+/**
+ * Dispatcher of the validation notifications to the registered listeners.
+ * UpdatedBlockTip, SyncTransaction, ChainTip and SetBestChain are delivered in order
+ * by the background scheduler (once registered), so that the validation thread doesn't
+ * wait on the listeners while holding cs_main; the other notifications are delivered
+ * synchronously.
+ */
+class CMainSignals {
+private:
+    std::unique_ptr<MainSignalsInstance> m_internals;
+
+    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::UnregisterValidationInterface(CValidationInterface*);
+    friend void ::UnregisterAllValidationInterfaces();
+    friend void ::CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
+    friend void ::SyncWithValidationInterfaceTip(const CBlockIndex* pindex);
+
+public:
+    CMainSignals();
+    ~CMainSignals();
+
+    /** Register a CScheduler to give callbacks which should run in the background (may only be called once) */
+    void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+    /** Unregister a CScheduler to give callbacks which should run in the background
+     *  (the queued callbacks are then delivered synchronously again) */
+    void UnregisterBackgroundSignalScheduler();
+    /** Call any remaining callbacks on the calling thread */
+    void FlushBackgroundCallbacks();
+
+    size_t CallbacksPending();
+
     /** A posInBlock value for SyncTransaction which indicates the transaction was conflicted, disconnected, or not in a block */
     static const int SYNC_TRANSACTION_NOT_IN_BLOCK = -1;
+
+    /** Notifies listeners of updated block chain tip */
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload);
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
-    boost::signals2::signal<void (const CTransaction &, const CBlockIndex *pindex, int posInBlock)> SyncTransaction;
-    /** Notifies listeners of an updated transaction lock without new data. */
-    boost::signals2::signal<void (const CTransaction &)> NotifyTransactionLock;
-    /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
-    boost::signals2::signal<bool (const uint256 &)> UpdatedTransaction;
+    void SyncTransaction(const CTransactionRef& ptx, const CBlockIndex* pindex, int posInBlock);
+    /** Notifies listeners of a change to the tip of the active block chain. */
+    void ChainTip(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock, Optional<SaplingMerkleTree> added);
     /** Notifies listeners of a new active block chain. */
-    boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
+    void SetBestChain(const CBlockLocator& locator);
+    /** Notifies listeners of an updated transaction lock without new data. */
+    void NotifyTransactionLock(const CTransaction& tx);
+    /** Notifies listeners of updated transaction without new data (for now: a coinbase potentially becoming visible). */
+    void UpdatedTransaction(const uint256& hash);
     /** Tells listeners to broadcast their data. */
-    boost::signals2::signal<void (CConnman* connman)> Broadcast;
+    void Broadcast(CConnman* connman);
     /** Notifies listeners of a block validation result */
-    boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    void BlockChecked(const CBlock& block, const CValidationState& state);
     /** Notifies listeners that a block has been successfully mined */
-    boost::signals2::signal<void (const uint256 &)> BlockFound;
-
-    /** Notifies listeners of a change to the tip of the active block chain. */
-    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, Optional<SaplingMerkleTree>)> ChainTip;
+    void BlockFound(const uint256& hash);
 };
 
 CMainSignals& GetMainSignals();
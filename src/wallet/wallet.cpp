@@ -21,6 +21,11 @@
 #include "utilmoneystr.h"
 #include "zafochain.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
 
@@ -447,6 +452,7 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        const CBlock *pblock,
                        Optional<SaplingMerkleTree> added)
 {
+    LOCK2(cs_main, cs_wallet);
     if (added) {
         ChainTipAdded(pindex, pblock, added.get());
     } else {
@@ -933,6 +939,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
             fUpdated = true;
         }
     }
+    // Sapling: track the notes witnesses
+    m_sspk_man->AddToSaplingNoteTxes(wtx);
 
     //// debug print
     LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
@@ -967,6 +975,7 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     // Sapling
     m_sspk_man->UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+    m_sspk_man->AddToSaplingNoteTxes(wtx);
     wtxOrdered.emplace(wtx.nOrderPos, &wtx);
     AddToSpends(hash);
     for (const CTxIn& txin : wtx.vin) {
@@ -984,8 +993,10 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
  * Add a transaction to the wallet, or update it.
  * pblock is optional, but should be provided if the transaction is known to be in a block.
  * If fUpdate is true, existing transactions will be updated.
+ * pSaplingNotes is optional: the result of FindMySaplingNotes for tx, if already known.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate,
+                                       const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>* pSaplingNotes)
 {
     {
         AssertLockHeld(cs_wallet);
@@ -1009,7 +1020,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex
         // Check tx for Sapling notes
         mapSaplingNoteData_t saplingNoteData;
         if (HasSaplingSPKM()) {
-            auto saplingNoteDataAndAddressesToAdd = m_sspk_man->FindMySaplingNotes(tx);
+            auto saplingNoteDataAndAddressesToAdd = pSaplingNotes ? *pSaplingNotes : m_sspk_man->FindMySaplingNotes(tx);
             saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
             auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
             // Add my addresses
@@ -1168,7 +1179,8 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock)
 {
-    LOCK(cs_wallet);
+    // notified in the background: take cs_main first, as the callers holding cs_wallet do
+    LOCK2(cs_main, cs_wallet);
     if (!AddToWalletIfInvolvingMe(tx, pindex, posInBlock, true))
         return; // Not one of ours
 
@@ -1571,10 +1583,35 @@ bool CWallet::Upgrade(std::string& error, const int& prevVersion)
     return true;
 }
 
+/** Max number of threads reading and filtering the blocks ahead of a rescan */
+static const int MAX_RESCAN_THREADS = 8;
+/** Number of blocks read ahead of a rescan, per thread */
+static const int RESCAN_BLOCKS_PER_THREAD = 4;
+
+/** A block being rescanned, with the results of the filtering of its txes (done without cs_wallet) */
+struct CRescanBlock
+{
+    const CBlockIndex* pindex;
+    // dispatch order
+    int64_t nSeq;
+    bool fFiltered{false};
+    CBlock block;
+    // whether some outputs of the txes are mine
+    std::vector<bool> vOutputsMine;
+    // Sapling notes of the txes (empty if the wallet has no Sapling keys manager)
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vSaplingNotes;
+    // zerocoin mints of the block (only when reading zafo)
+    std::list<CZerocoinMint> listMints;
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ * Worker threads read the blocks ahead and filter their transactions (IsMine
+ * outputs, Sapling trial decryption, zerocoin mints) without the wallet lock,
+ * while this thread applies the results in order, locking cs_main and cs_wallet
+ * for one block at a time.
  * @returns -1 if process was cancelled or the number of tx added to the wallet.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fromStartup)
@@ -1587,7 +1624,11 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
 
     const Consensus::Params& consensus = Params().GetConsensus();
 
-    CBlockIndex* pindex = pindexStart;
+    const CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
+    // The keys the blocks are filtered with (key pool top-ups, imported keys, scripts and viewing keys):
+    // when they change, the blocks already dispatched are checked again in full.
+    uint64_t nKeysMark;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1598,34 +1639,163 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        std::set<uint256> setAddedToWallet;
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            if (fromStartup && ShutdownRequested()) {
-                return -1;
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        nKeysMark = GetAdditionsCount();
+    }
+
+    std::mutex mutexRescan;
+    std::condition_variable condRescan;
+    std::deque<std::shared_ptr<CRescanBlock>> queueToFilter;
+    bool fStopRescan = false;
+
+    auto filter = [&]() {
+        while (true) {
+            std::shared_ptr<CRescanBlock> prb;
+            {
+                std::unique_lock<std::mutex> lock(mutexRescan);
+                condRescan.wait(lock, [&] { return fStopRescan || !queueToFilter.empty(); });
+                if (fStopRescan) return;
+                prb = queueToFilter.front();
+                queueToFilter.pop_front();
             }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            int posInBlock;
-            for (posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++) {
-                if (AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate))
-                    ret++;
+            CRescanBlock& rb = *prb;
+            ReadBlockFromDisk(rb.block, rb.pindex);
+            rb.vOutputsMine.reserve(rb.block.vtx.size());
+            for (const CTransactionRef& ptx : rb.block.vtx) {
+                rb.vOutputsMine.push_back(IsMine(*ptx));
+            }
+            if (HasSaplingSPKM()) {
+                std::vector<const CTransaction*> vtx;
+                vtx.reserve(rb.block.vtx.size());
+                for (const CTransactionRef& ptx : rb.block.vtx) vtx.emplace_back(ptx.get());
+                rb.vSaplingNotes = m_sspk_man->FindMySaplingNotes(vtx);
+            }
+            //If this is a zapwallettx, need to read zafo
+            if (fCheckZAFO && consensus.NetworkUpgradeActive(rb.pindex->nHeight, Consensus::UPGRADE_ZC)) {
+                BlockToZerocoinMintList(rb.block, rb.listMints, true);
             }
 
-            // Will try to rescan it if zPIV upgrade is active.
-            doZAfoRescan(pindex, block, setAddedToWallet, consensus, fCheckZAFO);
+            {
+                std::lock_guard<std::mutex> lock(mutexRescan);
+                rb.fFiltered = true;
+            }
+            condRescan.notify_all();
+        }
+    };
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+    // Whether tx may concern the wallet through the txes already in it (requires cs_wallet)
+    auto IsInvolvingWalletTxes = [this](const CTransaction& tx) {
+        if (mapWallet.count(tx.GetHash())) return true;
+        for (const CTxIn& txin : tx.vin) {
+            if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout)) return true;
+        }
+        if (HasSaplingSPKM() && tx.isSapling() && tx.hasSaplingData()) {
+            for (const SpendDescription& spend : tx.sapData->vShieldedSpend) {
+                if (m_sspk_man->mapSaplingNullifiersToNotes.count(spend.nullifier)) return true;
+            }
+        }
+        return false;
+    };
+
+    // Stops and joins the workers on every way out, exceptions included (they use the locals above)
+    struct RescanWorkers {
+        std::mutex& mutex;
+        std::condition_variable& cond;
+        bool& fStop;
+        std::vector<std::thread> vThreads;
+        ~RescanWorkers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fStop = true;
             }
+            cond.notify_all();
+            for (std::thread& t : vThreads) t.join();
         }
+    } workers{mutexRescan, condRescan, fStopRescan, {}};
+
+    const size_t nThreads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS));
+    for (size_t i = 0; i < nThreads; i++) {
+        workers.vThreads.emplace_back(filter);
+    }
+
+    std::deque<std::shared_ptr<CRescanBlock>> queueInFlight;
+    int64_t nDispatched = 0;
+    int64_t nFullCheckUntil = 0;
+    std::set<uint256> setAddedToWallet;
+    const CBlockIndex* pindexNext = pindex;
+    while (true) {
+        // keep the workers busy
+        {
+            LOCK(cs_main);
+            std::lock_guard<std::mutex> lock(mutexRescan);
+            while (pindexNext && queueInFlight.size() < nThreads * RESCAN_BLOCKS_PER_THREAD) {
+                auto prb = std::make_shared<CRescanBlock>();
+                prb->pindex = pindexNext;
+                prb->nSeq = nDispatched++;
+                queueInFlight.push_back(prb);
+                queueToFilter.push_back(prb);
+                pindexNext = chainActive.Next(pindexNext);
+            }
+        }
+        condRescan.notify_all();
+        if (queueInFlight.empty()) break;
+
+        std::shared_ptr<CRescanBlock> prb = queueInFlight.front();
+        queueInFlight.pop_front();
+        {
+            std::unique_lock<std::mutex> lock(mutexRescan);
+            condRescan.wait(lock, [&] { return prb->fFiltered; });
+        }
+
+        if (fromStartup && ShutdownRequested()) {
+            ret = -1;
+            break;
+        }
+
+        LOCK2(cs_main, cs_wallet);
+        pindex = prb->pindex;
+        // disconnected in the meanwhile: the new chain is synced through the validation interface
+        if (!chainActive.Contains(pindex)) {
+            LogPrintf("Rescan interrupted by a chain reorganization at block %d\n", pindex->nHeight);
+            break;
+        }
+
+        if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+        // new keys (key pool top-ups, or imported over RPC), that the blocks in flight may have been filtered without
+        const uint64_t nKeysMarkNow = GetAdditionsCount();
+        if (nKeysMarkNow != nKeysMark) {
+            nKeysMark = nKeysMarkNow;
+            nFullCheckUntil = nDispatched;
+        }
+        const bool fFullCheck = prb->nSeq < nFullCheckUntil;
+
+        const CBlock& block = prb->block;
+        for (int posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++) {
+            const CTransaction& tx = *block.vtx[posInBlock];
+            const auto* pSaplingNotes = (fFullCheck || prb->vSaplingNotes.empty()) ? nullptr : &prb->vSaplingNotes[posInBlock];
+            if (!fFullCheck && !prb->vOutputsMine[posInBlock] && (!pSaplingNotes || pSaplingNotes->first.empty()) &&
+                    !IsInvolvingWalletTxes(tx)) {
+                continue;
+            }
+            if (AddToWalletIfInvolvingMe(tx, pindex, posInBlock, fUpdate, pSaplingNotes))
+                ret++;
+        }
+
+        // Will try to rescan it if zPIV upgrade is active.
+        doZAfoRescan(pindex, block, prb->listMints, setAddedToWallet);
+
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+        }
+    }
+
+    if (ret != -1) {
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
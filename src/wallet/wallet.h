@@ -103,6 +103,9 @@ class ScriptPubKeyMan;
 class SaplingScriptPubKeyMan;
 class SaplingNoteData;
 
+// Sapling map
+typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature {
     FEATURE_BASE = 10500, // the earliest version new wallets supports (only useful for getinfo's clientversion output)
@@ -570,7 +573,8 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose = true);
     bool LoadToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate,
+                                  const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>* pSaplingNotes = nullptr);
     void EraseFromWallet(const uint256& hash);
 
     /**
@@ -781,7 +785,8 @@ public:
     bool AddDeterministicSeed(const uint256& seed);
 
     // Par of the tx rescan process
-    void doZAfoRescan(const CBlockIndex* pindex, const CBlock& block, std::set<uint256>& setAddedToWallet, const Consensus::Params& consensus, bool fCheckZAFO);
+    // Add to the wallet the txes of listMints (the mints of block, when reading zafo) that are mine, and their spends
+    void doZAfoRescan(const CBlockIndex* pindex, const CBlock& block, const std::list<CZerocoinMint>& listMints, std::set<uint256>& setAddedToWallet);
 
     //- ZC Mints (Only for regtest)
     std::string MintZerocoin(CAmount nValue, CWalletTx& wtxNew, std::vector<CDeterministicMint>& vDMints, const CCoinControl* coinControl = NULL);
@@ -945,9 +950,6 @@ public:
     void setAbandoned() { hashBlock = ABANDON_HASH; }
 };
 
-// Sapling map
-typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
-
 /**
  * A transaction with a bunch of additional info that only the owner cares about.
  * It includes any unrecorded transactions needed to link it back to the block chain.
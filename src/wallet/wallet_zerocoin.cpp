@@ -96,59 +96,53 @@ bool CWallet::GetDeterministicSeed(const uint256& hashSeed, uint256& seedOut)
 }
 
 void CWallet::doZAfoRescan(const CBlockIndex* pindex, const CBlock& block,
-        std::set<uint256>& setAddedToWallet, const Consensus::Params& consensus, bool fCheckZAFO)
+        const std::list<CZerocoinMint>& listMints, std::set<uint256>& setAddedToWallet)
 {
-    //If this is a zapwallettx, need to read zafo
-    if (fCheckZAFO && consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_ZC)) {
-        std::list<CZerocoinMint> listMints;
-        BlockToZerocoinMintList(block, listMints, true);
-
-        int posInBlock = 0;
-        for (auto& m : listMints) {
-            if (IsMyMint(m.GetValue())) {
-                LogPrint(BCLog::LEGACYZC, "%s: found mint\n", __func__);
-                UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
-
-                // Add the transaction to the wallet
-                posInBlock = 0;
-                for (posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++) {
-                    const auto& tx = *(block.vtx[posInBlock]);
-                    uint256 txid = tx.GetHash();
-                    if (setAddedToWallet.count(txid) || mapWallet.count(txid))
-                        continue;
-                    if (txid == m.GetTxHash()) {
-                        CWalletTx wtx(this, tx);
-                        wtx.nTimeReceived = block.GetBlockTime();
-                        wtx.SetMerkleBranch(pindex, posInBlock);
-                        AddToWallet(wtx);
-                        setAddedToWallet.insert(txid);
-                    }
+    int posInBlock = 0;
+    for (auto& m : listMints) {
+        if (IsMyMint(m.GetValue())) {
+            LogPrint(BCLog::LEGACYZC, "%s: found mint\n", __func__);
+            UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
+
+            // Add the transaction to the wallet
+            posInBlock = 0;
+            for (posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++) {
+                const auto& tx = *(block.vtx[posInBlock]);
+                uint256 txid = tx.GetHash();
+                if (setAddedToWallet.count(txid) || mapWallet.count(txid))
+                    continue;
+                if (txid == m.GetTxHash()) {
+                    CWalletTx wtx(this, tx);
+                    wtx.nTimeReceived = block.GetBlockTime();
+                    wtx.SetMerkleBranch(pindex, posInBlock);
+                    AddToWallet(wtx);
+                    setAddedToWallet.insert(txid);
                 }
+            }
 
-                //Check if the mint was ever spent
-                int nHeightSpend = 0;
-                uint256 txidSpend;
-                CTransaction txSpend;
-                if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
-                    if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
-                        continue;
-
-                    CWalletTx wtx(this, txSpend);
-                    CBlockIndex* pindexSpend = chainActive[nHeightSpend];
-                    CBlock blockSpend;
-                    if (ReadBlockFromDisk(blockSpend, pindexSpend)) {
-                        posInBlock = 0;
-                        for (posInBlock = 0; posInBlock < (int)blockSpend.vtx.size(); posInBlock++) {
-                            auto &tx = blockSpend.vtx[posInBlock];
-                            if (tx->GetHash() == txidSpend)
-                                wtx.SetMerkleBranch(pindexSpend, posInBlock);
-                        }
+            //Check if the mint was ever spent
+            int nHeightSpend = 0;
+            uint256 txidSpend;
+            CTransaction txSpend;
+            if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
+                if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
+                    continue;
+
+                CWalletTx wtx(this, txSpend);
+                CBlockIndex* pindexSpend = chainActive[nHeightSpend];
+                CBlock blockSpend;
+                if (ReadBlockFromDisk(blockSpend, pindexSpend)) {
+                    posInBlock = 0;
+                    for (posInBlock = 0; posInBlock < (int)blockSpend.vtx.size(); posInBlock++) {
+                        auto &tx = blockSpend.vtx[posInBlock];
+                        if (tx->GetHash() == txidSpend)
+                            wtx.SetMerkleBranch(pindexSpend, posInBlock);
                     }
-
-                    wtx.nTimeReceived = pindexSpend->nTime;
-                    AddToWallet(wtx);
-                    setAddedToWallet.emplace(txidSpend);
                 }
+
+                wtx.nTimeReceived = pindexSpend->nTime;
+                AddToWallet(wtx);
+                setAddedToWallet.emplace(txidSpend);
             }
         }
     }
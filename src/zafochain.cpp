@@ -224,30 +224,92 @@ bool IsPubcoinInBlockchain(const uint256& hashPubcoin, uint256& txid)
     return zerocoinDB->ReadCoinMint(hashPubcoin, txid);
 }
 
+// The spend is in the blockchain if its block is in the active chain
+static bool IsSpendPosInChain(const CZerocoinSpendPos& spendPos, int& nHeightTx)
+{
+    BlockMap::const_iterator it = mapBlockIndex.find(spendPos.hashBlock);
+    if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+        return false;
+
+    nHeightTx = spendPos.nHeight;
+    return true;
+}
+
 bool IsSerialInBlockchain(const CBigNum& bnSerial, int& nHeightTx)
 {
-    uint256 txHash;
+    CZerocoinSpendPos spendPos;
     // if not in zerocoinDB then its not in the blockchain
-    if (!zerocoinDB->ReadCoinSpend(bnSerial, txHash))
+    if (!zerocoinDB->ReadCoinSpend(bnSerial, spendPos))
         return false;
 
-    return IsTransactionInChain(txHash, nHeightTx);
+    return IsSpendPosInChain(spendPos, nHeightTx);
 }
 
 bool IsSerialInBlockchain(const uint256& hashSerial, int& nHeightTx, uint256& txidSpend)
 {
-    CTransaction tx;
-    return IsSerialInBlockchain(hashSerial, nHeightTx, txidSpend, tx);
+    txidSpend.SetNull();
+    CZerocoinSpendPos spendPos;
+    // if not in zerocoinDB then its not in the blockchain
+    if (!zerocoinDB->ReadCoinSpend(hashSerial, spendPos))
+        return false;
+
+    txidSpend = spendPos.txid;
+    return IsSpendPosInChain(spendPos, nHeightTx);
 }
 
 bool IsSerialInBlockchain(const uint256& hashSerial, int& nHeightTx, uint256& txidSpend, CTransaction& tx)
 {
     txidSpend.SetNull();
+    CZerocoinSpendPos spendPos;
     // if not in zerocoinDB then its not in the blockchain
-    if (!zerocoinDB->ReadCoinSpend(hashSerial, txidSpend))
+    if (!zerocoinDB->ReadCoinSpend(hashSerial, spendPos))
+        return false;
+
+    txidSpend = spendPos.txid;
+    if (!IsSpendPosInChain(spendPos, nHeightTx))
         return false;
 
-    return IsTransactionInChain(txidSpend, nHeightTx, tx);
+    // the spending tx itself is read from its block (no need for -txindex)
+    CBlock block;
+    if (!ReadBlockFromDisk(block, mapBlockIndex[spendPos.hashBlock]))
+        return error("%s : failed to read block %s", __func__, spendPos.hashBlock.GetHex());
+    for (const CTransactionRef& ptx : block.vtx) {
+        if (ptx->GetHash() == txidSpend) {
+            tx = *ptx;
+            return true;
+        }
+    }
+    return error("%s : spend %s not found in block %s", __func__, txidSpend.GetHex(), spendPos.hashBlock.GetHex());
+}
+
+bool UpgradeZerocoinSpendsDB()
+{
+    AssertLockHeld(cs_main);
+
+    int nVersion = 0;
+    if (zerocoinDB->ReadCoinSpendsVersion(nVersion) && nVersion >= ZC_SPENDS_DB_VERSION)
+        return true;
+
+    std::vector<std::pair<uint256, uint256> > vLegacySpends;
+    if (!zerocoinDB->ReadLegacyCoinSpends(vLegacySpends))
+        return error("%s : failed to read the zerocoin spends", __func__);
+
+    LogPrintf("Upgrading %u zerocoin spends to version %d...\n", vLegacySpends.size(), ZC_SPENDS_DB_VERSION);
+    std::vector<std::pair<uint256, CZerocoinSpendPos> > vPositions;
+    std::vector<uint256> vErase;
+    for (const auto& it : vLegacySpends) {
+        // a spend whose tx can't be found in a block is not in the blockchain (same as before the upgrade)
+        CTransaction tx;
+        uint256 hashBlock;
+        BlockMap::const_iterator mi;
+        if (!GetTransaction(it.second, tx, hashBlock, true) || (mi = mapBlockIndex.find(hashBlock)) == mapBlockIndex.end()) {
+            vErase.emplace_back(it.first);
+            continue;
+        }
+        vPositions.emplace_back(it.first, CZerocoinSpendPos(it.second, hashBlock, mi->second->nHeight));
+    }
+
+    return zerocoinDB->UpgradeCoinSpends(vPositions, vErase);
 }
 
 std::string ReindexZerocoinDB()
@@ -270,6 +332,7 @@ std::string ReindexZerocoinDB()
     std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpendInfo;
     std::vector<std::pair<libzerocoin::PublicCoin, uint256> > vMintInfo;
     while (pindex) {
+        vSpendInfo.clear();
         uiInterface.ShowProgress(_("Reindexing zerocoin database..."), std::max(1, std::min(99, (int)((double)(pindex->nHeight - zc_start_height) / (double)(chainActive.Height() - zc_start_height) * 100))));
 
         if (pindex->nHeight % 1000 == 0)
@@ -328,11 +391,14 @@ std::string ReindexZerocoinDB()
             }
         }
 
-        // Flush the zerocoinDB to disk every 100 blocks
+        // Spends are recorded with their block (a few per block at most)
+        if (!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo, pindex->GetBlockHash(), pindex->nHeight))
+            return _("Error writing zerocoinDB to disk");
+
+        // Flush the mints to disk every 100 blocks
         if (pindex->nHeight % 100 == 0) {
-            if ((!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo)) || (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)))
+            if (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo))
                 return _("Error writing zerocoinDB to disk");
-            vSpendInfo.clear();
             vMintInfo.clear();
         }
 
@@ -341,7 +407,7 @@ std::string ReindexZerocoinDB()
     uiInterface.ShowProgress("", 100);
 
     // Final flush to disk in case any remaining information exists
-    if ((!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo)) || (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)))
+    if ((!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)) || !zerocoinDB->WriteCoinSpendsVersion(ZC_SPENDS_DB_VERSION))
         return _("Error writing zerocoinDB to disk");
 
     uiInterface.ShowProgress("", 100);
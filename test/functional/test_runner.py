@@ -101,8 +101,10 @@ BASE_SCRIPTS= [
 
     # vv Tests less than 60s vv
     'wallet_labels.py',                         # ~ 57 sec
+    'wallet_import_funds.py',                   # ~ 55 sec
     'rpc_signmessage.py',                       # ~ 54 sec
     'mempool_resurrect.py',                     # ~ 51 sec
+    'mempool_persist.py',                       # ~ 50 sec
     'rpc_budget.py',                            # ~ 50 sec
     'mempool_spend_coinbase.py',                # ~ 50 sec
     'rpc_signrawtransaction.py',                # ~ 50 sec
@@ -119,7 +121,6 @@ BASE_SCRIPTS= [
     # 'mempool_limit.py', # We currently don't limit our mempool_reorg
     # 'interface_zmq.py',
     # 'rpc_getchaintips.py',
-    # 'mempool_persist.py',
     # 'rpc_users.py',
     # 'p2p_mempool.py',
     # 'mining_prioritisetransaction.py',
@@ -166,6 +167,7 @@ LEGACY_SKIP_TESTS = [
     'interface_http.py',
     'interface_rest.py',
     'mempool_reorg.py',
+    'mempool_persist.py',
     'mempool_resurrect.py',
     'mempool_spend_coinbase.py',
     'p2p_disconnect_ban.py',
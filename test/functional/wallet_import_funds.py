@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The AllForOneBusiness developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+'''
+Tests the rescan of importaddress, importpubkey, importprivkey and importwallet.
+Node0 sends funds to addresses of node1, node2 and node3 import them (the
+rescans run without holding the wallet lock) and check the funds they found.
+'''
+
+import os
+
+from test_framework.test_framework import AllForOneBusinessTestFramework
+from test_framework.util import (
+    assert_equal,
+    DecimalAmt,
+    sync_blocks,
+)
+
+class ImportFundsTest(AllForOneBusinessTestFramework):
+
+    def set_test_params(self):
+        self.num_nodes = 4
+
+    def run_test(self):
+        self.log.info("Sending funds to the addresses of node 1")
+        addresses = [self.nodes[1].getnewaddress() for _ in range(3)]
+        for i, addr in enumerate(addresses):
+            self.nodes[0].sendtoaddress(addr, i + 1)
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+
+        balance = self.nodes[2].getbalance()
+        balance_watchonly = self.nodes[2].getbalance(1, True)
+
+        self.log.info("Importing a watch-only address")
+        self.nodes[2].importaddress(addresses[0], "watch", True)
+        assert_equal(self.nodes[2].getbalance(1, True), balance_watchonly + DecimalAmt(1))
+
+        self.log.info("Importing a public key")
+        pubkey = self.nodes[1].validateaddress(addresses[1])['pubkey']
+        self.nodes[2].importpubkey(pubkey, "pubkey", True)
+        assert_equal(self.nodes[2].getbalance(1, True), balance_watchonly + DecimalAmt(3))
+        assert_equal(self.nodes[2].getbalance(), balance)
+
+        self.log.info("Importing a private key")
+        self.nodes[2].importprivkey(self.nodes[1].dumpprivkey(addresses[2]), "privkey", True)
+        assert_equal(self.nodes[2].getbalance(), balance + DecimalAmt(3))
+        assert_equal(self.nodes[2].getreceivedbyaddress(addresses[2]), DecimalAmt(3))
+
+        self.log.info("Importing the wallet of node 1")
+        dump_file = os.path.join(self.options.tmpdir, "node1", "wallet.dump")
+        self.nodes[1].dumpwallet(dump_file)
+        balance = self.nodes[3].getbalance()
+        self.nodes[3].importwallet(dump_file)
+        assert_equal(self.nodes[3].getbalance(), balance + self.nodes[1].getbalance())
+        for i, addr in enumerate(addresses):
+            assert_equal(self.nodes[3].getreceivedbyaddress(addr), DecimalAmt(i + 1))
+
+        self.log.info("Checking the funds received after the imports")
+        self.nodes[0].sendtoaddress(addresses[0], 4)
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[2].getbalance(1, True), balance_watchonly + DecimalAmt(10))
+        assert_equal(self.nodes[3].getreceivedbyaddress(addresses[0]), DecimalAmt(5))
+
+
+if __name__ == '__main__':
+    ImportFundsTest().main()